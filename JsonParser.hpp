@@ -2,19 +2,32 @@
 #define JSON_PARSER_HPP_
 
 #include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <clocale>
 #include <cmath>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <filesystem>
 #include <fstream>
 #include <initializer_list>
-#include <map>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <stack>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -44,6 +57,79 @@
 #define JSON_PARSER_IO_BUFFER_SIZE 1024
 #endif
 
+// Vectorized scanning of contiguous input. Define JSON_PARSER_NO_SIMD to force
+// the scalar code path.
+#ifndef JSON_PARSER_NO_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define JSON_PARSER_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) ||                                  \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JSON_PARSER_SIMD_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define JSON_PARSER_SIMD_NEON
+#endif
+#endif
+
+#if defined(JSON_PARSER_SIMD_AVX2) || defined(JSON_PARSER_SIMD_SSE2) ||        \
+    defined(JSON_PARSER_SIMD_NEON)
+#define JSON_PARSER_SIMD
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Keeps error paths out of line, away from the parsing loops.
+#if defined(__GNUC__) || defined(__clang__)
+#define JSON_PARSER_COLD __attribute__((cold, noinline))
+#elif defined(_MSC_VER)
+#define JSON_PARSER_COLD __declspec(noinline)
+#else
+#define JSON_PARSER_COLD
+#endif
+
+// Define JSON_PARSER_STATS to collect JsonParseStats and JsonSerializeStats,
+// see JsonStatsHook. Counters are added through a pointer that may be null;
+// without JSON_PARSER_STATS they compile to nothing.
+#ifdef JSON_PARSER_STATS
+#define JSON_PARSER_COUNT(stats, field, n)                                     \
+  ((stats) != nullptr ? void((stats)->field += (n)) : void())
+#define JSON_PARSER_COUNT_MAX(stats, field, n)                                 \
+  ((stats) != nullptr && (stats)->field < (n) ? void((stats)->field = (n))     \
+                                              : void())
+#else
+#define JSON_PARSER_COUNT(stats, field, n) ((void)(stats))
+#define JSON_PARSER_COUNT_MAX(stats, field, n) ((void)(stats))
+#endif
+
+// Files are memory-mapped by parseJsonFile unless JSON_PARSER_NO_MMAP is
+// defined; platforms without support fall back to std::ifstream.
+#ifndef JSON_PARSER_NO_MMAP
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#define JSON_PARSER_MMAP_WIN32
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define JSON_PARSER_MMAP_POSIX
+#endif
+#endif
+
+// JsonNode::JsonFdOutputStream writes to POSIX file descriptors.
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <unistd.h>
+#define JSON_PARSER_FD_OUTPUT
+#endif
+
 /*
 clang-format off
 
@@ -51,16 +137,57 @@ Synopsis:
 
 constexpr struct JsonNull_t {} JsonNull;
 
+class JsonArena {
+public:
+  JsonArena(size_t chunkSize = 4096);
+  void *allocate(size_t size, size_t align = alignof(std::max_align_t));
+  void deallocate(void *, size_t);
+  void reserve(size_t);
+  void reset();
+  size_t capacity() const;
+};
+
+class JsonMappedFile {
+public:
+  JsonMappedFile();
+  explicit JsonMappedFile(const std::filesystem::path &);
+  JsonMappedFile(JsonMappedFile &&) noexcept;
+  JsonMappedFile &operator=(JsonMappedFile &&) noexcept;
+  bool isOpen() const;
+  const char *data() const;
+  size_t size() const;
+  std::string_view view() const;
+  void close();
+};
+
+class JsonKey {
+public:
+  static constexpr size_t InlineCapacity = 14;
+  JsonKey(std::string_view);
+  JsonKey(const std::string &);
+  JsonKey(const char *);
+  const char *data() const;
+  const char *c_str() const;
+  size_t size() const;
+  bool empty() const;
+  uint64_t hash() const;
+  operator std::string_view() const;
+  operator std::string() const;
+};
+
 using JsonStr_t = std::string;
-using JsonArr_t = std::vector<JsonNode>;
-using JsonObj_t = std::map<std::string, JsonNode>;
+using JsonArr_t = std::vector<JsonNode, JsonAllocator<JsonNode>>;
+// Flat map-like container of std::pair<JsonKey, JsonNode>, sorted by key
+// unless JSON_PARSER_OBJECT_INSERTION_ORDER is defined.
+using JsonObj_t = JsonObject<JsonNode, JsonObjInsertionOrder>;
 
 struct JsonKeyLiteral_t {
   std::string_view key;
-  JsonKeyLiteral_t(const std::string_view &k);
+  uint64_t hash;
+  constexpr JsonKeyLiteral_t(const std::string_view &k);
 };
 
-JsonKeyLiteral_t operator""_key(const char *key, size_t len);
+constexpr JsonKeyLiteral_t operator""_key(const char *key, size_t len);
 
 class JsonParserLocaleGuard {
 public:
@@ -86,6 +213,7 @@ public:
   template <size_t N> JsonNode(const char (&)[N]);
   JsonNode(const char *);
   JsonNode(std::string_view);
+  JsonNode(const JsonKey &);
   JsonNode(std::initializer_list<JsonNode>);
   JsonNode(std::initializer_list<std::pair<const JsonKeyLiteral_t, JsonNode>>);
   JsonNode(const ArrayLike &, const size_t n, size_t offset, stride);
@@ -97,13 +225,15 @@ public:
   ~JsonNode();
 
   void clear();
+  void recycle(JsonParser &);
 
   void swap(JsonNode &) noexcept;
 
   JsonNode &operator=(JsonNode);
 
   JsonStr_t &str();
-  const JsonStr_t &str() const;
+  std::string_view str() const;
+  std::string_view view() const;
   const char *c_str() const;
   JsonArr_t &arr();
   const JsonArr_t &arr() const;
@@ -118,14 +248,15 @@ public:
   const JsonNode &operator[](size_t) const;
   const JsonNode &at(size_t) const;
 
-  JsonNode &operator[](const std::string &);
-  JsonNode &at(const std::string &);
-  const JsonNode &operator[](const std::string &) const;
-  const JsonNode &at(const std::string &) const;
+  // Keys are std::string_view or JsonKeyLiteral_t
+  JsonNode &operator[](std::string_view);
+  JsonNode &at(std::string_view);
+  const JsonNode &operator[](std::string_view) const;
+  const JsonNode &at(std::string_view) const;
 
-  bool contains(const JsonStr_t &) const;
-  JsonObj_t::iterator find(const JsonStr_t &);
-  JsonObj_t::const_iterator find(const JsonStr_t &) const;
+  bool contains(std::string_view) const;
+  JsonObj_t::iterator find(std::string_view);
+  JsonObj_t::const_iterator find(std::string_view) const;
 
   size_t size() const;
 
@@ -141,21 +272,27 @@ public:
 
   template <typename T> T get() const;
   template <> bool get<bool>() const;
+  template <> std::string_view get<std::string_view>() const;
   template <> auto get<NumberLike>() const;
   template <> auto get<std::filesystem::path>() const;
   template <> auto get<ArrayLike>(const size_t n = -1, size_t offset = 0, const size_t stride = 1) const;
   template <> auto get<MapLike>() const;
+  template <typename T> size_t getInto(T *out, size_t n, size_t offset = 0, size_t stride = 1) const;
+  template <typename Contiguous> size_t getInto(Contiguous &&out, size_t offset = 0, size_t stride = 1) const;
 
-  template <typename T> auto get(const std::string &key) const;
-  template <typename T> auto get(const std::string &key, T &&fallback) const;
+  template <typename T> auto get(std::string_view key) const;
+  template <typename T> auto get(std::string_view key, T &&fallback) const;
 
   template <typename Derived> class JsonOutputStreamBase {
   public:
     void put(char);
     void put(char, size_t);
     void puts(const char *, size_t);
+    void flush();
   };
 
+  class JsonFdOutputStream; // POSIX only
+
   class Serializer {
   public:
     Serializer &precision(int);
@@ -163,20 +300,89 @@ public:
     Serializer &ascii(bool);
     Serializer &dump(std::ostream &);
     std::string dumps();
+    size_t dumpTo(char *buf, size_t cap);
+    size_t estimateSize() const;
+    Serializer &dumpParallel(std::ostream &, unsigned threadCount = 0);
+    std::string dumpsMsgPack();
   };
 
   Serializer serializer() const;
 };
 
+class JsonSaxHandler {
+public:
+  bool onNull();
+  bool onBool(bool);
+  bool onInt64(int64_t);
+  bool onUint64(uint64_t);
+  bool onDouble(double);
+  bool onString(std::string_view);
+  bool onKey(std::string_view);
+  bool onStartArray();
+  bool onStartArray(size_t); // optional, MessagePack only
+  bool onEndArray();
+  bool onStartObject();
+  bool onStartObject(size_t); // optional, MessagePack only
+  bool onEndObject();
+};
+
+class JsonProjection {
+public:
+  JsonProjection();
+  JsonProjection(std::initializer_list<std::string_view> paths);
+  JsonProjection &add(std::string_view path);
+};
+
+using JsonErrorCode = detail::JsonErrorCode;
+
+struct JsonParseResult {
+  JsonNode value;
+  size_t offset;
+  bool failed;
+  JsonErrorCode error;
+  explicit operator bool() const;
+  const char *message() const;
+};
+
 class JsonParser {
 public:
   JsonParser();
+  JsonParser(JsonArena &);
+  JsonParser &borrowStrings(bool);
+  JsonParser &internKeys(bool);
+  JsonParser &readAhead(bool);
   JsonNode parse(std::string_view, size_t *offset = nullptr);
   JsonNode parse(std::ifstream &, bool checkEnd = true);
   JsonNode parse(std::istream &, bool checkEnd = true);
+  JsonNode parse(const JsonMappedFile &, bool checkEnd = true);
+  JsonParseResult tryParse(std::string_view, size_t *offset = nullptr) noexcept;
+  JsonParseResult tryParse(const JsonMappedFile &, bool checkEnd = true) noexcept;
+  JsonNode parse(std::string_view, const JsonProjection &, size_t *offset = nullptr);
+  JsonNode parse(std::istream &, const JsonProjection &, bool checkEnd = true);
+  JsonNode parse(const JsonMappedFile &, const JsonProjection &, bool checkEnd = true);
   JsonNode streamParse(std::string_view, size_t *offset = nullptr, bool *isComplete = nullptr);
   JsonNode streamParse(std::ifstream &, bool *isComplete = nullptr);
   JsonNode streamParse(std::istream &, bool *isComplete = nullptr);
+  JsonNode streamParse(const JsonMappedFile &, bool *isComplete = nullptr);
+  JsonNode parseParallel(std::string_view, unsigned threadCount = 0);
+  bool feed(std::string_view chunk);
+  JsonNode finish();
+  void releasePool();
+
+  template <typename Handler> bool saxParse(std::string_view, Handler &, size_t *offset = nullptr);
+  template <typename Handler> bool saxParse(std::ifstream &, Handler &, bool checkEnd = true);
+  template <typename Handler> bool saxParse(std::istream &, Handler &, bool checkEnd = true);
+  template <typename Handler> bool saxParse(const JsonMappedFile &, Handler &, bool checkEnd = true);
+
+  JsonNode parseMsgPack(std::string_view, size_t *offset = nullptr);
+  JsonNode parseMsgPack(std::istream &);
+  JsonNode parseMsgPack(const JsonMappedFile &);
+  template <typename Handler> bool saxParseMsgPack(std::string_view, Handler &, size_t *offset = nullptr);
+
+  template <typename T> void parseInto(std::string_view, T &, size_t *offset = nullptr);
+  template <typename T> void parseInto(std::ifstream &, T &, bool checkEnd = true);
+  template <typename T> void parseInto(std::istream &, T &, bool checkEnd = true);
+  template <typename T> void parseInto(const JsonMappedFile &, T &, bool checkEnd = true);
 
   template <typename Derived> class JsonInputStreamBase {
   public:
@@ -192,9 +398,118 @@ public:
   template <typename Derived>
   JsonNode streamParse(JsonInputStreamBase<Derived> &, bool *isComplete = nullptr);
 
+  template <typename Derived, typename Handler>
+  bool saxParseMsgPack(JsonInputStreamBase<Derived> &, Handler &);
+
+};
+
+class JsonDocument {
+public:
+  JsonDocument();
+  JsonDocument(std::string_view, size_t *offset = nullptr);
+  JsonDocument(JsonDocument &&) noexcept;
+  JsonDocument &operator=(JsonDocument &&) noexcept;
+  void swap(JsonDocument &) noexcept;
+  JsonDocument &borrowStrings(bool);
+  void parse(std::string_view, size_t *offset = nullptr);
+  void parseFile(const std::filesystem::path &);
+  const JsonNode &root() const;
+  JsonNode &mutableRoot();
+  JsonArena &arena();
+  void clear();
+};
+
+class JsonReclaimer {
+public:
+  JsonReclaimer();
+  void retire(JsonNode &&);
+  void retire(JsonDocument &&);
+  void drain();
+  size_t pending() const;
+};
+
+class JsonLazyValue {
+public:
+  JsonType type() const;
+  bool isNull() const;
+  bool isBool() const;
+  bool isNum() const;
+  bool isStr() const;
+  bool isArr() const;
+  bool isObj() const;
+  size_t size() const;
+  JsonLazyValue operator[](size_t) const;
+  JsonLazyValue at(size_t) const;
+  JsonLazyValue operator[](std::string_view) const;
+  JsonLazyValue at(std::string_view) const;
+  bool contains(std::string_view) const;
+  std::string_view key() const;
+  iterator begin() const;
+  iterator end() const;
+  std::string_view str() const;
+  template <typename T> T get() const;
+  JsonNode toNode() const;
+};
+
+class JsonLazyDocument {
+public:
+  JsonLazyDocument();
+  explicit JsonLazyDocument(std::string_view);
+  void parse(std::string_view);
+  void parseFile(const std::filesystem::path &);
+  JsonLazyValue root() const;
+  JsonLazyValue operator[](size_t) const;
+  JsonLazyValue operator[](std::string_view) const;
+  void clear();
+};
+
+class JsonLinesReader {
+public:
+  JsonLinesReader(std::string_view, unsigned threadCount = 0, size_t batchSize = 1024);
+  JsonLinesReader(const std::filesystem::path &, unsigned threadCount = 0, size_t batchSize = 1024);
+  JsonLinesReader &borrowStrings(bool);
+  JsonLinesReader &internKeys(bool);
+  bool eof() const;
+  std::vector<JsonNode> &nextBatch();
+  template <typename F> size_t forEach(F &&);
+};
+
+#define JSON_PARSER_FIELDS(Type, fields...)
+
+template <typename T> class JsonValueSerializer {
+public:
+  JsonValueSerializer &precision(int);
+  JsonValueSerializer &ascii(bool);
+  const JsonValueSerializer &dump(JsonOutputStreamBase<Derived> &) const;
+  std::string dumps() const;
+  size_t dumpTo(char *buf, size_t cap) const;
+};
+
+template <typename T> JsonValueSerializer<T> jsonSerializer(const T &);
+
+template <typename Derived> class JsonWriter {
+public:
+  explicit JsonWriter(JsonOutputStreamBase<Derived> &);
+  JsonWriter &precision(int);
+  JsonWriter &indent(int);
+  JsonWriter &ascii(bool);
+  JsonWriter &beginArray();
+  JsonWriter &endArray();
+  JsonWriter &beginObject();
+  JsonWriter &endObject();
+  JsonWriter &key(std::string_view);
+  JsonWriter &value(std::nullptr_t);
+  JsonWriter &value(bool);
+  template <typename T> JsonWriter &value(T); // arithmetic
+  JsonWriter &value(std::string_view);
+  JsonWriter &value(const JsonNode &);
+  bool complete() const;
+  void flush();
 };
 
 JsonNode parseJsonString(std::string_view inputView, size_t *offset = nullptr);
+JsonDocument parseJsonDocument(std::string_view inputView, size_t *offset = nullptr);
+JsonDocument parseJsonDocumentFile(const std::filesystem::path &filename, bool borrowStrings = false);
 JsonNode parseJsonFile(const std::filesystem::path &filename, bool checkEnd = true);
 JsonNode parseJsonFile(std::ifstream &is, bool checkEnd = true);
 
@@ -213,1832 +528,8096 @@ inline constexpr struct JsonNull_t {
 } JsonNull;
 
 class JsonNode;
+class JsonParser;
+template <typename T> class JsonValueSerializer;
+struct JsonParseStats;
+struct JsonSerializeStats;
+
+// Bump allocator backing the containers and strings of a JsonDocument.
+// Individual deallocations are no-ops; all memory is returned at once by
+// reset() or the destructor. Not thread-safe.
+class JsonArena {
+public:
+  explicit JsonArena(size_t chunkSize = 4096) : m_nextChunkSize(chunkSize) {}
+  JsonArena(const JsonArena &) = delete;
+  JsonArena &operator=(const JsonArena &) = delete;
 
-using JsonStr_t = std::string;
-using JsonArr_t = std::vector<JsonNode>;
-using JsonObj_t = std::map<std::string, JsonNode>;
-
-struct JsonKeyLiteral_t {
-  std::string_view key;
-  JsonKeyLiteral_t(const std::string_view &k) : key(k) {}
-};
+  ~JsonArena() { freeChunks(nullptr); }
 
-inline JsonKeyLiteral_t operator""_key(const char *key, size_t len) {
-  return JsonKeyLiteral_t{std::string_view(key, len)};
-}
+  void *allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    size_t pad = (align - reinterpret_cast<uintptr_t>(m_cur) % align) % align;
+    if (pad + size > static_cast<size_t>(m_end - m_cur)) {
+      addChunk(size + align);
+      pad = (align - reinterpret_cast<uintptr_t>(m_cur) % align) % align;
+    }
+    char *p = m_cur + pad;
+    m_cur = p + size;
+    return p;
+  }
 
-enum class JsonType : uint8_t {
-  Null = 0,
-  Bool,
-  Num,
-  Str,
-  Arr,
-  Obj,
-};
+  void deallocate(void *, size_t) {}
 
-namespace detail {
+  // Makes sure the next allocations up to size bytes need no new chunk.
+  void reserve(size_t size) {
+    if (size > static_cast<size_t>(m_end - m_cur))
+      addChunk(size);
+  }
 
-enum class JsonErrorCode : uint8_t {
-  InvalidJson = 0,
-  UnexpectedEndOfInput,
-  InvalidLiteral,
-  InvalidNumber,
-  InvalidString,
-  InvalidCharacter,
-  InvalidUnicode,
-  InvalidEscapeSequence,
-  InvalidKeyValuePair,
-  InvalidArrayOrObject,
+  // Frees all chunks but the last one, which is kept for reuse.
+  void reset() {
+    if (m_chunk == nullptr)
+      return;
+    freeChunks(m_chunk);
+    m_chunk->prev = nullptr;
+    m_cur = reinterpret_cast<char *>(m_chunk + 1);
+  }
 
-  InvalidJsonAccess,
-};
+  // Total bytes of chunk memory currently held.
+  size_t capacity() const {
+    size_t n = 0;
+    for (auto c = m_chunk; c != nullptr; c = c->prev)
+      n += c->size;
+    return n;
+  }
 
-inline const char *JsonErrorMsg[]{
-    "invalid json",           "unexpected end of input",
-    "invalid literal",        "invalid number",
-    "invalid string",         "invalid character",
-    "invalid unicode",        "invalid escape sequence",
-    "invalid key-value pair", "invalid array or object",
-    "invalid json access",
-};
+private:
+  struct alignas(std::max_align_t) Chunk {
+    Chunk *prev;
+    size_t size;
+  };
 
-inline const char *getJsonErrorMsg(JsonErrorCode code) {
-  return JsonErrorMsg[static_cast<uint8_t>(code)];
-}
-}; // namespace detail
+  void addChunk(size_t minSize) {
+    size_t size = std::max(minSize, m_nextChunkSize);
+    if (m_nextChunkSize < (size_t(64) << 20))
+      m_nextChunkSize *= 2;
+    auto c = static_cast<Chunk *>(::operator new(sizeof(Chunk) + size));
+    c->prev = m_chunk;
+    c->size = size;
+    m_chunk = c;
+    m_cur = reinterpret_cast<char *>(c + 1);
+    m_end = m_cur + size;
+  }
 
-// If the locale is not "C", the parser may fail to parse floating-point numbers
-// and the serializer may produce non-standard JSON strings. This class is used
-// to temporarily set the locale to "C" during parsing and serialization with
-// RAII (not thread-safe).
-class JsonParserLocaleGuard {
-public:
-  JsonParserLocaleGuard() : m_backup(std::locale()) {
-    std::locale::global(std::locale::classic());
+  void freeChunks(Chunk *keep) {
+    for (auto c = m_chunk; c != nullptr;) {
+      auto prev = c->prev;
+      if (c != keep)
+        ::operator delete(c);
+      c = prev;
+    }
+    m_chunk = keep;
+    if (keep == nullptr)
+      m_cur = m_end = nullptr;
   }
-  ~JsonParserLocaleGuard() { std::locale::global(m_backup); }
 
 private:
-  std::locale m_backup;
+  Chunk *m_chunk = nullptr;
+  char *m_cur = nullptr;
+  char *m_end = nullptr;
+  size_t m_nextChunkSize;
 };
 
-class JsonNode {
-  friend class JsonParser;
+// Read-only mapping of a whole file. isOpen() is false if the file could not
+// be mapped (missing, empty, not a regular file, or no platform support).
+class JsonMappedFile {
+public:
+  JsonMappedFile() = default;
+  explicit JsonMappedFile(const std::filesystem::path &filename) {
+    open(filename);
+  }
 
-private:
-  struct TraverseState {
-    JsonNode *node;
-    union {
-      JsonArr_t::iterator arrIt;
-      JsonObj_t::iterator objIt;
-    };
+  JsonMappedFile(const JsonMappedFile &) = delete;
+  JsonMappedFile &operator=(const JsonMappedFile &) = delete;
 
-    TraverseState(JsonNode *n) : node(n) {
-      if (n->isArr())
-        arrIt = n->val_.a->begin();
-      else if (n->isObj())
-        objIt = n->val_.o->begin();
+  JsonMappedFile(JsonMappedFile &&other) noexcept
+      : m_data(std::exchange(other.m_data, nullptr)),
+        m_size(std::exchange(other.m_size, 0)),
+        m_open(std::exchange(other.m_open, false)) {}
+
+  JsonMappedFile &operator=(JsonMappedFile &&other) noexcept {
+    if (this != &other) {
+      close();
+      m_data = std::exchange(other.m_data, nullptr);
+      m_size = std::exchange(other.m_size, 0);
+      m_open = std::exchange(other.m_open, false);
     }
-  };
+    return *this;
+  }
 
-  struct ConstTraverseState {
-    const JsonNode *node;
-    union {
-      JsonArr_t::const_iterator arrIt;
-      JsonObj_t::const_iterator objIt;
-    };
+  ~JsonMappedFile() { close(); }
 
-    ConstTraverseState(const JsonNode *n) : node(n) {
-      if (n->isArr())
-        arrIt = n->val_.a->cbegin();
-      else if (n->isObj())
-        objIt = n->val_.o->cbegin();
+  bool isOpen() const { return m_open; }
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  std::string_view view() const { return {m_data, m_size}; }
+
+  void close() {
+    if (m_data != nullptr) {
+#if defined(JSON_PARSER_MMAP_WIN32)
+      UnmapViewOfFile(m_data);
+#elif defined(JSON_PARSER_MMAP_POSIX)
+      munmap(const_cast<char *>(m_data), m_size);
+#endif
     }
-  };
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+  }
 
-  // Traits
 private:
-  template <typename T> struct is_signed_integral {
-    static constexpr bool value =
-        std::is_integral_v<T> && std::is_signed_v<T> &&
-        !std::is_same_v<T, char> && !std::is_same_v<T, bool>;
-  };
-  template <typename T>
-  static constexpr bool is_signed_integral_v = is_signed_integral<T>::value;
+  void open(const std::filesystem::path &filename) {
+#if defined(JSON_PARSER_MMAP_WIN32)
+    HANDLE file = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      return;
+    LARGE_INTEGER size;
+    if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &size) &&
+        static_cast<uint64_t>(size.QuadPart) <= SIZE_MAX) {
+      m_size = static_cast<size_t>(size.QuadPart);
+      HANDLE mapping =
+          m_size == 0 ? nullptr
+                      : CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0,
+                                           nullptr);
+      if (mapping != nullptr) {
+        m_data = static_cast<const char *>(
+            MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        m_open = m_data != nullptr;
+        CloseHandle(mapping);
+      }
+    }
+    CloseHandle(file);
+#elif defined(JSON_PARSER_MMAP_POSIX)
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+      return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      m_size = static_cast<size_t>(st.st_size);
+      // Empty files cannot be mapped, and files like those in /proc report a
+      // size of zero. Both are left to the stream fallback.
+      if (m_size != 0) {
+        void *p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+          madvise(p, m_size, MADV_SEQUENTIAL);
+#endif
+          m_data = static_cast<const char *>(p);
+          m_open = true;
+        }
+      }
+    }
+    ::close(fd);
+#else
+    (void)filename;
+#endif
+    if (!m_open)
+      m_size = 0;
+  }
 
-  template <typename T> struct is_unsigned_integral {
-    static constexpr bool value =
-        std::is_integral_v<T> && std::is_unsigned_v<T> &&
-        !std::is_same_v<T, char> && !std::is_same_v<T, bool>;
-  };
-  template <typename T>
-  static constexpr bool is_unsigned_integral_v = is_unsigned_integral<T>::value;
+private:
+  const char *m_data = nullptr;
+  size_t m_size = 0;
+  bool m_open = false;
+};
 
-  template <typename T, typename = void>
-  struct has_subscript_op : std::false_type {};
-  template <typename T>
-  struct has_subscript_op<T,
-                          std::void_t<decltype(std::declval<T &>()[size_t{1}])>>
-      : std::true_type {};
-  template <typename T>
-  static constexpr bool has_subscript_op_v = has_subscript_op<T>::value;
+namespace detail {
 
-  template <typename T>
-  using resize_op_t = decltype(std::declval<T>().resize(size_t{}));
-  template <typename T, typename = void>
-  struct has_resize_op : std::false_type {};
-  template <typename T>
-  struct has_resize_op<T, std::void_t<resize_op_t<T>>> : std::true_type {};
-  template <typename T>
-  static constexpr bool has_resize_op_v = has_resize_op<T>::value;
+// Allocates from a JsonArena, or from the global heap when no arena is set.
+// Copies of a container always go back to the heap.
+template <typename T> class JsonAllocator {
+public:
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  JsonAllocator() noexcept = default;
+  JsonAllocator(JsonArena *arena) noexcept : m_arena(arena) {}
+  template <typename U>
+  JsonAllocator(const JsonAllocator<U> &other) noexcept
+      : m_arena(other.arena()) {}
+
+  T *allocate(size_t n) {
+    if (m_arena != nullptr)
+      return static_cast<T *>(m_arena->allocate(n * sizeof(T), alignof(T)));
+    return std::allocator<T>{}.allocate(n);
+  }
 
-  template <typename T, typename = void> struct get_value_type {
-    using type = std::remove_reference_t<decltype(std::declval<T &>()[0])>;
-  };
-  template <typename T>
-  struct get_value_type<T, std::void_t<typename T::value_type>> {
-    using type = typename T::value_type;
-  };
-  template <typename T>
-  using get_value_type_t = typename get_value_type<T>::type;
+  void deallocate(T *p, size_t n) {
+    if (m_arena != nullptr)
+      m_arena->deallocate(p, n * sizeof(T));
+    else
+      std::allocator<T>{}.deallocate(p, n);
+  }
 
-  template <typename T, typename = void>
-  struct has_size_op : std::false_type {};
-  template <typename T>
-  struct has_size_op<T, std::void_t<decltype(std::declval<T>().size())>>
-      : std::true_type {};
-  template <typename T>
-  static constexpr bool has_size_op_v = has_size_op<T>::value;
+  JsonAllocator select_on_container_copy_construction() const { return {}; }
 
-  template <typename T, typename = void>
-  struct has_length_op : std::false_type {};
-  template <typename T>
-  struct has_length_op<T, std::void_t<decltype(std::declval<T>().length())>>
-      : std::true_type {};
-  template <typename T>
-  static constexpr bool has_static_length_op_v = has_length_op<T>::value;
+  JsonArena *arena() const noexcept { return m_arena; }
 
-  template <typename T>
-  static constexpr bool is_unresizable_sequence_container_v =
-      has_subscript_op_v<T> && !has_resize_op_v<T> && !std::is_pointer_v<T>;
+  template <typename U> bool operator==(const JsonAllocator<U> &other) const {
+    return m_arena == other.arena();
+  }
+  template <typename U> bool operator!=(const JsonAllocator<U> &other) const {
+    return m_arena != other.arena();
+  }
 
-  template <typename T>
-  static constexpr bool is_resizable_sequence_container_v =
-      has_subscript_op_v<T> && has_resize_op_v<T> && !std::is_pointer_v<T> &&
-      !std::is_same_v<T, std::string>;
+private:
+  JsonArena *m_arena = nullptr;
+};
 
-  template <typename T, typename = void>
-  struct is_associative_container : std::false_type {};
-  template <typename T>
-  struct is_associative_container<
-      T, std::void_t<typename T::key_type, typename T::mapped_type,
-                     decltype(std::declval<T &>().emplace(
-                         std::declval<typename T::key_type>(),
-                         std::declval<typename T::mapped_type>()))>>
-      : std::true_type {};
-  template <typename T>
-  static constexpr bool is_associative_container_v =
-      is_associative_container<T>::value;
+constexpr uint64_t hashJsonKey(std::string_view key) {
+  uint64_t h = 14695981039346656037ull; // FNV-1a
+  for (char c : key) {
+    h ^= static_cast<uint8_t>(c);
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+
+class JsonKeyTable;
+
+} // namespace detail
+
+// Key of an object member, a read-only string. Keys of up to InlineCapacity
+// bytes are stored in place, longer ones in a reference-counted buffer along
+// with their hash. Copies share the buffer, and parsers with internKeys() set
+// use one buffer for every occurrence of a key. Parsers with borrowStrings()
+// set leave long keys without escapes in the input instead; copies of such a
+// key own its characters.
+class JsonKey {
+  // Strings, string views and C strings compare as text.
+  template <typename S>
+  using EnableIfText =
+      std::enable_if_t<!std::is_same_v<S, JsonKey> &&
+                       std::is_convertible_v<const S &, std::string_view>>;
 
-  // Constructors
 public:
-  JsonNode() = default;
+  static constexpr size_t InlineCapacity = 14;
 
-  JsonNode(JsonNull_t) : ty_(NullType_), val_() {}
+  JsonKey() noexcept { std::memset(m_buf, 0, sizeof(m_buf)); }
+  JsonKey(std::string_view key) { init(key); }
+  JsonKey(const std::string &key) : JsonKey(std::string_view(key)) {}
+  JsonKey(const char *key) : JsonKey(std::string_view(key)) {}
 
-  JsonNode(bool b) : ty_(BoolType_) { val_.b = b; }
+  JsonKey(const JsonKey &other) {
+    if (other.isBorrowed()) {
+      init(other);
+      return;
+    }
+    std::memcpy(m_buf, other.m_buf, sizeof(m_buf));
+    if (isShared())
+      shared()->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  JsonKey(JsonKey &&other) noexcept {
+    std::memcpy(m_buf, other.m_buf, sizeof(m_buf));
+    std::memset(other.m_buf, 0, sizeof(other.m_buf));
+  }
+  JsonKey &operator=(const JsonKey &other) {
+    JsonKey(other).swap(*this);
+    return *this;
+  }
+  JsonKey &operator=(JsonKey &&other) noexcept {
+    JsonKey(std::move(other)).swap(*this);
+    return *this;
+  }
+  ~JsonKey() {
+    if (!isShared())
+      return;
+    Shared *s = shared();
+    if (s->refs.load(std::memory_order_acquire) == 1 ||
+        s->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      s->~Shared();
+      ::operator delete(s);
+    }
+  }
 
-  JsonNode(const JsonStr_t &str) : ty_(StrType_) {
-    val_.s = new JsonStr_t(str);
+  void swap(JsonKey &other) noexcept {
+    char tmp[sizeof(m_buf)];
+    std::memcpy(tmp, m_buf, sizeof(m_buf));
+    std::memcpy(m_buf, other.m_buf, sizeof(m_buf));
+    std::memcpy(other.m_buf, tmp, sizeof(m_buf));
   }
 
-  JsonNode(JsonStr_t &&str) : ty_(StrType_) {
-    val_.s = new JsonStr_t(std::move(str));
+  const char *data() const {
+    if (isShared())
+      return reinterpret_cast<const char *>(shared() + 1);
+    return isBorrowed() ? borrowed() : m_buf;
+  }
+  // Throws std::logic_error for keys borrowed from the parser input, which
+  // are not null-terminated.
+  const char *c_str() const {
+    if (isBorrowed())
+      throw std::logic_error("JsonKey::c_str: key borrowed from the input");
+    return data();
+  }
+  size_t size() const {
+    if (isShared())
+      return shared()->size;
+    if (isBorrowed()) {
+      uint32_t size;
+      std::memcpy(&size, m_buf + sizeof(const char *), sizeof(size));
+      return size;
+    }
+    return static_cast<size_t>(m_buf[Tag]);
   }
+  size_t length() const { return size(); }
+  bool empty() const { return size() == 0; }
+  const char *begin() const { return data(); }
+  const char *end() const { return data() + size(); }
+
+  operator std::string_view() const { return {data(), size()}; }
+  operator std::string() const { return {data(), size()}; }
+
+  // The read-only members of std::string that keys had before JsonKey.
+  static constexpr size_t npos = std::string_view::npos;
+  std::string substr(size_t pos = 0, size_t n = npos) const {
+    return std::string(std::string_view(*this).substr(pos, n));
+  }
+  size_t find(std::string_view s, size_t pos = 0) const {
+    return std::string_view(*this).find(s, pos);
+  }
+  size_t find(char c, size_t pos = 0) const {
+    return std::string_view(*this).find(c, pos);
+  }
+  size_t rfind(std::string_view s, size_t pos = npos) const {
+    return std::string_view(*this).rfind(s, pos);
+  }
+  size_t rfind(char c, size_t pos = npos) const {
+    return std::string_view(*this).rfind(c, pos);
+  }
+  char operator[](size_t i) const { return data()[i]; }
 
-  JsonNode(const std::filesystem::path &path) : ty_(StrType_) {
-#if __cplusplus >= 202002L
-    auto u8path = path.u8string();
-    val_.s = new JsonStr_t(u8path.begin(), u8path.end());
-#else
-    val_.s = new JsonStr_t(path.u8string());
-#endif
+  uint64_t hash() const {
+    return isShared() ? shared()->hash
+                      : detail::hashJsonKey(std::string_view(*this));
   }
 
-  JsonNode(const JsonArr_t &arr) : ty_(ArrType_) {
-    val_.a = new JsonArr_t(arr);
+  int compare(std::string_view other) const {
+    return std::string_view(*this).compare(other);
   }
-  JsonNode(JsonArr_t &&arr) : ty_(ArrType_) {
-    val_.a = new JsonArr_t(std::move(arr));
+
+  friend bool operator==(const JsonKey &a, const JsonKey &b) {
+    if (a.isInline() && b.isInline())
+      return std::memcmp(a.m_buf, b.m_buf, sizeof(a.m_buf)) == 0;
+    if (a.isShared() && b.isShared()) {
+      if (a.shared() == b.shared())
+        return true;
+      if (a.shared()->hash != b.shared()->hash)
+        return false;
+    }
+    return a.size() == b.size() &&
+           std::memcmp(a.data(), b.data(), a.size()) == 0;
+  }
+  template <typename S, typename = EnableIfText<S>>
+  friend bool operator==(const JsonKey &a, const S &s) {
+    std::string_view b(s);
+    return a.size() == b.size() &&
+           (a.data() == b.data() ||
+            std::memcmp(a.data(), b.data(), b.size()) == 0);
+  }
+  template <typename S, typename = EnableIfText<S>>
+  friend bool operator==(const S &a, const JsonKey &b) {
+    return b == a;
+  }
+  friend bool operator!=(const JsonKey &a, const JsonKey &b) {
+    return !(a == b);
+  }
+  template <typename S, typename = EnableIfText<S>>
+  friend bool operator!=(const JsonKey &a, const S &b) {
+    return !(a == b);
+  }
+  template <typename S, typename = EnableIfText<S>>
+  friend bool operator!=(const S &a, const JsonKey &b) {
+    return !(b == a);
+  }
+  friend bool operator<(const JsonKey &a, const JsonKey &b) {
+    return std::string_view(a) < std::string_view(b);
+  }
+  template <typename S, typename = EnableIfText<S>>
+  friend bool operator<(const JsonKey &a, const S &b) {
+    return std::string_view(a) < std::string_view(b);
+  }
+  template <typename S, typename = EnableIfText<S>>
+  friend bool operator<(const S &a, const JsonKey &b) {
+    return std::string_view(a) < std::string_view(b);
   }
 
-  JsonNode(const JsonObj_t &obj) : ty_(ObjType_) {
-    val_.o = new JsonObj_t(obj);
+  template <typename S, typename = EnableIfText<S>>
+  friend std::string operator+(const JsonKey &a, const S &b) {
+    std::string ret(a);
+    ret.append(std::string_view(b));
+    return ret;
   }
-  JsonNode(JsonObj_t &&obj) : ty_(ObjType_) {
-    val_.o = new JsonObj_t(std::move(obj));
+  template <typename S, typename = EnableIfText<S>>
+  friend std::string operator+(const S &a, const JsonKey &b) {
+    std::string ret(std::string_view{a});
+    ret.append(std::string_view(b));
+    return ret;
+  }
+  friend std::string operator+(const JsonKey &a, const JsonKey &b) {
+    std::string ret(a);
+    ret.append(std::string_view(b));
+    return ret;
+  }
+  friend std::string operator+(const JsonKey &a, char c) {
+    std::string ret(a);
+    ret.push_back(c);
+    return ret;
+  }
+  friend std::string operator+(char c, const JsonKey &b) {
+    return c + std::string(b);
   }
 
-  template <typename T,
-            typename std::enable_if_t<std::is_floating_point_v<T>, int> = 0>
-  JsonNode(T num) : ty_(DoubleType_) {
-    val_.d = static_cast<double>(num);
+  friend std::ostream &operator<<(std::ostream &os, const JsonKey &key) {
+    return os << std::string_view(key);
   }
 
-  template <typename T,
-            typename std::enable_if_t<is_signed_integral_v<T>, int> = 0>
-  JsonNode(T num) : ty_(IntType_) {
-    val_.i = static_cast<int64_t>(num);
+private:
+  friend class detail::JsonKeyTable;
+  friend class JsonParser;
+
+  struct Shared {
+    std::atomic<uint32_t> refs;
+    size_t size;
+    uint64_t hash;
+    // followed by the characters and a null terminator
+  };
+
+  // The last byte holds the length of an inline key, SharedTag or
+  // BorrowedTag otherwise. A borrowed key stores its data pointer followed by
+  // its length as a uint32_t.
+  static constexpr size_t Tag = 15;
+  static constexpr char SharedTag = static_cast<char>(0x80);
+  static constexpr char BorrowedTag = static_cast<char>(0x81);
+
+  // Refers to key, which must outlive the key and its moved-to instances.
+  static JsonKey borrow(std::string_view key) {
+    if (key.size() <= InlineCapacity || key.size() > UINT32_MAX)
+      return JsonKey(key);
+    JsonKey ret;
+    const char *p = key.data();
+    const auto size = static_cast<uint32_t>(key.size());
+    std::memcpy(ret.m_buf, &p, sizeof(p));
+    std::memcpy(ret.m_buf + sizeof(p), &size, sizeof(size));
+    ret.m_buf[Tag] = BorrowedTag;
+    return ret;
   }
 
-  template <typename T,
-            typename std::enable_if_t<is_unsigned_integral_v<T>, int> = 0>
-  JsonNode(T num) : ty_(UintType_) {
-    val_.u = static_cast<uint64_t>(num);
+  void init(std::string_view key) {
+    std::memset(m_buf, 0, sizeof(m_buf));
+    if (key.size() <= InlineCapacity) {
+      std::memcpy(m_buf, key.data(), key.size());
+      m_buf[Tag] = static_cast<char>(key.size());
+      return;
+    }
+    void *raw = ::operator new(sizeof(Shared) + key.size() + 1);
+    auto s = new (raw) Shared{{1}, key.size(), detail::hashJsonKey(key)};
+    auto chars = reinterpret_cast<char *>(s + 1);
+    std::memcpy(chars, key.data(), key.size());
+    chars[key.size()] = '\0';
+    setShared(s);
   }
 
-  JsonNode(std::nullptr_t) : ty_(NullType_) {}
+  bool isShared() const { return m_buf[Tag] == SharedTag; }
+  bool isBorrowed() const { return m_buf[Tag] == BorrowedTag; }
+  bool isInline() const { return !isShared() && !isBorrowed(); }
+  const char *borrowed() const {
+    const char *p;
+    std::memcpy(&p, m_buf, sizeof(p));
+    return p;
+  }
+  Shared *shared() const {
+    Shared *s;
+    std::memcpy(&s, m_buf, sizeof(s));
+    return s;
+  }
+  void setShared(Shared *s) {
+    std::memcpy(m_buf, &s, sizeof(s));
+    m_buf[Tag] = SharedTag;
+  }
 
-  JsonNode(char c) : ty_(StrType_) { val_.s = new JsonStr_t(1, c); }
+private:
+  alignas(8) char m_buf[16];
+};
 
-  template <size_t N> JsonNode(const char (&str)[N]) : ty_(StrType_) {
-    val_.s = new JsonStr_t(str, N > 0 ? N - 1 : 0);
+namespace detail {
+
+// Long keys already seen by a parser, each holding a reference to its
+// buffer. Lookups hash the key once. Keys longer than MaxKeySize are not
+// kept, and the table stops growing at MaxSize keys or MaxBytes characters,
+// so that input with many distinct keys cannot make it grow without bound.
+class JsonKeyTable {
+public:
+  static constexpr size_t MaxSize = 1 << 16;
+  static constexpr size_t MaxKeySize = 256;
+  static constexpr size_t MaxBytes = 4 << 20;
+
+  JsonKey intern(std::string_view key) {
+    if (key.size() <= JsonKey::InlineCapacity || key.size() > MaxKeySize)
+      return JsonKey(key);
+    const uint64_t hash = hashJsonKey(key);
+    if (m_slots.empty())
+      m_slots.resize(64);
+    size_t mask = m_slots.size() - 1;
+    size_t h = hash & mask;
+    for (; !m_slots[h].empty(); h = (h + 1) & mask)
+      if (m_slots[h].hash() == hash && m_slots[h] == key)
+        return m_slots[h];
+    JsonKey ret(key);
+    if (m_size >= MaxSize || m_bytes + key.size() > MaxBytes)
+      return ret;
+    m_slots[h] = ret;
+    m_bytes += key.size();
+    if (++m_size * 2 > m_slots.size())
+      grow();
+    return ret;
   }
 
-  template <typename T,
-            typename std::enable_if_t<std::is_same_v<T, const char *>, int> = 0>
-  JsonNode(T str) : ty_(StrType_) {
-    val_.s = new JsonStr_t(str);
+  void clear() {
+    m_slots = {};
+    m_size = 0;
+    m_bytes = 0;
   }
 
-  JsonNode(std::string_view str) : ty_(StrType_) {
-    val_.s = new JsonStr_t(str.begin(), str.end());
+private:
+  void grow() {
+    std::vector<JsonKey> old(m_slots.size() * 2);
+    old.swap(m_slots);
+    size_t mask = m_slots.size() - 1;
+    for (auto &key : old) {
+      if (key.empty())
+        continue;
+      size_t h = key.hash() & mask;
+      while (!m_slots[h].empty())
+        h = (h + 1) & mask;
+      m_slots[h] = std::move(key);
+    }
   }
 
-  JsonNode(std::initializer_list<JsonNode> arr) : ty_(ArrType_) {
-    val_.a = new JsonArr_t(arr);
+private:
+  // Empty keys mark free slots, interned keys are never empty.
+  std::vector<JsonKey> m_slots;
+  size_t m_size = 0;
+  size_t m_bytes = 0; // characters of the keys
+};
+
+// Object storage: key/value pairs in one contiguous vector. By default the
+// pairs are kept sorted by key and found by binary search. With InsertionOrder
+// they keep the order in which keys were added and are found by a linear scan.
+// Either way lookups use a hash index once there are more than IndexThreshold
+// keys; the overloads taking a hash skip hashing the key.
+//
+// A key inserted out of order is appended and the pairs are sorted on the
+// next iteration, find() or const access, so that building an object key by
+// key stays O(n log n). Non-const lookups do not sort. The sort moves pairs,
+// like an insertion it invalidates references and iterators taken before it.
+template <typename Node, bool InsertionOrder> class JsonObject {
+  using Item = std::pair<JsonKey, Node>;
+  using Items = std::vector<Item, JsonAllocator<Item>>;
+
+public:
+  // As in flat maps, pairs are stored and handed out with a mutable key so
+  // that they can be moved around. Keys must not be assigned through
+  // iterators, which would break the order and the index.
+  using key_type = JsonKey;
+  using mapped_type = Node;
+  using value_type = Item;
+  using size_type = size_t;
+  using allocator_type = JsonAllocator<Item>;
+  using iterator = typename Items::iterator;
+  using const_iterator = typename Items::const_iterator;
+
+  static constexpr size_t IndexThreshold = 16;
+
+  JsonObject() = default;
+  explicit JsonObject(const allocator_type &alloc)
+      : m_items(alloc), m_index(alloc) {}
+  JsonObject(std::initializer_list<value_type> init) {
+    for (const auto &p : init)
+      emplace(p.first, p.second);
+    sort();
   }
-  JsonNode(
-      std::initializer_list<std::pair<const JsonKeyLiteral_t, JsonNode>> obj)
-      : ty_(ObjType_) {
-    val_.o = new JsonObj_t{};
-    for (const auto &p : obj) {
-      val_.o->emplace(p.first.key, p.second);
+  JsonObject(const JsonObject &other)
+      : m_items((other.sort(), other.m_items)), m_index(other.m_index) {}
+  JsonObject(JsonObject &&other) noexcept
+      : m_items(std::move(other.m_items)), m_index(std::move(other.m_index)),
+        m_unsorted(other.m_unsorted.load(std::memory_order_relaxed)) {
+    other.m_unsorted.store(false, std::memory_order_relaxed);
+  }
+  JsonObject &operator=(const JsonObject &other) {
+    if (this != &other) {
+      other.sort();
+      m_items = other.m_items;
+      m_index = other.m_index;
+      m_unsorted.store(false, std::memory_order_relaxed);
     }
+    return *this;
+  }
+  JsonObject &operator=(JsonObject &&other) noexcept {
+    m_items = std::move(other.m_items);
+    m_index = std::move(other.m_index);
+    m_unsorted.store(other.m_unsorted.load(std::memory_order_relaxed),
+                     std::memory_order_relaxed);
+    other.m_unsorted.store(false, std::memory_order_relaxed);
+    return *this;
   }
 
-  template <typename T, typename std::enable_if_t<
-                            has_subscript_op_v<T> &&
-                                (has_size_op_v<T> || has_static_length_op_v<T>),
-                            int> = 0>
-  JsonNode(const T &a, const size_t n = static_cast<size_t>(-1),
-           size_t offset = 0, const size_t stride = 1) {
-    ty_ = ArrType_;
-    size_t sz{};
-    if constexpr (has_size_op_v<T>)
-      sz = a.size();
-    else
-      sz = a.length();
-    val_.a = new JsonArr_t(n == static_cast<size_t>(-1) ? sz : n);
-    for (size_t i = 0; offset < sz && i < n; offset += stride, ++i) {
-      (*val_.a)[i] = a[offset];
-    }
+  allocator_type get_allocator() const { return m_items.get_allocator(); }
+
+  iterator begin() {
+    sort();
+    return iterator(m_items.begin());
+  }
+  iterator end() {
+    sort();
+    return iterator(m_items.end());
+  }
+  const_iterator begin() const {
+    sort();
+    return const_iterator(m_items.begin());
   }
+  const_iterator end() const {
+    sort();
+    return const_iterator(m_items.end());
+  }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
 
-  template <typename T, typename std::enable_if_t<
-                            has_subscript_op_v<T> && !has_size_op_v<T> &&
-                                !has_static_length_op_v<T>,
-                            int> = 0>
-  JsonNode(const T &a, const size_t n, size_t offset = 0,
-           const size_t stride = 1) {
-    ty_ = ArrType_;
-    val_.a = new JsonArr_t(n);
-    for (size_t i = 0; i < n; offset += stride, ++i) {
-      (*val_.a)[i] = a[offset];
-    }
+  size_t size() const { return m_items.size(); }
+  bool empty() const { return m_items.empty(); }
+  void reserve(size_t n) { m_items.reserve(n); }
+  void shrink_to_fit() { m_items.shrink_to_fit(); }
+
+  void clear() {
+    m_items.clear();
+    m_index.clear();
+    m_unsorted.store(false, std::memory_order_relaxed);
   }
 
-  template <typename T,
-            typename std::enable_if_t<is_associative_container_v<T>, int> = 0>
-  JsonNode(const T &m) {
-    ty_ = ObjType_;
-    val_.o = new JsonObj_t{};
-    for (const auto &p : m) {
-      val_.o->emplace(p.first, p.second);
+  iterator find(std::string_view key) {
+    sort();
+    return iterator(m_items.begin() + findIndex(key));
+  }
+  const_iterator find(std::string_view key) const {
+    sort();
+    return const_iterator(m_items.begin() + findIndex(key));
+  }
+  iterator find(std::string_view key, uint64_t hash) {
+    sort();
+    return iterator(m_items.begin() + findHashed(key, hash));
+  }
+  const_iterator find(std::string_view key, uint64_t hash) const {
+    sort();
+    return const_iterator(m_items.begin() + findHashed(key, hash));
+  }
+
+  size_t count(std::string_view key) const {
+    sort();
+    return findIndex(key) != m_items.size();
+  }
+  bool contains(std::string_view key) const {
+    sort();
+    return findIndex(key) != m_items.size();
+  }
+  bool contains(std::string_view key, uint64_t hash) const {
+    sort();
+    return findHashed(key, hash) != m_items.size();
+  }
+
+  Node &at(std::string_view key) { return itemAt(findIndex(key)); }
+  const Node &at(std::string_view key) const {
+    sort();
+    return const_cast<JsonObject *>(this)->itemAt(findIndex(key));
+  }
+  Node &at(std::string_view key, uint64_t hash) {
+    return itemAt(findHashed(key, hash));
+  }
+  const Node &at(std::string_view key, uint64_t hash) const {
+    sort();
+    return const_cast<JsonObject *>(this)->itemAt(findHashed(key, hash));
+  }
+
+  Node &operator[](std::string_view key) {
+    return try_emplace(key).first->second;
+  }
+
+  // The returned iterator is into the unsorted pairs if the key was
+  // appended out of order, see sort().
+  template <typename K, typename... Args>
+  std::pair<iterator, bool> try_emplace(K &&key, Args &&...args) {
+    std::string_view k(key);
+    size_t i = findIndex(k);
+    if (i != m_items.size())
+      return {iterator(m_items.begin() + i), false};
+    if constexpr (!InsertionOrder) {
+      if (!m_items.empty() && !(std::string_view(m_items.back().first) < k))
+        m_unsorted.store(true, std::memory_order_relaxed);
     }
+    m_items.emplace_back(JsonKey(std::forward<K>(key)),
+                         Node(std::forward<Args>(args)...));
+    indexLast();
+    return {iterator(m_items.begin() + i), true};
   }
 
-  JsonNode(const JsonNode &other) {
-    std::stack<ConstTraverseState> stateStack;
-    std::stack<JsonNode *> nodeStack;
-    stateStack.emplace(&other);
-    nodeStack.emplace(this);
-    while (!stateStack.empty()) {
-      auto otherNode = stateStack.top().node;
-      auto node = nodeStack.top();
-      node->ty_ = otherNode->ty_;
-      switch (otherNode->ty_) {
-      case ArrType_: {
-        auto &otherArr = *otherNode->val_.a;
-        auto &it = stateStack.top().arrIt;
-        if (it == otherArr.cbegin()) {
-          (node->val_.a = new JsonArr_t{})->reserve(otherArr.size());
-        }
-        if (it != otherArr.cend()) {
-          const auto otherChild = &(*it);
-          ++it;
-          stateStack.emplace(otherChild);
-          nodeStack.emplace(&(node->val_.a->emplace_back()));
-        } else {
-          stateStack.pop();
-          nodeStack.pop();
-        }
-      } break;
-      case ObjType_: {
-        auto &otherObj = *otherNode->val_.o;
-        auto &it = stateStack.top().objIt;
-        if (it == otherObj.cbegin()) {
-          node->val_.o = new JsonObj_t{};
-        }
-        if (it != otherObj.cend()) {
-          const auto otherChild = &(it->second);
-          stateStack.emplace(otherChild);
-          nodeStack.emplace(
-              &(node->val_.o->emplace(it->first, JsonNode{}).first->second));
-          ++it;
-        } else {
-          stateStack.pop();
-          nodeStack.pop();
+  template <typename K, typename V>
+  std::pair<iterator, bool> emplace(K &&key, V &&value) {
+    return try_emplace(std::forward<K>(key), std::forward<V>(value));
+  }
+
+  std::pair<iterator, bool> insert(const value_type &p) {
+    return try_emplace(p.first, p.second);
+  }
+  std::pair<iterator, bool> insert(value_type &&p) {
+    return try_emplace(p.first, std::move(p.second));
+  }
+
+  iterator erase(const_iterator pos) {
+    auto it = m_items.erase(pos);
+    if (!m_index.empty())
+      rebuildIndex();
+    return iterator(it);
+  }
+
+  size_t erase(std::string_view key) {
+    size_t i = findIndex(key);
+    if (i == m_items.size())
+      return 0;
+    m_items.erase(m_items.begin() + i);
+    if (!m_index.empty())
+      rebuildIndex();
+    return 1;
+  }
+
+  // Appends a pair without looking for an existing key. Lookups are only
+  // valid again after finalize(), which restores the ordering and resolves
+  // duplicate keys (the last value wins).
+  template <typename K> Node &append(K &&key) {
+    return m_items.emplace_back(JsonKey(std::forward<K>(key)), Node{}).second;
+  }
+
+  void finalize() {
+    if constexpr (InsertionOrder) {
+      size_t n = m_items.size();
+      m_index.clear();
+      size_t w = 0;
+      for (size_t i = 0; i < n; ++i) {
+        size_t j = findIndex(m_items[i].first, w);
+        if (j != w) {
+          m_items[j].second = std::move(m_items[i].second);
+          continue;
         }
-      } break;
-      case StrType_:
-        nodeStack.top()->val_.s = new JsonStr_t(*otherNode->val_.s);
-        stateStack.pop();
-        nodeStack.pop();
-        break;
-      case DoubleType_:
-      case IntType_:
-      case UintType_:
-      case BoolType_:
-        nodeStack.top()->val_ = otherNode->val_;
-        stateStack.pop();
-        nodeStack.pop();
-        break;
-      default:
-        stateStack.pop();
-        nodeStack.pop();
+        if (w != i)
+          m_items[w] = std::move(m_items[i]);
+        ++w;
+        if (w > IndexThreshold)
+          indexLast(w);
+      }
+      m_items.erase(m_items.begin() + w, m_items.end());
+    } else {
+      auto less = [](const Item &a, const Item &b) {
+        return a.first < b.first;
+      };
+      if (std::adjacent_find(m_items.begin(), m_items.end(),
+                             [&](const Item &a, const Item &b) {
+                               return !less(a, b);
+                             }) == m_items.end()) {
+        rebuildIndex();
+        return;
       }
+      // Small objects are sorted in place, stable_sort allocates a buffer.
+      if (m_items.size() <= IndexThreshold) {
+        for (auto it = m_items.begin() + 1; it != m_items.end(); ++it)
+          std::rotate(std::upper_bound(m_items.begin(), it, *it, less), it,
+                      it + 1);
+      } else {
+        std::stable_sort(m_items.begin(), m_items.end(), less);
+      }
+      size_t w = 0;
+      for (size_t i = 0; i < m_items.size(); ++i) {
+        if (w != 0 && m_items[w - 1].first == m_items[i].first)
+          m_items[w - 1].second = std::move(m_items[i].second);
+        else if (w++ != i)
+          m_items[w - 1] = std::move(m_items[i]);
+      }
+      m_items.erase(m_items.begin() + w, m_items.end());
+      rebuildIndex();
     }
+    m_unsorted.store(false, std::memory_order_release);
   }
 
-  JsonNode(JsonNode &&other) noexcept : ty_(other.ty_), val_(other.val_) {
-    other.ty_ = {};
+private:
+  // Sorts pairs appended out of order by try_emplace. Const accessors call it
+  // too, on objects that may be shared between threads, so the first one
+  // sorts under a lock and the others wait for it. The keys are unique, so
+  // finalize() only sorts.
+  void sort() const {
+    if constexpr (!InsertionOrder) {
+      if (m_unsorted.load(std::memory_order_acquire))
+        const_cast<JsonObject *>(this)->sortLocked();
+    }
   }
 
-  // Destructor
-public:
-  ~JsonNode() {
-    if (!isInternalPtr())
-      return;
+  JSON_PARSER_COLD void sortLocked() {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (m_unsorted.load(std::memory_order_acquire))
+      finalize();
+  }
 
-    std::stack<TraverseState> stateStack;
-    stateStack.emplace(this);
-    while (!stateStack.empty()) {
-      auto node = stateStack.top().node;
-      switch (node->ty_) {
-      case ArrType_: {
-        auto &arr = node->val_.a;
-        auto &it = stateStack.top().arrIt;
-        if (it != arr->cend()) {
-          if (it->isInternalPtr()) {
-            const auto child = &(*it);
-            stateStack.emplace(child);
-          }
-          ++it;
-        } else {
-          delete arr;
-          node->ty_ = {};
-          stateStack.pop();
-        }
-      } break;
-      case ObjType_: {
-        auto &obj = node->val_.o;
-        auto &it = stateStack.top().objIt;
-        if (it != obj->cend()) {
-          if (it->second.isInternalPtr()) {
-            const auto child = &(it->second);
-            stateStack.emplace(child);
-          }
-          ++it;
-        } else {
-          delete obj;
-          node->ty_ = {};
-          stateStack.pop();
-        }
-      } break;
-      case StrType_:
-        delete node->val_.s;
-        node->ty_ = {};
-        stateStack.pop();
-        break;
-      default:
-        // should not reach here
-        break;
+  Node &itemAt(size_t i) {
+    if (i == m_items.size())
+      throw std::out_of_range("JsonObject::at");
+    return m_items[i].second;
+  }
+
+  size_t lowerBound(std::string_view key) const {
+    return std::lower_bound(m_items.begin(), m_items.end(), key,
+                            [](const Item &p, std::string_view k) {
+                              return std::string_view(p.first) < k;
+                            }) -
+           m_items.begin();
+  }
+
+  // Position of key among the first n pairs, n if it is not there. hash is
+  // only computed when the index is used.
+  template <typename Hash>
+  size_t findIndex(std::string_view key, size_t n, Hash hash) const {
+    if (!m_index.empty()) {
+      size_t mask = m_index.size() - 1;
+      for (size_t h = hash() & mask;; h = (h + 1) & mask) {
+        uint32_t slot = m_index[h];
+        if (slot == 0)
+          return n;
+        if (m_items[slot - 1].first == key)
+          return slot - 1;
       }
     }
+    if (InsertionOrder || m_unsorted.load(std::memory_order_relaxed)) {
+      for (size_t i = 0; i < n; ++i)
+        if (m_items[i].first == key)
+          return i;
+      return n;
+    } else {
+      size_t i = lowerBound(key);
+      return i != n && m_items[i].first == key ? i : n;
+    }
   }
 
-  void clear() {
-    switch (ty_) {
-    case ArrType_:
-      delete val_.a;
-      break;
-    case ObjType_:
-      delete val_.o;
-      break;
-    case StrType_:
-      delete val_.s;
-      break;
-    default:
-      break;
-    }
-    ty_ = {};
+  size_t findIndex(std::string_view key, size_t n) const {
+    return findIndex(key, n, [key] { return hashJsonKey(key); });
+  }
+  size_t findIndex(std::string_view key) const {
+    return findIndex(key, m_items.size());
+  }
+  size_t findHashed(std::string_view key, uint64_t hash) const {
+    return findIndex(key, m_items.size(), [hash] { return hash; });
   }
 
-  // Assignment operators
-public:
-  void swap(JsonNode &other) noexcept {
-    std::swap(ty_, other.ty_);
-    std::swap(val_, other.val_);
+  // Adds pair n - 1 to the hash index, creating or growing the index when
+  // needed.
+  void indexLast(size_t n) {
+    if (n <= IndexThreshold)
+      return;
+    if (n * 2 > m_index.size()) {
+      rebuildIndex(n);
+      return;
+    }
+    insertIndex(n - 1);
   }
+  void indexLast() { indexLast(m_items.size()); }
 
-  JsonNode &operator=(JsonNode other) {
-    swap(other);
-    return *this;
+  void rebuildIndex(size_t n) {
+    m_index.clear();
+    if (n <= IndexThreshold)
+      return;
+    size_t cap = 1;
+    while (cap < n * 4)
+      cap <<= 1;
+    m_index.assign(cap, 0);
+    for (size_t i = 0; i < n; ++i)
+      insertIndex(i);
+  }
+  void rebuildIndex() { rebuildIndex(m_items.size()); }
+
+  void insertIndex(size_t i) {
+    size_t mask = m_index.size() - 1;
+    size_t h = m_items[i].first.hash() & mask;
+    while (m_index[h] != 0)
+      h = (h + 1) & mask;
+    m_index[h] = static_cast<uint32_t>(i + 1);
   }
 
-  // Index and key
 private:
-  void requireType(size_t ty) const {
-    (void)ty; // Suppress unused variable warning
-#ifndef NDEBUG
-    if (ty_ != ty)
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+  Items m_items;
+  // Open addressing table of pair positions + 1, only with more than
+  // IndexThreshold pairs.
+  std::vector<uint32_t, JsonAllocator<uint32_t>> m_index;
+  // Set when pairs were appended out of key order, see sort().
+  mutable std::atomic<bool> m_unsorted{false};
+};
+
+} // namespace detail
+
+// Define JSON_PARSER_OBJECT_INSERTION_ORDER to keep object members in the
+// order they were inserted or parsed instead of sorting them by key.
+#ifdef JSON_PARSER_OBJECT_INSERTION_ORDER
+inline constexpr bool JsonObjInsertionOrder = true;
+#else
+inline constexpr bool JsonObjInsertionOrder = false;
 #endif
-  }
 
+using JsonStr_t = std::string;
+using JsonArr_t = std::vector<JsonNode, detail::JsonAllocator<JsonNode>>;
+using JsonObj_t = detail::JsonObject<JsonNode, JsonObjInsertionOrder>;
+
+// An object key with its hash, which objects with a hash index use instead of
+// hashing the key on each lookup. "name"_key is a constant expression:
+//   static constexpr auto Radius = "radius"_key;
+//   double r = json[Radius].get<double>();
+struct JsonKeyLiteral_t {
+  std::string_view key;
+  uint64_t hash;
+  constexpr JsonKeyLiteral_t(const std::string_view &k)
+      : key(k), hash(detail::hashJsonKey(k)) {}
+};
+
+constexpr JsonKeyLiteral_t operator""_key(const char *key, size_t len) {
+  return JsonKeyLiteral_t{std::string_view(key, len)};
+}
+
+enum class JsonType : uint8_t {
+  Null = 0,
+  Bool,
+  Num,
+  Str,
+  Arr,
+  Obj,
+};
+
+namespace detail {
+
+enum class JsonErrorCode : uint8_t {
+  InvalidJson = 0,
+  UnexpectedEndOfInput,
+  InvalidLiteral,
+  InvalidNumber,
+  InvalidString,
+  InvalidCharacter,
+  InvalidUnicode,
+  InvalidEscapeSequence,
+  InvalidKeyValuePair,
+  InvalidArrayOrObject,
+  InvalidMsgPack,
+
+  InvalidJsonAccess,
+};
+
+inline const char *JsonErrorMsg[]{
+    "invalid json",           "unexpected end of input",
+    "invalid literal",        "invalid number",
+    "invalid string",         "invalid character",
+    "invalid unicode",        "invalid escape sequence",
+    "invalid key-value pair", "invalid array or object",
+    "invalid msgpack",        "invalid json access",
+};
+
+inline const char *getJsonErrorMsg(JsonErrorCode code) {
+  return JsonErrorMsg[static_cast<uint8_t>(code)];
+}
+
+[[noreturn]] JSON_PARSER_COLD inline void throwJsonError(JsonErrorCode code) {
+  throw std::runtime_error(getJsonErrorMsg(code));
+}
+
+inline bool isJsonSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Characters that end a run of plain string content: quote, backslash, control
+// characters, and the first byte of a multi-byte UTF-8 sequence (which has to
+// be validated).
+inline bool isJsonStringSpecial(char c) {
+  return c == '"' || c == '\\' || static_cast<uint8_t>(c) < 0x20u ||
+         static_cast<uint8_t>(c) >= 0x80u;
+}
+
+inline int countTrailingZeros(uint64_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long idx;
+  _BitScanForward64(&idx, x);
+  return static_cast<int>(idx);
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
+inline int popCount(uint64_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  return static_cast<int>(__popcnt64(x));
+#else
+  return __builtin_popcountll(x);
+#endif
+}
+
+#ifdef JSON_PARSER_SIMD
+
+// A 64-byte block of input, classified into bitmasks with one bit per byte
+// (bit i corresponds to p[i]).
+class JsonSimdBlock {
 public:
-  JsonStr_t &str() {
-    if (ty_ != StrType_) {
-      *this = JsonStr_t{};
-    }
-    return *val_.s;
-  }
-  const JsonStr_t &str() const {
-    requireType(StrType_);
-    return *val_.s;
-  }
-  const char *c_str() const {
-    requireType(StrType_);
-    return val_.s->c_str();
+  static constexpr size_t size = 64;
+
+  explicit JsonSimdBlock(const char *p) {
+#if defined(JSON_PARSER_SIMD_AVX2)
+    for (int i = 0; i < 2; ++i)
+      m_v[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p) + i);
+#elif defined(JSON_PARSER_SIMD_SSE2)
+    for (int i = 0; i < 4; ++i)
+      m_v[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p) + i);
+#else
+    for (int i = 0; i < 4; ++i)
+      m_v[i] = vld1q_u8(reinterpret_cast<const uint8_t *>(p) + 16 * i);
+#endif
   }
 
-  JsonArr_t &arr() {
-    if (ty_ != ArrType_) {
-      *this = JsonArr_t{};
-    }
-    return *val_.a;
+  uint64_t eq(char c) const {
+#if defined(JSON_PARSER_SIMD_AVX2)
+    const __m256i s = _mm256_set1_epi8(c);
+    return mask(_mm256_cmpeq_epi8(m_v[0], s), _mm256_cmpeq_epi8(m_v[1], s));
+#elif defined(JSON_PARSER_SIMD_SSE2)
+    const __m128i s = _mm_set1_epi8(c);
+    return mask(_mm_cmpeq_epi8(m_v[0], s), _mm_cmpeq_epi8(m_v[1], s),
+                _mm_cmpeq_epi8(m_v[2], s), _mm_cmpeq_epi8(m_v[3], s));
+#else
+    const uint8x16_t s = vdupq_n_u8(static_cast<uint8_t>(c));
+    return mask(vceqq_u8(m_v[0], s), vceqq_u8(m_v[1], s), vceqq_u8(m_v[2], s),
+                vceqq_u8(m_v[3], s));
+#endif
   }
-  const JsonArr_t &arr() const {
-    requireType(ArrType_);
-    return *val_.a;
+
+  // Bytes that are <= c when compared as unsigned.
+  uint64_t le(uint8_t c) const {
+#if defined(JSON_PARSER_SIMD_AVX2)
+    const __m256i s = _mm256_set1_epi8(static_cast<char>(c));
+    return mask(_mm256_cmpeq_epi8(_mm256_max_epu8(m_v[0], s), s),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(m_v[1], s), s));
+#elif defined(JSON_PARSER_SIMD_SSE2)
+    const __m128i s = _mm_set1_epi8(static_cast<char>(c));
+    return mask(_mm_cmpeq_epi8(_mm_max_epu8(m_v[0], s), s),
+                _mm_cmpeq_epi8(_mm_max_epu8(m_v[1], s), s),
+                _mm_cmpeq_epi8(_mm_max_epu8(m_v[2], s), s),
+                _mm_cmpeq_epi8(_mm_max_epu8(m_v[3], s), s));
+#else
+    const uint8x16_t s = vdupq_n_u8(c);
+    return mask(vcleq_u8(m_v[0], s), vcleq_u8(m_v[1], s), vcleq_u8(m_v[2], s),
+                vcleq_u8(m_v[3], s));
+#endif
   }
 
-  JsonObj_t &obj() {
-    if (ty_ != ObjType_) {
-      *this = JsonObj_t{};
-    }
-    return *val_.o;
+  // Bytes with the high bit set (non-ASCII).
+  uint64_t high() const {
+#if defined(JSON_PARSER_SIMD_AVX2)
+    return mask(m_v[0], m_v[1]);
+#elif defined(JSON_PARSER_SIMD_SSE2)
+    return mask(m_v[0], m_v[1], m_v[2], m_v[3]);
+#else
+    const uint8x16_t s = vdupq_n_u8(0x80);
+    return mask(vcgeq_u8(m_v[0], s), vcgeq_u8(m_v[1], s), vcgeq_u8(m_v[2], s),
+                vcgeq_u8(m_v[3], s));
+#endif
   }
-  const JsonObj_t &obj() const {
-    requireType(ObjType_);
-    return *val_.o;
+
+  uint64_t space() const {
+    return eq(' ') | eq('\t') | eq('\n') | eq('\r');
   }
 
-  void push_back(const JsonNode &node) {
-    if (ty_ != ArrType_) {
-      *this = JsonArr_t{};
-    }
-    val_.a->push_back(node);
+  uint64_t quote() const { return eq('"'); }
+
+  uint64_t backslash() const { return eq('\\'); }
+
+  uint64_t structural() const {
+    return eq('[') | eq(']') | eq('{') | eq('}') | eq(',') | eq(':');
   }
-  void push_back(JsonNode &&node) {
-    if (ty_ != ArrType_) {
-      *this = JsonArr_t{};
-    }
-    val_.a->push_back(std::move(node));
+
+  uint64_t stringSpecial() const {
+    return quote() | backslash() | le(0x1F) | high();
   }
 
-  JsonNode &operator[](size_t idx) {
-    requireType(ArrType_);
-    return (*val_.a)[idx];
+private:
+#if defined(JSON_PARSER_SIMD_AVX2)
+  static uint64_t mask(__m256i a, __m256i b) {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(a)) |
+           (static_cast<uint64_t>(static_cast<uint32_t>(
+                _mm256_movemask_epi8(b)))
+            << 32);
   }
-  JsonNode &at(size_t idx) {
-    requireType(ArrType_);
-    return val_.a->at(idx);
+  __m256i m_v[2];
+#elif defined(JSON_PARSER_SIMD_SSE2)
+  static uint64_t mask(__m128i a, __m128i b, __m128i c, __m128i d) {
+    return static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(a))) |
+           (static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(b)))
+            << 16) |
+           (static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(c)))
+            << 32) |
+           (static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(d)))
+            << 48);
   }
-  const JsonNode &operator[](size_t idx) const {
-    requireType(ArrType_);
-    return (*val_.a)[idx];
+  __m128i m_v[4];
+#else
+  static uint64_t mask(uint8x16_t a, uint8x16_t b, uint8x16_t c,
+                       uint8x16_t d) {
+    const uint8x16_t bits = {1, 2, 4, 8, 16, 32, 64, 128,
+                             1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t s0 = vpaddq_u8(vandq_u8(a, bits), vandq_u8(b, bits));
+    uint8x16_t s1 = vpaddq_u8(vandq_u8(c, bits), vandq_u8(d, bits));
+    s0 = vpaddq_u8(s0, s1);
+    s0 = vpaddq_u8(s0, s0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(s0), 0);
   }
-  const JsonNode &at(size_t idx) const {
-    requireType(ArrType_);
-    return val_.a->at(idx);
+  uint8x16_t m_v[4];
+#endif
+};
+
+#endif
+
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+// 10^e for 0 <= e <= 22, all exactly representable as double.
+inline double pow10Exact(int64_t e) {
+  constexpr double table[]{1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                           1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                           1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  return table[e];
+}
+
+// Correctly rounded conversion of a validated JSON number, independent of the
+// global locale. Returns an infinity if the value is out of range.
+inline double parseDouble(const char *first, const char *last) {
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+  double d;
+  auto [ptr, ec] = std::from_chars(first, last, d);
+  if (ec == std::errc())
+    return d;
+  // Out of range, strtod tells overflow from underflow.
+#endif
+  char buf[64];
+  std::string longBuf;
+  char *p = buf;
+  size_t n = last - first;
+  if (n >= sizeof(buf)) {
+    longBuf.resize(n + 1);
+    p = longBuf.data();
   }
+  const char point = *std::localeconv()->decimal_point;
+  for (size_t i = 0; i < n; ++i)
+    p[i] = first[i] == '.' ? point : first[i];
+  p[n] = '\0';
+  return std::strtod(p, nullptr);
+}
 
-  JsonNode &operator[](const std::string &key) {
-    if (ty_ != ObjType_) {
-      *this = JsonObj_t{};
+// Size of a buffer that always fits the output of formatDouble.
+inline constexpr size_t JsonDoubleBufSize = 64;
+
+// Writes d to buf and returns the length. A negative precision yields the
+// shortest text that parses back to the same value, otherwise `precision`
+// significant digits are written. The output does not depend on the locale.
+inline size_t formatDouble(char *buf, double d, int precision) {
+  precision = std::min(precision, 40);
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+  auto res = precision < 0 ? std::to_chars(buf, buf + JsonDoubleBufSize, d)
+                           : std::to_chars(buf, buf + JsonDoubleBufSize, d,
+                                           std::chars_format::general,
+                                           precision);
+  return res.ptr - buf;
+#elif defined(JSON_PARSER_USE_STD_FORMAT) || defined(JSON_PARSER_USE_LIBFMT)
+#ifdef JSON_PARSER_USE_STD_FORMAT
+  namespace fmt = std;
+#endif
+  auto res = precision < 0 ? fmt::format_to_n(buf, JsonDoubleBufSize, "{}", d)
+                           : fmt::format_to_n(buf, JsonDoubleBufSize,
+                                              "{:.{}g}", d, precision);
+  return res.out - buf;
+#else
+  int len;
+  if (precision >= 0) {
+    len = std::snprintf(buf, JsonDoubleBufSize, "%.*g", precision, d);
+  } else {
+    // The first of 15, 16 or 17 digits that round-trips is the shortest.
+    for (int p = 15;; ++p) {
+      len = std::snprintf(buf, JsonDoubleBufSize, "%.*g", p, d);
+      if (p == 17 || !std::isfinite(d) || std::strtod(buf, nullptr) == d)
+        break;
     }
-    return (*val_.o)[key];
-  }
-  JsonNode &at(const std::string &key) {
-    requireType(ObjType_);
-    return val_.o->at(key);
-  }
-  const JsonNode &operator[](const std::string &key) const {
-    requireType(ObjType_);
-    return val_.o->at(key);
-  }
-  const JsonNode &at(const std::string &key) const {
-    requireType(ObjType_);
-    return val_.o->at(key);
   }
+  const char point = *std::localeconv()->decimal_point;
+  if (point != '.')
+    std::replace(buf, buf + len, point, '.');
+  return len;
+#endif
+}
 
-  bool contains(const JsonStr_t &key) const {
-    requireType(ObjType_);
-    return val_.o->find(key) != val_.o->end();
-  }
+// Length of the UTF-8 sequence starting with lead, 0 if lead is invalid.
+inline uint8_t utf8ByteCount(uint8_t lead) {
+  if (lead <= 0x7F)
+    return 1;
+  if (lead >= 0xC0 && lead <= 0xDF)
+    return 2;
+  if (lead >= 0xE0 && lead <= 0xEF)
+    return 3;
+  if (lead >= 0xF0 && lead <= 0xF7)
+    return 4;
+  return 0;
+}
 
-  JsonObj_t::iterator find(const JsonStr_t &key) {
-    requireType(ObjType_);
-    return val_.o->find(key);
+inline bool isUtf8Continuation(uint8_t u) { return u >= 0x80 && u <= 0xBF; }
+
+// Length of the valid UTF-8 sequence at p, 0 if it is invalid or truncated.
+inline size_t utf8SequenceLength(const char *p, const char *end) {
+  size_t n = utf8ByteCount(static_cast<uint8_t>(*p));
+  if (n == 0 || static_cast<size_t>(end - p) < n)
+    return 0;
+  for (size_t i = 1; i < n; ++i)
+    if (!isUtf8Continuation(static_cast<uint8_t>(p[i])))
+      return 0;
+  return n;
+}
+
+// Returns the first non-whitespace character in [p, end).
+inline const char *skipSpaceSpan(const char *p, const char *end) {
+  if (p == end || !isJsonSpace(*p))
+    return p;
+#ifdef JSON_PARSER_SIMD
+  while (static_cast<size_t>(end - p) >= JsonSimdBlock::size) {
+    uint64_t other = ~JsonSimdBlock(p).space();
+    if (other)
+      return p + countTrailingZeros(other);
+    p += JsonSimdBlock::size;
   }
+#endif
+  while (p != end && isJsonSpace(*p))
+    ++p;
+  return p;
+}
 
-  JsonObj_t::const_iterator find(const JsonStr_t &key) const {
-    requireType(ObjType_);
-    return val_.o->find(key);
+// Returns the first character in [p, end) that can not be copied verbatim
+// into a string value.
+inline const char *scanStringSpan(const char *p, const char *end) {
+#ifdef JSON_PARSER_SIMD
+  while (static_cast<size_t>(end - p) >= JsonSimdBlock::size) {
+    uint64_t special = JsonSimdBlock(p).stringSpecial();
+    if (special)
+      return p + countTrailingZeros(special);
+    p += JsonSimdBlock::size;
   }
+#endif
+  while (p != end && !isJsonStringSpecial(*p))
+    ++p;
+  return p;
+}
 
-  size_t size() const {
-    if (ty_ == StrType_) {
-      return val_.s->size();
-    } else if (ty_ == ArrType_) {
-      return val_.a->size();
-    } else if (ty_ == ObjType_) {
-      return val_.o->size();
-    } else {
-      return 0;
-    }
-  }
-
-  // Type and getter
-private:
-  bool isInternalPtr() const {
-    return ty_ == StrType_ || ty_ == ArrType_ || ty_ == ObjType_;
-  }
-
-public:
-  JsonType type() const {
-    constexpr JsonType types[]{JsonType::Null, JsonType::Bool, JsonType::Num,
-                               JsonType::Num,  JsonType::Num,  JsonType::Str,
-                               JsonType::Arr,  JsonType::Obj};
-
-    return types[ty_];
+// Returns the first character in [p, end) that the serializer escapes: quotes,
+// backslashes and control characters, and non-ASCII bytes if ascii is set.
+inline const char *scanEscapeSpan(const char *p, const char *end, bool ascii) {
+#ifdef JSON_PARSER_SIMD
+  auto special = [ascii](const JsonSimdBlock &block) {
+    return block.quote() | block.backslash() | block.le(0x1F) |
+           (ascii ? block.high() : 0);
+  };
+  while (static_cast<size_t>(end - p) >= JsonSimdBlock::size) {
+    if (uint64_t m = special(JsonSimdBlock(p)))
+      return p + countTrailingZeros(m);
+    p += JsonSimdBlock::size;
   }
-  std::string typeStr() const {
-    constexpr const char *types[]{"null", "bool", "num", "num",
-                                  "num",  "str",  "arr", "obj"};
-    return types[ty_];
+  // The tail is padded with a character that is never escaped.
+  if (p != end) {
+    char tail[JsonSimdBlock::size];
+    std::fill(std::copy(p, end, tail), tail + JsonSimdBlock::size, 'a');
+    uint64_t m = special(JsonSimdBlock(tail));
+    return m ? p + countTrailingZeros(m) : end;
   }
+  return p;
+#else
+  while (p != end && !(*p == '"' || *p == '\\' ||
+                       static_cast<uint8_t>(*p) < 0x20u ||
+                       (ascii && static_cast<uint8_t>(*p) >= 0x80u)))
+    ++p;
+  return p;
+#endif
+}
 
-  bool isNull() const { return type() == JsonType::Null; }
-  bool isBool() const { return type() == JsonType::Bool; }
-  bool isNum() const { return type() == JsonType::Num; }
-  bool isStr() const { return type() == JsonType::Str; }
-  bool isArr() const { return type() == JsonType::Arr; }
-  bool isObj() const { return type() == JsonType::Obj; }
+// Returns the first character in [p, end) that can not be part of a number.
+inline const char *skipNumberSpan(const char *p, const char *end) {
+  while (p != end && (isDigit(*p) || *p == '-' || *p == '+' || *p == '.' ||
+                      *p == 'e' || *p == 'E'))
+    ++p;
+  return p;
+}
 
-  template <typename T>
-  typename std::enable_if_t<std::is_same_v<T, bool>, T> get() const {
-    if (ty_ == BoolType_)
-      return val_.b;
-    if (ty_ == IntType_)
-      return static_cast<bool>(val_.i);
-    if (ty_ == UintType_)
-      return static_cast<bool>(val_.u);
-    if (ty_ == DoubleType_)
-      return static_cast<bool>(val_.d);
-    throw std::runtime_error(
-        getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+// Returns the first quote or structural character in [p, end).
+inline const char *skipToStructural(const char *p, const char *end) {
+#ifdef JSON_PARSER_SIMD
+  while (static_cast<size_t>(end - p) >= JsonSimdBlock::size) {
+    JsonSimdBlock block(p);
+    uint64_t m = block.structural() | block.quote();
+    if (m)
+      return p + countTrailingZeros(m);
+    p += JsonSimdBlock::size;
   }
+#endif
+  while (p != end && *p != '"' && *p != '[' && *p != ']' && *p != '{' &&
+         *p != '}' && *p != ',' && *p != ':')
+    ++p;
+  return p;
+}
 
-  template <typename T>
-  typename std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>,
-                            T>
-  get() const {
-    switch (ty_) {
-    case DoubleType_:
-      return static_cast<T>(val_.d);
-    case IntType_:
-      return static_cast<T>(val_.i);
-    case UintType_:
-      return static_cast<T>(val_.u);
-    default:
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+// Scans the array starting at the '[' at p and returns its closing bracket,
+// or nullptr if the brackets or quotes do not balance. Commas between the
+// top-level elements are collected, at most one per stride bytes. Nothing
+// else is validated.
+inline const char *splitJsonArray(const char *p, const char *end,
+                                  size_t stride,
+                                  std::vector<const char *> &commas) {
+  size_t depth = 0;
+  const char *next = p + stride;
+  for (; (p = skipToStructural(p, end)) != end; ++p) {
+    switch (*p) {
+    case '"':
+      for (++p;; ++p) {
+        p = scanStringSpan(p, end);
+        if (p == end)
+          return nullptr;
+        if (*p == '"')
+          break;
+        if (*p == '\\' && ++p == end)
+          return nullptr;
+      }
+      break;
+    case '[':
+    case '{':
+      ++depth;
+      break;
+    case ']':
+    case '}':
+      if (--depth == 0)
+        return p;
+      break;
+    case ',':
+      if (depth == 1 && p >= next) {
+        commas.push_back(p);
+        next = p + stride;
+      }
+      break;
     }
   }
+  return nullptr;
+}
 
-  template <typename T>
-  typename std::enable_if_t<std::is_same_v<T, std::filesystem::path>,
-                            std::filesystem::path>
-  get() const {
-    requireType(StrType_);
-#if __cplusplus >= 202002L
-    return std::filesystem::path(std::u8string(val_.s->begin(), val_.s->end()));
-#else
-    return std::filesystem::u8path(*val_.s);
-#endif
-  }
+#ifdef JSON_PARSER_SIMD
+
+// Bit i is set if bits 0 to i of x hold an odd number of ones.
+inline uint64_t prefixXor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
 
-  template <typename T>
-  typename std::enable_if_t<is_unresizable_sequence_container_v<T>, T>
-  get(const size_t n = static_cast<size_t>(-1), size_t offset = 0,
-      const size_t stride = 1) const {
-    requireType(ArrType_);
-    auto &arr = *val_.a;
-    using ValueType = get_value_type_t<T>;
-    T ret{};
-    for (size_t i = 0; offset < arr.size() && i < n; offset += stride, ++i) {
-      ret[i] = arr[offset].get<ValueType>();
+// Returns the end of the container starting at p, or nullptr. Each block is
+// classified at once: escaped quotes are found from the runs of backslashes,
+// the bytes inside strings from the prefix xor of the quotes, and brackets are
+// only walked one by one in a block where the container may close.
+inline const char *skipContainerSpan(const char *p, const char *end) {
+  constexpr uint64_t Even = 0x5555555555555555ull;
+  uint64_t prevEscaped = 0;
+  uint64_t inString = 0;
+  size_t depth = 0;
+  char tail[JsonSimdBlock::size];
+  for (; p < end; p += JsonSimdBlock::size) {
+    const char *src = p;
+    if (static_cast<size_t>(end - p) < JsonSimdBlock::size) {
+      std::memset(tail, ' ', sizeof(tail));
+      std::memcpy(tail, p, end - p);
+      src = tail;
     }
-    return ret;
-  }
-
-  template <typename T>
-  typename std::enable_if_t<is_resizable_sequence_container_v<T>, T>
-  get(const size_t n = static_cast<size_t>(-1), size_t offset = 0,
-      const size_t stride = 1) const {
-    requireType(ArrType_);
-    auto &arr = *val_.a;
-    using ValueType = get_value_type_t<T>;
-    T ret{};
-    ret.resize(n == static_cast<size_t>(-1) ? arr.size() : n);
-    for (size_t i = 0; offset < arr.size() && i < n; offset += stride, ++i) {
-      ret[i] = arr[offset].get<ValueType>();
+    JsonSimdBlock block(src);
+
+    // A quote is escaped if preceded by an odd run of backslashes.
+    uint64_t backslash = block.backslash() & ~prevEscaped;
+    uint64_t followsEscape = backslash << 1 | prevEscaped;
+    uint64_t oddStarts = backslash & ~Even & ~followsEscape;
+    uint64_t evenStarts = oddStarts + backslash;
+    prevEscaped = evenStarts < oddStarts;
+    uint64_t escaped = (Even ^ (evenStarts << 1)) & followsEscape;
+
+    uint64_t str = prefixXor(block.quote() & ~escaped) ^ inString;
+    inString = static_cast<uint64_t>(static_cast<int64_t>(str) >> 63);
+    uint64_t open = (block.eq('[') | block.eq('{')) & ~str;
+    uint64_t close = (block.eq(']') | block.eq('}')) & ~str;
+
+    if (static_cast<size_t>(popCount(close)) < depth) {
+      depth += popCount(open);
+      depth -= popCount(close);
+      continue;
     }
-    return ret;
-  }
-
-  template <typename T>
-  typename std::enable_if_t<
-      is_associative_container_v<T> &&
-          std::is_convertible_v<std::string, typename T::key_type>,
-      T>
-  get() const {
-    requireType(ObjType_);
-    auto &obj = *val_.o;
-    using MappedType = typename T::mapped_type;
-    T ret{};
-    for (const auto &p : obj) {
-      ret.emplace(p.first, p.second.get<MappedType>());
+    for (uint64_t m = open | close; m != 0; m &= m - 1) {
+      int i = countTrailingZeros(m);
+      if (open >> i & 1)
+        ++depth;
+      else if (--depth == 0)
+        return p + i + 1;
     }
-    return ret;
   }
+  return nullptr;
+}
 
-  template <typename T>
-  typename std::enable_if_t<std::is_same_v<std::string, T>, T> get() const {
-    switch (ty_) {
-    case NullType_:
-      return "null";
-    case BoolType_:
-      return val_.b ? "true" : "false";
-    case DoubleType_:
-#ifdef JSON_PARSER_USE_STD_FORMAT
-      return std::format("{}", val_.d);
-#elif defined(JSON_PARSER_USE_LIBFMT)
-      return fmt::format("{}", val_.d);
 #else
-      return std::to_string(val_.d);
-#endif
-    case IntType_:
-      return std::to_string(val_.i);
-    case UintType_:
-      return std::to_string(val_.u);
-    case StrType_:
-      return *val_.s;
-    default:
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+
+inline const char *skipContainerSpan(const char *p, const char *end) {
+  size_t depth = 0;
+  for (; p != end; ++p) {
+    switch (*p) {
+    case '"':
+      for (++p; p != end && *p != '"'; ++p)
+        if (*p == '\\' && ++p == end)
+          return nullptr;
+      if (p == end)
+        return nullptr;
+      break;
+    case '[':
+    case '{':
+      ++depth;
+      break;
+    case ']':
+    case '}':
+      if (--depth == 0)
+        return p + 1;
+      break;
     }
   }
+  return nullptr;
+}
 
-  template <typename T> auto get(const std::string &key) const {
-    requireType(ObjType_);
-    return val_.o->at(key).get<T>();
-  }
+#endif
 
-  template <typename T> auto get(const std::string &key, T &&fallback) const {
-    requireType(ObjType_);
-    auto it = val_.o->find(key);
-    if (it != val_.o->end())
-      return it->second.get<T>();
-    return std::forward<T>(fallback);
+// Returns the end of the value starting at p, or nullptr if the input ends
+// inside it. Only brackets and quotes are balanced; a scalar extends to the
+// next space, comma or closing bracket.
+inline const char *skipValueSpan(const char *p, const char *end) {
+  if (p == end)
+    return p;
+  if (*p == '[' || *p == '{')
+    return skipContainerSpan(p, end);
+  if (*p != '"') {
+    while (p != end && !isJsonSpace(*p) && *p != ',' && *p != ']' &&
+           *p != '}')
+      ++p;
+    return p;
+  }
+  for (++p;; ++p) {
+    p = scanStringSpan(p, end);
+    if (p == end)
+      return nullptr;
+    if (*p == '"')
+      return p + 1;
+    if (*p == '\\' && ++p == end)
+      return nullptr;
   }
+}
 
-  // serialization
+}; // namespace detail
+
+// If the locale is not "C", the parser may fail to parse floating-point numbers
+// and the serializer may produce non-standard JSON strings. This class is used
+// to temporarily set the locale to "C" during parsing and serialization with
+// RAII (not thread-safe).
+class JsonParserLocaleGuard {
 public:
-  template <typename Derived> class JsonOutputStreamBase;
+  JsonParserLocaleGuard() : m_backup(std::locale()) {
+    std::locale::global(std::locale::classic());
+  }
+  ~JsonParserLocaleGuard() { std::locale::global(m_backup); }
 
 private:
-  template <size_t BufSize, typename Derived> class JsonStringRingBuffer {
-  public:
-    JsonStringRingBuffer(JsonOutputStreamBase<Derived> &os)
-        : m_os(os), m_pos(0) {}
+  std::locale m_backup;
+};
 
-    ~JsonStringRingBuffer() {
-      if (m_pos)
-        dumpBuffer();
-    }
+#ifdef JSON_PARSER_STATS
+// What parsing one document took, see JsonParser::stats().
+struct JsonParseStats {
+  size_t bytes = 0; // input of the value; only files for std::istream
+  size_t nulls = 0;
+  size_t bools = 0;
+  size_t ints = 0; // negative integers
+  size_t uints = 0;
+  size_t doubles = 0;
+  size_t strings = 0;
+  size_t arrays = 0;
+  size_t objects = 0;
+  size_t keys = 0;
+  // Strings and keys with escape sequences, decoded into a copy.
+  size_t escapedStrings = 0;
+  size_t maxDepth = 0; // of nested arrays and objects
+  // Heap blocks holding the containers, strings and long keys of the tree,
+  // and the size of their elements and characters. Arena memory and
+  // interned keys are not counted.
+  size_t heapBlocks = 0;
+  size_t heapBytes = 0;
+  size_t refills = 0; // blocks read from a file
+  std::chrono::nanoseconds parseTime{};
+  std::chrono::nanoseconds ioTime{}; // reading or waiting for blocks
+  bool failed = false;
+
+  JsonParseStats &operator+=(const JsonParseStats &other) {
+    bytes += other.bytes;
+    nulls += other.nulls;
+    bools += other.bools;
+    ints += other.ints;
+    uints += other.uints;
+    doubles += other.doubles;
+    strings += other.strings;
+    arrays += other.arrays;
+    objects += other.objects;
+    keys += other.keys;
+    escapedStrings += other.escapedStrings;
+    maxDepth = std::max(maxDepth, other.maxDepth);
+    heapBlocks += other.heapBlocks;
+    heapBytes += other.heapBytes;
+    refills += other.refills;
+    parseTime += other.parseTime;
+    ioTime += other.ioTime;
+    failed = failed || other.failed;
+    return *this;
+  }
+};
 
-    void put(char c) {
-      if (m_pos == BufSize)
-        dumpBuffer();
-      m_buf[m_pos++] = c;
-    }
+// What writing one value took, see JsonNode::Serializer::stats().
+struct JsonSerializeStats {
+  size_t bytes = 0; // output
+  size_t nulls = 0;
+  size_t bools = 0;
+  size_t ints = 0; // negative integers
+  size_t uints = 0;
+  size_t doubles = 0;
+  size_t strings = 0;
+  size_t arrays = 0;
+  size_t objects = 0;
+  size_t keys = 0;
+  size_t escapedStrings = 0; // strings and keys written with escapes
+  size_t maxDepth = 0;
+  std::chrono::nanoseconds time{};
+};
 
-    void put(char c, size_t rep) {
-      size_t f = free();
-      while (rep > f) {
-        std::fill_n(m_buf + m_pos, f, c);
-        m_pos = BufSize;
-        dumpBuffer();
-        rep -= f;
-        f = BufSize;
-      }
-      std::fill_n(m_buf + m_pos, rep, c);
-      m_pos += rep;
-    }
+// Receives the stats of each document parsed and each value written, on the
+// thread doing the work. A hook set on a JsonParser or Serializer replaces
+// the one installed for the process, which must be thread-safe. Hooks must
+// not throw.
+class JsonStatsHook {
+public:
+  virtual ~JsonStatsHook() = default;
+  virtual void onParse(const JsonParseStats &) {}
+  virtual void onSerialize(const JsonSerializeStats &) {}
 
-    void puts(const char *s, size_t n) {
-      size_t f = free();
-      while (n > f) {
-        std::copy_n(s, f, m_buf + m_pos);
-        m_pos = BufSize;
-        dumpBuffer();
-        s += f;
-        n -= f;
-        f = BufSize;
-      }
-      std::copy_n(s, n, m_buf + m_pos);
-      m_pos += n;
-    }
+  // Sets the hook of parsers and serializers without one, null for none.
+  static void install(JsonStatsHook *hook) {
+    slot().store(hook, std::memory_order_release);
+  }
+  static JsonStatsHook *installed() {
+    return slot().load(std::memory_order_acquire);
+  }
 
-  private:
-    void dumpBuffer() {
-      m_os.puts_(m_buf, m_pos);
-      m_pos = 0;
-    }
-    size_t free() const { return BufSize - m_pos; }
+private:
+  static std::atomic<JsonStatsHook *> &slot() {
+    static std::atomic<JsonStatsHook *> hook{nullptr};
+    return hook;
+  }
+};
 
-  private:
-    JsonOutputStreamBase<Derived> &m_os;
-    char m_buf[BufSize];
-    size_t m_pos;
-  };
+namespace detail {
 
+// Adds its lifetime to *total, if total is set.
+class JsonStatsTimer {
 public:
-  template <typename Derived> class JsonOutputStreamBase {
-    friend class JsonStringRingBuffer<JSON_PARSER_IO_BUFFER_SIZE, Derived>;
-
-  public:
-    JsonOutputStreamBase() : m_buf(*this) {}
+  explicit JsonStatsTimer(std::chrono::nanoseconds *total)
+      : m_total(total), m_start(std::chrono::steady_clock::now()) {}
+  JsonStatsTimer(const JsonStatsTimer &) = delete;
+  JsonStatsTimer &operator=(const JsonStatsTimer &) = delete;
+  ~JsonStatsTimer() {
+    if (m_total != nullptr)
+      *m_total += std::chrono::steady_clock::now() - m_start;
+  }
 
-    void put(char c) { m_buf.put(c); }
-    void put(char c, size_t rep) { m_buf.put(c, rep); }
-    void puts(const char *s, size_t n) { m_buf.puts(s, n); }
+private:
+  std::chrono::nanoseconds *m_total;
+  std::chrono::steady_clock::time_point m_start;
+};
 
-  private:
-    void puts_(const char *s, size_t n) {
-      static_cast<Derived *>(this)->puts_(s, n);
-    }
+} // namespace detail
+#endif
 
-  private:
-    JsonStringRingBuffer<JSON_PARSER_IO_BUFFER_SIZE, Derived> m_buf;
-  };
+class JsonNode {
+  friend class JsonParser;
+  friend class JsonDocument;
+  friend class JsonReclaimer;
 
-  class JsonStringOutputStream
-      : public JsonOutputStreamBase<JsonStringOutputStream> {
-  public:
-    JsonStringOutputStream(std::string &str) : m_str(str) {}
-    void puts_(const char *s, size_t n) { m_str.append(s, n); }
+private:
+  struct TraverseState {
+    JsonNode *node;
+    union {
+      JsonArr_t::iterator arrIt;
+      JsonObj_t::iterator objIt;
+    };
 
-  private:
+    TraverseState(JsonNode *n) : node(n) {
+      if (n->isArr())
+        arrIt = n->val_.a->begin();
+      else if (n->isObj())
+        objIt = n->val_.o->begin();
+    }
+  };
+
+  struct ConstTraverseState {
+    const JsonNode *node;
+    union {
+      JsonArr_t::const_iterator arrIt;
+      JsonObj_t::const_iterator objIt;
+    };
+
+    ConstTraverseState(const JsonNode *n) : node(n) {
+      if (n->isArr())
+        arrIt = n->val_.a->cbegin();
+      else if (n->isObj())
+        objIt = n->val_.o->cbegin();
+    }
+  };
+
+  // Traits
+private:
+  template <typename T> struct is_signed_integral {
+    static constexpr bool value =
+        std::is_integral_v<T> && std::is_signed_v<T> &&
+        !std::is_same_v<T, char> && !std::is_same_v<T, bool>;
+  };
+  template <typename T>
+  static constexpr bool is_signed_integral_v = is_signed_integral<T>::value;
+
+  template <typename T> struct is_unsigned_integral {
+    static constexpr bool value =
+        std::is_integral_v<T> && std::is_unsigned_v<T> &&
+        !std::is_same_v<T, char> && !std::is_same_v<T, bool>;
+  };
+  template <typename T>
+  static constexpr bool is_unsigned_integral_v = is_unsigned_integral<T>::value;
+
+  template <typename T, typename = void>
+  struct has_subscript_op : std::false_type {};
+  template <typename T>
+  struct has_subscript_op<T,
+                          std::void_t<decltype(std::declval<T &>()[size_t{1}])>>
+      : std::true_type {};
+  template <typename T>
+  static constexpr bool has_subscript_op_v = has_subscript_op<T>::value;
+
+  template <typename T>
+  using resize_op_t = decltype(std::declval<T>().resize(size_t{}));
+  template <typename T, typename = void>
+  struct has_resize_op : std::false_type {};
+  template <typename T>
+  struct has_resize_op<T, std::void_t<resize_op_t<T>>> : std::true_type {};
+  template <typename T>
+  static constexpr bool has_resize_op_v = has_resize_op<T>::value;
+
+  template <typename T, typename = void> struct get_value_type {
+    using type = std::remove_reference_t<decltype(std::declval<T &>()[0])>;
+  };
+  template <typename T>
+  struct get_value_type<T, std::void_t<typename T::value_type>> {
+    using type = typename T::value_type;
+  };
+  template <typename T>
+  using get_value_type_t = typename get_value_type<T>::type;
+
+  template <typename T, typename = void>
+  struct has_size_op : std::false_type {};
+  template <typename T>
+  struct has_size_op<T, std::void_t<decltype(std::declval<T>().size())>>
+      : std::true_type {};
+  template <typename T>
+  static constexpr bool has_size_op_v = has_size_op<T>::value;
+
+  template <typename T, typename = void>
+  struct has_length_op : std::false_type {};
+  template <typename T>
+  struct has_length_op<T, std::void_t<decltype(std::declval<T>().length())>>
+      : std::true_type {};
+  template <typename T>
+  static constexpr bool has_static_length_op_v = has_length_op<T>::value;
+
+  template <typename T, typename = void>
+  struct has_data_op : std::false_type {};
+  template <typename T>
+  struct has_data_op<T, std::void_t<decltype(std::declval<T &>().data()),
+                                    decltype(std::declval<T &>().size())>>
+      : std::true_type {};
+  template <typename T>
+  static constexpr bool has_data_op_v = has_data_op<T>::value;
+
+  // Element types copied by getInto().
+  template <typename T>
+  static constexpr bool is_bulk_number_v =
+      std::is_arithmetic_v<T> && !std::is_same_v<T, bool>;
+
+  template <typename T>
+  static constexpr bool is_unresizable_sequence_container_v =
+      has_subscript_op_v<T> && !has_resize_op_v<T> && !std::is_pointer_v<T> &&
+      !std::is_same_v<T, std::string_view>;
+
+  template <typename T>
+  static constexpr bool is_resizable_sequence_container_v =
+      has_subscript_op_v<T> && has_resize_op_v<T> && !std::is_pointer_v<T> &&
+      !std::is_same_v<T, std::string>;
+
+  template <typename T, typename = void>
+  struct is_associative_container : std::false_type {};
+  template <typename T>
+  struct is_associative_container<
+      T, std::void_t<typename T::key_type, typename T::mapped_type,
+                     decltype(std::declval<T &>().emplace(
+                         std::declval<typename T::key_type>(),
+                         std::declval<typename T::mapped_type>()))>>
+      : std::true_type {};
+  template <typename T>
+  static constexpr bool is_associative_container_v =
+      is_associative_container<T>::value;
+
+  // Constructors
+public:
+  JsonNode() = default;
+
+  JsonNode(JsonNull_t) : ty_(NullType_), val_() {}
+
+  JsonNode(bool b) : ty_(BoolType_) { val_.b = b; }
+
+  JsonNode(const JsonStr_t &str) : ty_(StrType_) {
+    val_.s = new JsonStr_t(str);
+  }
+
+  JsonNode(JsonStr_t &&str) : ty_(StrType_) {
+    val_.s = new JsonStr_t(std::move(str));
+  }
+
+  JsonNode(const std::filesystem::path &path) : ty_(StrType_) {
+#if __cplusplus >= 202002L
+    auto u8path = path.u8string();
+    val_.s = new JsonStr_t(u8path.begin(), u8path.end());
+#else
+    val_.s = new JsonStr_t(path.u8string());
+#endif
+  }
+
+  JsonNode(const JsonArr_t &arr) : ty_(ArrType_) {
+    val_.a = newShared<JsonArr_t>(arr);
+  }
+  JsonNode(JsonArr_t &&arr) : ty_(ArrType_) {
+    val_.a = newShared<JsonArr_t>(std::move(arr));
+  }
+
+  JsonNode(const JsonObj_t &obj) : ty_(ObjType_) {
+    val_.o = newShared<JsonObj_t>(obj);
+  }
+  JsonNode(JsonObj_t &&obj) : ty_(ObjType_) {
+    val_.o = newShared<JsonObj_t>(std::move(obj));
+  }
+
+  template <typename T,
+            typename std::enable_if_t<std::is_floating_point_v<T>, int> = 0>
+  JsonNode(T num) : ty_(DoubleType_) {
+    val_.d = static_cast<double>(num);
+  }
+
+  template <typename T,
+            typename std::enable_if_t<is_signed_integral_v<T>, int> = 0>
+  JsonNode(T num) : ty_(IntType_) {
+    val_.i = static_cast<int64_t>(num);
+  }
+
+  template <typename T,
+            typename std::enable_if_t<is_unsigned_integral_v<T>, int> = 0>
+  JsonNode(T num) : ty_(UintType_) {
+    val_.u = static_cast<uint64_t>(num);
+  }
+
+  JsonNode(std::nullptr_t) : ty_(NullType_) {}
+
+  JsonNode(char c) : ty_(StrType_) { val_.s = new JsonStr_t(1, c); }
+
+  template <size_t N> JsonNode(const char (&str)[N]) : ty_(StrType_) {
+    val_.s = new JsonStr_t(str, N > 0 ? N - 1 : 0);
+  }
+
+  template <typename T,
+            typename std::enable_if_t<std::is_same_v<T, const char *>, int> = 0>
+  JsonNode(T str) : ty_(StrType_) {
+    val_.s = new JsonStr_t(str);
+  }
+
+  JsonNode(std::string_view str) : ty_(StrType_) {
+    val_.s = new JsonStr_t(str.begin(), str.end());
+  }
+
+  JsonNode(const JsonKey &key) : JsonNode(std::string_view(key)) {}
+
+  JsonNode(std::initializer_list<JsonNode> arr) : ty_(ArrType_) {
+    val_.a = newShared<JsonArr_t>(arr);
+  }
+  JsonNode(
+      std::initializer_list<std::pair<const JsonKeyLiteral_t, JsonNode>> obj)
+      : ty_(ObjType_) {
+    val_.o = newShared<JsonObj_t>();
+    for (const auto &p : obj) {
+      val_.o->emplace(p.first.key, p.second);
+    }
+  }
+
+  template <typename T, typename std::enable_if_t<
+                            has_subscript_op_v<T> &&
+                                (has_size_op_v<T> || has_static_length_op_v<T>),
+                            int> = 0>
+  JsonNode(const T &a, const size_t n = static_cast<size_t>(-1),
+           size_t offset = 0, const size_t stride = 1) {
+    ty_ = ArrType_;
+    size_t sz{};
+    if constexpr (has_size_op_v<T>)
+      sz = a.size();
+    else
+      sz = a.length();
+    val_.a = newShared<JsonArr_t>(n == static_cast<size_t>(-1) ? sz : n);
+    for (size_t i = 0; offset < sz && i < n; offset += stride, ++i) {
+      (*val_.a)[i] = a[offset];
+    }
+  }
+
+  template <typename T, typename std::enable_if_t<
+                            has_subscript_op_v<T> && !has_size_op_v<T> &&
+                                !has_static_length_op_v<T>,
+                            int> = 0>
+  JsonNode(const T &a, const size_t n, size_t offset = 0,
+           const size_t stride = 1) {
+    ty_ = ArrType_;
+    val_.a = newShared<JsonArr_t>(n);
+    for (size_t i = 0; i < n; offset += stride, ++i) {
+      (*val_.a)[i] = a[offset];
+    }
+  }
+
+  template <typename T,
+            typename std::enable_if_t<is_associative_container_v<T>, int> = 0>
+  JsonNode(const T &m) {
+    ty_ = ObjType_;
+    val_.o = newShared<JsonObj_t>();
+    for (const auto &p : m) {
+      val_.o->emplace(p.first, p.second);
+    }
+  }
+
+  // Heap containers are shared with other instead of being copied, see
+  // unshare(). Strings are copied.
+  JsonNode(const JsonNode &other) {
+    if (other.isShareable()) {
+      share(other);
+      return;
+    }
+    std::stack<ConstTraverseState> stateStack;
+    std::stack<JsonNode *> nodeStack;
+    stateStack.emplace(&other);
+    nodeStack.emplace(this);
+    while (!stateStack.empty()) {
+      auto otherNode = stateStack.top().node;
+      auto node = nodeStack.top();
+      node->ty_ = otherNode->ty_;
+      switch (otherNode->ty_) {
+      case ArrType_: {
+        auto &otherArr = *otherNode->val_.a;
+        auto &it = stateStack.top().arrIt;
+        if (it == otherArr.cbegin()) {
+          (node->val_.a = newShared<JsonArr_t>())->reserve(otherArr.size());
+        }
+        if (it != otherArr.cend()) {
+          const auto otherChild = &(*it);
+          ++it;
+          auto child = &(node->val_.a->emplace_back());
+          if (otherChild->isShareable()) {
+            child->share(*otherChild);
+          } else {
+            stateStack.emplace(otherChild);
+            nodeStack.emplace(child);
+          }
+        } else {
+          stateStack.pop();
+          nodeStack.pop();
+        }
+      } break;
+      case ObjType_: {
+        auto &otherObj = *otherNode->val_.o;
+        auto &it = stateStack.top().objIt;
+        if (it == otherObj.cbegin()) {
+          (node->val_.o = newShared<JsonObj_t>())->reserve(otherObj.size());
+        }
+        if (it != otherObj.cend()) {
+          const auto otherChild = &(it->second);
+          auto child = &(node->val_.o->append(it->first));
+          if (otherChild->isShareable()) {
+            child->share(*otherChild);
+          } else {
+            stateStack.emplace(otherChild);
+            nodeStack.emplace(child);
+          }
+          ++it;
+        } else {
+          node->val_.o->finalize();
+          stateStack.pop();
+          nodeStack.pop();
+        }
+      } break;
+      case StrType_:
+        nodeStack.top()->val_.s = new JsonStr_t(*otherNode->val_.s);
+        stateStack.pop();
+        nodeStack.pop();
+        break;
+      case StrInlineType_:
+        node->len_ = otherNode->len_;
+        node->val_ = otherNode->val_;
+        stateStack.pop();
+        nodeStack.pop();
+        break;
+      case StrViewType_:
+        // Copies never refer to the memory of the source tree.
+        node->ty_ = StrType_;
+        node->val_.s = new JsonStr_t(otherNode->str());
+        stateStack.pop();
+        nodeStack.pop();
+        break;
+      case DoubleType_:
+      case IntType_:
+      case UintType_:
+      case BoolType_:
+        nodeStack.top()->val_ = otherNode->val_;
+        stateStack.pop();
+        nodeStack.pop();
+        break;
+      default:
+        stateStack.pop();
+        nodeStack.pop();
+      }
+    }
+  }
+
+  JsonNode(JsonNode &&other) noexcept
+      : ty_(other.ty_), arena_(other.arena_), owned_(other.owned_),
+        len_(other.len_), val_(other.val_) {
+    other.ty_ = {};
+  }
+
+  // Destructor
+public:
+  ~JsonNode() {
+    if (!isInternalPtr() || releaseIfShared())
+      return;
+
+    std::stack<TraverseState> stateStack;
+    stateStack.emplace(this);
+    while (!stateStack.empty()) {
+      auto node = stateStack.top().node;
+      switch (node->ty_) {
+      case ArrType_: {
+        auto &arr = node->val_.a;
+        auto &it = stateStack.top().arrIt;
+        if (it != arr->cend()) {
+          if (it->isInternalPtr() && !it->releaseIfShared()) {
+            const auto child = &(*it);
+            stateStack.emplace(child);
+          }
+          ++it;
+        } else {
+          node->destroyHolder(arr);
+          node->ty_ = {};
+          stateStack.pop();
+        }
+      } break;
+      case ObjType_: {
+        auto &obj = node->val_.o;
+        auto &it = stateStack.top().objIt;
+        if (it != obj->cend()) {
+          if (it->second.isInternalPtr() && !it->second.releaseIfShared()) {
+            const auto child = &(it->second);
+            stateStack.emplace(child);
+          }
+          ++it;
+        } else {
+          node->destroyHolder(obj);
+          node->ty_ = {};
+          stateStack.pop();
+        }
+      } break;
+      case StrType_:
+        node->destroyHolder(node->val_.s);
+        node->ty_ = {};
+        stateStack.pop();
+        break;
+      case StrViewType_:
+        delete[] node->val_.v;
+        node->ty_ = {};
+        stateStack.pop();
+        break;
+      default:
+        // should not reach here
+        break;
+      }
+    }
+  }
+
+  void clear() {
+    switch (ty_) {
+    case ArrType_:
+      destroyHolder(val_.a);
+      break;
+    case ObjType_:
+      destroyHolder(val_.o);
+      break;
+    case StrType_:
+      destroyHolder(val_.s);
+      break;
+    case StrViewType_:
+      if (owned_)
+        delete[] val_.v;
+      break;
+    default:
+      break;
+    }
+    ty_ = {};
+  }
+
+  // Returns the containers and strings of the tree to the pool of parser,
+  // which reuses them for the trees it parses without an arena. The node is
+  // null afterwards.
+  void recycle(JsonParser &parser);
+
+private:
+  template <typename T> void destroyHolder(T *p) {
+    if (arena_)
+      p->~T();
+    else if constexpr (std::is_same_v<T, JsonStr_t>)
+      delete p;
+    else
+      releaseShared(p);
+  }
+
+  // Containers on the heap are reference counted and shared by copies until
+  // one of them is modified; containers in an arena are always copied.
+  struct SharedHeader {
+    std::atomic<uint32_t> refs{1};
+    // Set when strings borrowed from the parser input are in the container
+    // or its descendants, which keeps copies from sharing it.
+    bool borrows = false;
+    // Set once a mutable reference to the container or an iterator into it
+    // has been handed out, see pin(). Copies then copy the container.
+    bool pinned = false;
+  };
+
+  template <typename T>
+  static constexpr size_t SharedOffset =
+      (sizeof(SharedHeader) + alignof(T) - 1) / alignof(T) * alignof(T);
+
+  template <typename T, typename... Args> static T *newShared(Args &&...args) {
+    void *raw = ::operator new(SharedOffset<T> + sizeof(T));
+    new (raw) SharedHeader;
+    try {
+      return new (static_cast<char *>(raw) + SharedOffset<T>)
+          T(std::forward<Args>(args)...);
+    } catch (...) {
+      ::operator delete(raw);
+      throw;
+    }
+  }
+
+  template <typename T> static SharedHeader &header(T *p) {
+    return *std::launder(reinterpret_cast<SharedHeader *>(
+        reinterpret_cast<char *>(p) - SharedOffset<T>));
+  }
+
+  SharedHeader &header() const {
+    return ty_ == ArrType_ ? header(val_.a) : header(val_.o);
+  }
+
+  // Drops a reference to a container, destroying it with the last one.
+  template <typename T> static void releaseShared(T *p) {
+    auto &h = header(p);
+    if (h.refs.load(std::memory_order_acquire) != 1 &&
+        h.refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+      return;
+    p->~T();
+    h.~SharedHeader();
+    ::operator delete(&h);
+  }
+
+  bool isHeapContainer() const {
+    return (ty_ == ArrType_ || ty_ == ObjType_) && !arena_;
+  }
+
+  bool isShareable() const {
+    return isHeapContainer() && !header().borrows && !header().pinned;
+  }
+
+  void share(const JsonNode &other) {
+    ty_ = other.ty_;
+    val_ = other.val_;
+    header().refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Drops the reference of a shared container and forgets the value. Returns
+  // false, keeping the value, if the node is the only owner.
+  bool releaseIfShared() {
+    if (!isHeapContainer())
+      return false;
+    auto &h = header();
+    if (h.refs.load(std::memory_order_acquire) == 1)
+      return false;
+    if (h.refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      // The other owners were released meanwhile.
+      h.refs.store(1, std::memory_order_relaxed);
+      return false;
+    }
+    ty_ = {};
+    return true;
+  }
+
+  // Gives the node a container of its own before it is modified. The
+  // elements are copied, sharing their containers in turn.
+  void unshare() {
+    if (!isHeapContainer() ||
+        header().refs.load(std::memory_order_acquire) == 1)
+      return;
+    if (ty_ == ArrType_) {
+      auto p = newShared<JsonArr_t>(*val_.a);
+      releaseShared(val_.a);
+      val_.a = p;
+    } else {
+      auto p = newShared<JsonObj_t>(*val_.o);
+      releaseShared(val_.o);
+      val_.o = p;
+    }
+  }
+
+  // Unshares the container before a reference to it or an iterator into it
+  // is returned by arr(), obj() or find(). Those are typically kept and
+  // written through after the node has been copied, so the container is not
+  // shared again.
+  void pin() {
+    unshare();
+    if (isHeapContainer())
+      header().pinned = true;
+  }
+
+  // Forgets the value without releasing anything, used when the memory is
+  // known to be owned by an arena.
+  void drop() { ty_ = {}; }
+
+  // Replace the value with an empty container or a string whose memory comes
+  // from arena, or from the heap if arena is null.
+  template <typename T> T *resetHolder(JsonArena *arena) {
+    T *p;
+    if (arena != nullptr)
+      p = new (arena->allocate(sizeof(T), alignof(T)))
+          T(typename T::allocator_type(arena));
+    else if constexpr (std::is_same_v<T, JsonStr_t>)
+      p = new T{};
+    else
+      p = newShared<T>();
+    adoptHolder(p);
+    arena_ = arena != nullptr;
+    return p;
+  }
+
+  // Takes ownership of a heap-allocated container or string, containers
+  // coming from newShared().
+  template <typename T> void adoptHolder(T *p) {
+    JsonNode tmp;
+    if constexpr (std::is_same_v<T, JsonArr_t>) {
+      tmp.ty_ = ArrType_;
+      tmp.val_.a = p;
+    } else if constexpr (std::is_same_v<T, JsonObj_t>) {
+      tmp.ty_ = ObjType_;
+      tmp.val_.o = p;
+    } else {
+      tmp.ty_ = StrType_;
+      tmp.val_.s = p;
+    }
+    swap(tmp);
+  }
+
+  // Strings short enough are stored in the node itself, longer ones in a
+  // null-terminated buffer of their exact size instead of a JsonStr_t.
+  void resetStr(JsonArena *arena, std::string_view str) {
+    if (str.size() <= InlineStrCapacity) {
+      *this = JsonNode{};
+      ty_ = StrInlineType_;
+      len_ = static_cast<uint32_t>(str.size());
+      std::copy(str.begin(), str.end(), val_.c);
+      val_.c[str.size()] = '\0';
+      return;
+    }
+    if (str.size() > UINT32_MAX) {
+      *this = JsonStr_t(str);
+      return;
+    }
+    auto p = arena == nullptr
+                 ? new char[str.size() + 1]
+                 : static_cast<char *>(arena->allocate(str.size() + 1, 1));
+    std::copy(str.begin(), str.end(), p);
+    p[str.size()] = '\0';
+    resetView(p, str.size());
+    arena_ = arena != nullptr;
+    owned_ = arena == nullptr;
+  }
+
+  void resetView(const char *data, size_t len) {
+    *this = JsonNode{};
+    ty_ = StrViewType_;
+    len_ = static_cast<uint32_t>(len);
+    val_.v = data;
+  }
+
+  // Assignment operators
+public:
+  void swap(JsonNode &other) noexcept {
+    std::swap(ty_, other.ty_);
+    std::swap(arena_, other.arena_);
+    std::swap(owned_, other.owned_);
+    std::swap(len_, other.len_);
+    std::swap(val_, other.val_);
+  }
+
+  JsonNode &operator=(JsonNode other) {
+    swap(other);
+    return *this;
+  }
+
+  // Index and key
+private:
+  void requireType(size_t ty) const {
+    (void)ty; // Suppress unused variable warning
+#ifndef NDEBUG
+    if (ty_ != ty)
+      throw std::runtime_error(
+          getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+#endif
+  }
+
+public:
+  JsonStr_t &str() {
+    if (ty_ == StrViewType_ || ty_ == StrInlineType_) {
+      *this = JsonStr_t(strView());
+    } else if (ty_ != StrType_) {
+      *this = JsonStr_t{};
+    }
+    return *val_.s;
+  }
+  // Returns a view rather than a std::string, since parsed strings are
+  // stored inline or in exact-size buffers.
+  std::string_view str() const {
+    if (ty_ == StrViewType_ || ty_ == StrInlineType_)
+      return strView();
+    requireType(StrType_);
+    return *val_.s;
+  }
+  // Same as the const str(), also on a non-const node.
+  std::string_view view() const { return str(); }
+  // Throws std::logic_error for strings borrowed from the parser input,
+  // which are not null-terminated.
+  const char *c_str() const {
+    if (ty_ == StrInlineType_)
+      return val_.c;
+    if (ty_ == StrViewType_) {
+      if (!arena_ && !owned_)
+        throw std::logic_error(
+            "JsonNode::c_str: string borrowed from the input");
+      return val_.v;
+    }
+    requireType(StrType_);
+    return val_.s->c_str();
+  }
+
+  // The mutable accessors of containers unshare them first. arr(), obj() and
+  // find() also pin them; operator[] and at() do not, so reads through them
+  // keep later copies cheap.
+  JsonArr_t &arr() {
+    if (ty_ != ArrType_) {
+      *this = JsonArr_t{};
+    }
+    pin();
+    return *val_.a;
+  }
+  const JsonArr_t &arr() const {
+    requireType(ArrType_);
+    return *val_.a;
+  }
+
+  JsonObj_t &obj() {
+    if (ty_ != ObjType_) {
+      *this = JsonObj_t{};
+    }
+    pin();
+    return *val_.o;
+  }
+  const JsonObj_t &obj() const {
+    requireType(ObjType_);
+    return *val_.o;
+  }
+
+  void push_back(const JsonNode &node) {
+    if (ty_ != ArrType_) {
+      *this = JsonArr_t{};
+    }
+    unshare();
+    val_.a->push_back(node);
+  }
+  void push_back(JsonNode &&node) {
+    if (ty_ != ArrType_) {
+      *this = JsonArr_t{};
+    }
+    unshare();
+    val_.a->push_back(std::move(node));
+  }
+
+  JsonNode &operator[](size_t idx) {
+    requireType(ArrType_);
+    unshare();
+    return (*val_.a)[idx];
+  }
+  JsonNode &at(size_t idx) {
+    requireType(ArrType_);
+    unshare();
+    return val_.a->at(idx);
+  }
+  const JsonNode &operator[](size_t idx) const {
+    requireType(ArrType_);
+    return (*val_.a)[idx];
+  }
+  const JsonNode &at(size_t idx) const {
+    requireType(ArrType_);
+    return val_.a->at(idx);
+  }
+
+  JsonNode &operator[](std::string_view key) {
+    if (ty_ != ObjType_) {
+      *this = JsonObj_t{};
+    }
+    unshare();
+    return (*val_.o)[key];
+  }
+  JsonNode &at(std::string_view key) {
+    requireType(ObjType_);
+    unshare();
+    return val_.o->at(key);
+  }
+  const JsonNode &operator[](std::string_view key) const {
+    requireType(ObjType_);
+    return val_.o->at(key);
+  }
+  const JsonNode &at(std::string_view key) const {
+    requireType(ObjType_);
+    return val_.o->at(key);
+  }
+
+  JsonNode &operator[](const JsonKeyLiteral_t &key) {
+    if (ty_ == ObjType_) {
+      unshare();
+      auto it = val_.o->find(key.key, key.hash);
+      if (it != val_.o->end())
+        return it->second;
+    }
+    return (*this)[key.key];
+  }
+  JsonNode &at(const JsonKeyLiteral_t &key) {
+    requireType(ObjType_);
+    unshare();
+    return val_.o->at(key.key, key.hash);
+  }
+  const JsonNode &operator[](const JsonKeyLiteral_t &key) const {
+    requireType(ObjType_);
+    return val_.o->at(key.key, key.hash);
+  }
+  const JsonNode &at(const JsonKeyLiteral_t &key) const {
+    requireType(ObjType_);
+    return val_.o->at(key.key, key.hash);
+  }
+
+  bool contains(std::string_view key) const {
+    requireType(ObjType_);
+    return val_.o->contains(key);
+  }
+  bool contains(const JsonKeyLiteral_t &key) const {
+    requireType(ObjType_);
+    return val_.o->contains(key.key, key.hash);
+  }
+
+  JsonObj_t::iterator find(std::string_view key) {
+    requireType(ObjType_);
+    pin();
+    return val_.o->find(key);
+  }
+  JsonObj_t::const_iterator find(std::string_view key) const {
+    requireType(ObjType_);
+    return val_.o->find(key);
+  }
+
+  JsonObj_t::iterator find(const JsonKeyLiteral_t &key) {
+    requireType(ObjType_);
+    pin();
+    return val_.o->find(key.key, key.hash);
+  }
+  JsonObj_t::const_iterator find(const JsonKeyLiteral_t &key) const {
+    requireType(ObjType_);
+    return val_.o->find(key.key, key.hash);
+  }
+
+  size_t size() const {
+    if (ty_ == StrType_) {
+      return val_.s->size();
+    } else if (ty_ == StrViewType_ || ty_ == StrInlineType_) {
+      return len_;
+    } else if (ty_ == ArrType_) {
+      return val_.a->size();
+    } else if (ty_ == ObjType_) {
+      return val_.o->size();
+    } else {
+      return 0;
+    }
+  }
+
+  // Type and getter
+private:
+  bool isInternalPtr() const {
+    return ty_ == StrType_ || ty_ == ArrType_ || ty_ == ObjType_ ||
+           (ty_ == StrViewType_ && owned_);
+  }
+
+  std::string_view strView() const {
+    return std::string_view(ty_ == StrInlineType_ ? val_.c : val_.v, len_);
+  }
+
+public:
+  JsonType type() const {
+    constexpr JsonType types[]{JsonType::Null, JsonType::Bool, JsonType::Num,
+                               JsonType::Num,  JsonType::Num,  JsonType::Str,
+                               JsonType::Arr,  JsonType::Obj,  JsonType::Str,
+                               JsonType::Str};
+
+    return types[ty_];
+  }
+  std::string typeStr() const {
+    constexpr const char *types[]{"null", "bool", "num", "num", "num",
+                                  "str",  "arr",  "obj", "str", "str"};
+    return types[ty_];
+  }
+
+  bool isNull() const { return type() == JsonType::Null; }
+  bool isBool() const { return type() == JsonType::Bool; }
+  bool isNum() const { return type() == JsonType::Num; }
+  bool isStr() const { return type() == JsonType::Str; }
+  bool isArr() const { return type() == JsonType::Arr; }
+  bool isObj() const { return type() == JsonType::Obj; }
+
+  template <typename T>
+  typename std::enable_if_t<std::is_same_v<T, bool>, T> get() const {
+    if (ty_ == BoolType_)
+      return val_.b;
+    if (ty_ == IntType_)
+      return static_cast<bool>(val_.i);
+    if (ty_ == UintType_)
+      return static_cast<bool>(val_.u);
+    if (ty_ == DoubleType_)
+      return static_cast<bool>(val_.d);
+    throw std::runtime_error(
+        getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+  }
+
+  template <typename T>
+  typename std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>,
+                            T>
+  get() const {
+    switch (ty_) {
+    case DoubleType_:
+      return static_cast<T>(val_.d);
+    case IntType_:
+      return static_cast<T>(val_.i);
+    case UintType_:
+      return static_cast<T>(val_.u);
+    default:
+      throw std::runtime_error(
+          getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+    }
+  }
+
+  template <typename T>
+  typename std::enable_if_t<std::is_same_v<T, std::filesystem::path>,
+                            std::filesystem::path>
+  get() const {
+    auto s = str();
+#if __cplusplus >= 202002L
+    return std::filesystem::path(std::u8string(s.begin(), s.end()));
+#else
+    return std::filesystem::u8path(s.begin(), s.end());
+#endif
+  }
+
+  template <typename T>
+  typename std::enable_if_t<is_unresizable_sequence_container_v<T>, T>
+  get(const size_t n = static_cast<size_t>(-1), size_t offset = 0,
+      const size_t stride = 1) const {
+    requireType(ArrType_);
+    auto &arr = *val_.a;
+    using ValueType = get_value_type_t<T>;
+    T ret{};
+    const size_t count = std::min<size_t>(n, ret.size());
+    if constexpr (has_data_op_v<T> && is_bulk_number_v<ValueType>) {
+      getInto(ret.data(), count, offset, stride);
+      return ret;
+    }
+    for (size_t i = 0; offset < arr.size() && i < count;
+         offset += stride, ++i) {
+      ret[i] = arr[offset].get<ValueType>();
+    }
+    return ret;
+  }
+
+  template <typename T>
+  typename std::enable_if_t<is_resizable_sequence_container_v<T>, T>
+  get(const size_t n = static_cast<size_t>(-1), size_t offset = 0,
+      const size_t stride = 1) const {
+    requireType(ArrType_);
+    auto &arr = *val_.a;
+    using ValueType = get_value_type_t<T>;
+    T ret{};
+    ret.resize(n == static_cast<size_t>(-1) ? arr.size() : n);
+    const size_t count = ret.size();
+    if constexpr (has_data_op_v<T> && is_bulk_number_v<ValueType>) {
+      getInto(ret.data(), count, offset, stride);
+      return ret;
+    }
+    for (size_t i = 0; offset < arr.size() && i < count;
+         offset += stride, ++i) {
+      ret[i] = arr[offset].get<ValueType>();
+    }
+    return ret;
+  }
+
+  // Copies up to n numbers of an array, from offset and every stride
+  // elements, to out. A stride of 0 repeats the element at offset n times.
+  // Returns the count copied. Throws like get<T>() on elements that are not
+  // numbers.
+  template <typename T>
+  typename std::enable_if_t<is_bulk_number_v<T>, size_t>
+  getInto(T *out, size_t n, size_t offset = 0, size_t stride = 1) const {
+    requireType(ArrType_);
+    const auto &arr = *val_.a;
+    if (offset >= arr.size() || n == 0)
+      return 0;
+    if (stride != 0)
+      n = std::min(n, (arr.size() - offset - 1) / stride + 1);
+    const JsonNode *src = arr.data() + offset;
+    for (size_t i = 0; i < n; ++i, src += stride)
+      out[i] = src->get<T>();
+    return n;
+  }
+
+  // Fills a contiguous container such as std::vector or std::span, without
+  // resizing it.
+  template <typename Container>
+  typename std::enable_if_t<
+      has_data_op_v<Container> &&
+          is_bulk_number_v<std::remove_reference_t<
+              decltype(*std::declval<Container &>().data())>>,
+      size_t>
+  getInto(Container &&out, size_t offset = 0, size_t stride = 1) const {
+    return getInto(out.data(), out.size(), offset, stride);
+  }
+
+
+  template <typename T>
+  typename std::enable_if_t<
+      is_associative_container_v<T> &&
+          std::is_convertible_v<std::string, typename T::key_type>,
+      T>
+  get() const {
+    requireType(ObjType_);
+    auto &obj = *val_.o;
+    using MappedType = typename T::mapped_type;
+    T ret{};
+    for (const auto &p : obj) {
+      ret.emplace(p.first, p.second.get<MappedType>());
+    }
+    return ret;
+  }
+
+  template <typename T>
+  typename std::enable_if_t<std::is_same_v<std::string, T>, T> get() const {
+    switch (ty_) {
+    case NullType_:
+      return "null";
+    case BoolType_:
+      return val_.b ? "true" : "false";
+    case DoubleType_: {
+      char buf[detail::JsonDoubleBufSize];
+      return std::string(buf, detail::formatDouble(buf, val_.d, -1));
+    }
+    case IntType_:
+      return std::to_string(val_.i);
+    case UintType_:
+      return std::to_string(val_.u);
+    case StrType_:
+      return *val_.s;
+    case StrViewType_:
+    case StrInlineType_:
+      return std::string(strView());
+    default:
+      throw std::runtime_error(
+          getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+    }
+  }
+
+  // Views the characters of a string without copying them.
+  template <typename T>
+  typename std::enable_if_t<std::is_same_v<std::string_view, T>, T>
+  get() const {
+    if (ty_ == StrType_)
+      return *val_.s;
+    if (ty_ == StrViewType_ || ty_ == StrInlineType_)
+      return strView();
+    throw std::runtime_error(
+        getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+  }
+
+  template <typename T> auto get(std::string_view key) const {
+    return (*this)[key].template get<T>();
+  }
+  template <typename T> auto get(const JsonKeyLiteral_t &key) const {
+    return (*this)[key].template get<T>();
+  }
+
+  template <typename T> auto get(std::string_view key, T &&fallback) const {
+    requireType(ObjType_);
+    return getOr(val_.o->find(key), std::forward<T>(fallback));
+  }
+  template <typename T>
+  auto get(const JsonKeyLiteral_t &key, T &&fallback) const {
+    requireType(ObjType_);
+    return getOr(val_.o->find(key.key, key.hash), std::forward<T>(fallback));
+  }
+
+private:
+  template <typename T>
+  auto getOr(JsonObj_t::const_iterator it, T &&fallback) const {
+    if (it != val_.o->end())
+      return it->second.get<T>();
+    return std::forward<T>(fallback);
+  }
+
+public:
+
+  // serialization
+public:
+  template <typename Derived> class JsonOutputStreamBase;
+
+private:
+  // Streams defining grow_() are written in place, in the memory they give
+  // the ring buffer with setWindow(). grow_() is called when it is full, and
+  // flush_() when the output written so far has to be readable.
+  template <typename T, typename = void>
+  struct has_grow_op : std::false_type {};
+  template <typename T>
+  struct has_grow_op<T, std::void_t<decltype(std::declval<T &>().grow_(
+                            std::declval<char *>(), std::declval<char *&>()))>>
+      : std::true_type {};
+
+  template <size_t BufSize, typename Derived> class JsonStringRingBuffer {
+  public:
+    JsonStringRingBuffer(JsonOutputStreamBase<Derived> &os)
+        : m_os(os), m_pos(m_buf), m_end(m_buf + BufSize) {}
+
+    ~JsonStringRingBuffer() {
+      if constexpr (!has_grow_op<Derived>::value) {
+        if (m_pos != m_buf)
+          dumpBuffer();
+      }
+    }
+
+    void put(char c) {
+      if (m_pos == m_end)
+        dumpBuffer();
+      *m_pos++ = c;
+      count(1);
+    }
+
+    void put(char c, size_t rep) {
+      count(rep);
+      size_t f = free();
+      while (rep > f) {
+        std::fill_n(m_pos, f, c);
+        m_pos = m_end;
+        dumpBuffer();
+        rep -= f;
+        f = free();
+      }
+      std::fill_n(m_pos, rep, c);
+      m_pos += rep;
+    }
+
+    void puts(const char *s, size_t n) {
+      count(n);
+      size_t f = free();
+      while (n > f) {
+        std::copy_n(s, f, m_pos);
+        m_pos = m_end;
+        dumpBuffer();
+        s += f;
+        n -= f;
+        f = free();
+      }
+      std::copy_n(s, n, m_pos);
+      m_pos += n;
+    }
+
+    void setWindow(char *begin, char *end) {
+      m_pos = begin;
+      m_end = end;
+    }
+
+    void flush() {
+      if constexpr (has_grow_op<Derived>::value) {
+        m_pos = static_cast<Derived &>(m_os).flush_(m_pos, m_end);
+      } else {
+        if (m_pos != m_buf)
+          dumpBuffer();
+      }
+    }
+
+    char *pos() const { return m_pos; }
+
+#ifdef JSON_PARSER_STATS
+    size_t written() const { return m_written; }
+#endif
+
+  private:
+    void count(size_t n) {
+#ifdef JSON_PARSER_STATS
+      m_written += n;
+#else
+      (void)n;
+#endif
+    }
+
+    void dumpBuffer() {
+      if constexpr (has_grow_op<Derived>::value) {
+        m_pos = static_cast<Derived &>(m_os).grow_(m_pos, m_end);
+      } else {
+        m_os.puts_(m_buf, m_pos - m_buf);
+        m_pos = m_buf;
+      }
+    }
+    size_t free() const { return m_end - m_pos; }
+
+  private:
+    JsonOutputStreamBase<Derived> &m_os;
+    char m_buf[BufSize];
+    char *m_pos;
+    char *m_end;
+#ifdef JSON_PARSER_STATS
+    size_t m_written = 0;
+#endif
+  };
+
+public:
+  template <typename Derived> class JsonOutputStreamBase {
+    friend class JsonStringRingBuffer<JSON_PARSER_IO_BUFFER_SIZE, Derived>;
+
+  public:
+    JsonOutputStreamBase() : m_buf(*this) {}
+
+    void put(char c) { m_buf.put(c); }
+    void put(char c, size_t rep) { m_buf.put(c, rep); }
+    void puts(const char *s, size_t n) { m_buf.puts(s, n); }
+    // Passes the buffered output on, or makes the output of streams written
+    // in place readable.
+    void flush() { m_buf.flush(); }
+#ifdef JSON_PARSER_STATS
+    // Bytes put so far.
+    size_t written() const { return m_buf.written(); }
+#endif
+
+  protected:
+    void setWindow(char *begin, char *end) { m_buf.setWindow(begin, end); }
+    char *windowPos() const { return m_buf.pos(); }
+
+  private:
+    void puts_(const char *s, size_t n) {
+      static_cast<Derived *>(this)->puts_(s, n);
+    }
+
+  private:
+    JsonStringRingBuffer<JSON_PARSER_IO_BUFFER_SIZE, Derived> m_buf;
+  };
+
+  // Appends to str, writing in place. sizeHint bytes are reserved up front.
+  class JsonStringOutputStream
+      : public JsonOutputStreamBase<JsonStringOutputStream> {
+  public:
+    // The string is grown by sizeHint bytes, or by a buffer's worth without
+    // a hint, and cut back to the output on destruction.
+    JsonStringOutputStream(std::string &str, size_t sizeHint = 0)
+        : m_str(str) {
+      const size_t size = m_str.size();
+      m_str.resize(size + (sizeHint != 0 ? sizeHint
+                                         : size_t(JSON_PARSER_IO_BUFFER_SIZE)));
+      setWindow(m_str.data() + size, m_str.data() + m_str.size());
+    }
+    ~JsonStringOutputStream() { m_str.resize(windowPos() - m_str.data()); }
+
+    // Frees the capacity of a returned string if more than a quarter of it
+    // is unused, as after a small output or a high estimate.
+    static void shrink(std::string &str) {
+      if (str.capacity() - str.size() > str.size() / 4 + 16)
+        str.shrink_to_fit();
+    }
+
+    char *grow_(char *pos, char *&end) {
+      const size_t size = pos - m_str.data();
+      m_str.resize(std::max<size_t>(size * 2, JSON_PARSER_IO_BUFFER_SIZE));
+      end = m_str.data() + m_str.size();
+      return m_str.data() + size;
+    }
+
+    // Cuts the string back to the output. The next write grows it again.
+    char *flush_(char *pos, char *&end) {
+      m_str.resize(pos - m_str.data());
+      end = m_str.data() + m_str.size();
+      return end;
+    }
+
+  private:
     std::string &m_str;
   };
 
-  class JsonFileOutputStream
-      : public JsonOutputStreamBase<JsonFileOutputStream> {
-  public:
-    JsonFileOutputStream(std::ostream &os) : m_os(os) {}
-    void puts_(const char *s, size_t n) { m_os.write(s, n); }
+  // Writes to a caller buffer of cap bytes. size() counts the whole output,
+  // including what did not fit. No terminating null is written.
+  class JsonBufferOutputStream
+      : public JsonOutputStreamBase<JsonBufferOutputStream> {
+  public:
+    JsonBufferOutputStream(char *buf, size_t cap) : m_window(buf) {
+      setWindow(buf, buf + cap);
+    }
+
+    size_t size() const { return m_skipped + (windowPos() - m_window); }
+
+    // Bytes past the buffer go to m_discard, only to be counted.
+    char *grow_(char *pos, char *&end) {
+      m_skipped += pos - m_window;
+      m_window = m_discard;
+      end = m_discard + sizeof(m_discard);
+      return m_discard;
+    }
+    char *flush_(char *pos, char *&) { return pos; }
+
+  private:
+    char *m_window;
+    size_t m_skipped = 0;
+    char m_discard[256];
+  };
+
+  class JsonFileOutputStream
+      : public JsonOutputStreamBase<JsonFileOutputStream> {
+  public:
+    JsonFileOutputStream(std::ostream &os) : m_os(os) {}
+    void puts_(const char *s, size_t n) { m_os.write(s, n); }
+
+  private:
+    std::ostream &m_os;
+  };
+
+#ifdef JSON_PARSER_FD_OUTPUT
+  // Writes to a file descriptor, which stays open. After a failed write the
+  // rest of the output is dropped and good() returns false.
+  class JsonFdOutputStream : public JsonOutputStreamBase<JsonFdOutputStream> {
+  public:
+    explicit JsonFdOutputStream(int fd) : m_fd(fd) {}
+    bool good() const { return m_good; }
+
+    void puts_(const char *s, size_t n) {
+      while (m_good && n != 0) {
+        const ssize_t w = ::write(m_fd, s, n);
+        if (w >= 0) {
+          s += w;
+          n -= static_cast<size_t>(w);
+        } else if (errno != EINTR) {
+          m_good = false;
+        }
+      }
+    }
+
+  private:
+    int m_fd;
+    bool m_good = true;
+  };
+#endif
+
+public:
+  class Serializer {
+    friend class JsonNode;
+    template <typename T> friend class JsonValueSerializer;
+    template <typename Derived> friend class JsonWriter;
+
+    Serializer(const JsonNode &node) : m_node(node) {}
+    // A serializer of a member or element of other's node, with its options.
+    Serializer(const JsonNode &node, const Serializer &other, size_t depth)
+        : m_node(node), m_precision(other.m_precision),
+          m_indent(other.m_indent), m_ascii(other.m_ascii), m_depth(depth) {}
+
+  public:
+    Serializer(const Serializer &) = delete;
+    Serializer &operator=(const Serializer &) = delete;
+
+    Serializer &precision(int p) {
+      m_precision = p;
+      return *this;
+    }
+
+    Serializer &indent(int i) {
+      m_indent = i;
+      return *this;
+    }
+
+    Serializer &ascii(bool a) {
+      m_ascii = a;
+      return *this;
+    }
+
+#ifdef JSON_PARSER_STATS
+    // Stats of the last dump(), dumps() or dumpTo(); dumpParallel() and
+    // values written by a JsonWriter inside containers are not counted.
+    const JsonSerializeStats &stats() const { return m_stats; }
+    // Receives the stats of every value written, instead of the installed
+    // hook.
+    Serializer &statsHook(JsonStatsHook *hook) {
+      m_statsHook = hook;
+      return *this;
+    }
+#endif
+
+    template <typename Derived>
+    Serializer &dump(JsonOutputStreamBase<Derived> &os) {
+      bool formatted = (m_indent != -1);
+      JsonSerializeStats *stats = statsSink();
+#ifdef JSON_PARSER_STATS
+      std::optional<detail::JsonStatsTimer> timer;
+      if (stats != nullptr) {
+        m_stats = {};
+        m_stats.bytes = os.written();
+        timer.emplace(&m_stats.time);
+      }
+#endif
+
+      std::stack<ConstTraverseState> stateStack;
+      stateStack.emplace(&m_node);
+
+      while (!stateStack.empty()) {
+        auto node = stateStack.top().node;
+        switch (node->ty_) {
+        case NullType_:
+          JSON_PARSER_COUNT(stats, nulls, 1);
+          os.puts("null", 4);
+          stateStack.pop();
+          break;
+        case BoolType_:
+          JSON_PARSER_COUNT(stats, bools, 1);
+          node->val_.b ? os.puts("true", 4) : os.puts("false", 5);
+          stateStack.pop();
+          break;
+        case DoubleType_:
+          JSON_PARSER_COUNT(stats, doubles, 1);
+          dumpDouble(os, node->val_.d, m_precision);
+          stateStack.pop();
+          break;
+        case IntType_:
+          JSON_PARSER_COUNT(stats, ints, 1);
+          dumpInt64(os, node->val_.i);
+          stateStack.pop();
+          break;
+        case UintType_:
+          JSON_PARSER_COUNT(stats, uints, 1);
+          dumpUint64(os, node->val_.u);
+          stateStack.pop();
+          break;
+        case StrType_:
+        case StrViewType_:
+        case StrInlineType_:
+          JSON_PARSER_COUNT(stats, strings, 1);
+          os.put('"');
+          if (dumpJsonString(os, node->str(), m_ascii))
+            JSON_PARSER_COUNT(stats, escapedStrings, 1);
+          os.put('"');
+          stateStack.pop();
+          break;
+        case ArrType_: {
+          const auto &arr = *node->val_.a;
+          if (arr.empty()) {
+            JSON_PARSER_COUNT(stats, arrays, 1);
+            JSON_PARSER_COUNT_MAX(stats, maxDepth, stateStack.size());
+            os.puts("[]", 2);
+            stateStack.pop();
+            break;
+          }
+          auto &it = stateStack.top().arrIt;
+          if (it == arr.cbegin()) {
+            JSON_PARSER_COUNT(stats, arrays, 1);
+            JSON_PARSER_COUNT_MAX(stats, maxDepth, stateStack.size());
+            os.put('[');
+            if (formatted) {
+              os.put('\n');
+              os.put(' ', m_indent * (m_depth + stateStack.size()));
+            }
+          } else if (it != arr.cend()) {
+            os.put(',');
+            if (formatted) {
+              os.put('\n');
+              os.put(' ', m_indent * (m_depth + stateStack.size()));
+            }
+          }
+          if (it != arr.cend()) {
+            const auto child = &(*it);
+            ++it;
+            stateStack.emplace(child);
+          } else {
+            if (formatted) {
+              os.put('\n');
+              os.put(' ', m_indent * (m_depth + stateStack.size() - 1));
+            }
+            os.put(']');
+            stateStack.pop();
+          }
+        } break;
+        case ObjType_: {
+          const auto &obj = *node->val_.o;
+          if (obj.empty()) {
+            JSON_PARSER_COUNT(stats, objects, 1);
+            JSON_PARSER_COUNT_MAX(stats, maxDepth, stateStack.size());
+            os.puts("{}", 2);
+            stateStack.pop();
+            break;
+          }
+          auto &it = stateStack.top().objIt;
+          if (it == obj.cbegin()) {
+            JSON_PARSER_COUNT(stats, objects, 1);
+            JSON_PARSER_COUNT_MAX(stats, maxDepth, stateStack.size());
+            os.put('{');
+            if (formatted) {
+              os.put('\n');
+              os.put(' ', m_indent * (m_depth + stateStack.size()));
+            }
+          } else if (it != obj.cend()) {
+            os.put(',');
+            if (formatted) {
+              os.put('\n');
+              os.put(' ', m_indent * (m_depth + stateStack.size()));
+            }
+          }
+
+          if (it != obj.cend()) {
+            JSON_PARSER_COUNT(stats, keys, 1);
+            os.put('"');
+            if (dumpJsonString(os, it->first, m_ascii))
+              JSON_PARSER_COUNT(stats, escapedStrings, 1);
+            os.puts("\":", 2);
+            if (formatted)
+              os.put(' ');
+            const auto child = &(it->second);
+            ++it;
+            stateStack.emplace(child);
+          } else {
+            if (formatted) {
+              os.put('\n');
+              os.put(' ', m_indent * (m_depth + stateStack.size() - 1));
+            }
+            os.put('}');
+            stateStack.pop();
+          }
+        } break;
+        default:
+          stateStack.pop();
+          break;
+        }
+      }
+#ifdef JSON_PARSER_STATS
+      if (stats != nullptr) {
+        m_stats.bytes = os.written() - m_stats.bytes;
+        timer.reset();
+        if (JsonStatsHook *hook =
+                m_statsHook ? m_statsHook : JsonStatsHook::installed())
+          hook->onSerialize(m_stats);
+      }
+#endif
+      return *this;
+    }
+
+    std::string dumps() {
+      std::string str;
+      {
+        JsonStringOutputStream os(str, estimateSize());
+        dump(os);
+      }
+      JsonStringOutputStream::shrink(str);
+      return str;
+    }
+
+    // Writes up to cap bytes to buf and returns the size of the whole output,
+    // which did not fit if it is larger than cap.
+    size_t dumpTo(char *buf, size_t cap) {
+      JsonBufferOutputStream os(buf, cap);
+      dump(os);
+      return os.size();
+    }
+
+    // Writes the value as MessagePack. Integers keep their signedness, int64
+    // values using the signed formats and uint64 ones the unsigned formats, so
+    // that JsonParser::parseMsgPack restores each number with its type.
+    // Doubles that are exact as floats are written as float 32.
+    template <typename Derived>
+    Serializer &dumpMsgPack(JsonOutputStreamBase<Derived> &os) {
+      std::vector<ConstTraverseState> stack;
+      if (dumpMsgPackValue(os, m_node))
+        stack.emplace_back(&m_node);
+      while (!stack.empty()) {
+        auto &top = stack.back();
+        const JsonNode *child;
+        if (top.node->ty_ == ArrType_) {
+          if (top.arrIt == top.node->val_.a->cend()) {
+            stack.pop_back();
+            continue;
+          }
+          child = &*top.arrIt++;
+        } else {
+          if (top.objIt == top.node->val_.o->cend()) {
+            stack.pop_back();
+            continue;
+          }
+          dumpMsgPackStr(os, top.objIt->first);
+          child = &top.objIt++->second;
+        }
+        if (dumpMsgPackValue(os, *child))
+          stack.emplace_back(child);
+      }
+      return *this;
+    }
+
+    std::string dumpsMsgPack() {
+      std::string str;
+      {
+        JsonStringOutputStream os(str);
+        dumpMsgPack(os);
+      }
+      JsonStringOutputStream::shrink(str);
+      return str;
+    }
+
+    // Dumps a large top-level array or object on up to threadCount threads,
+    // 0 meaning one per hardware thread. Runs of elements are written to
+    // buffers in parallel and copied to os in order, with at most a few
+    // chunks of about ParallelChunkSize bytes per thread held at a time. The
+    // output is the same as dump(os). Smaller values are dumped sequentially.
+    template <typename Derived>
+    Serializer &dumpParallel(JsonOutputStreamBase<Derived> &os,
+                             unsigned threadCount = 0);
+
+    Serializer &dumpParallel(std::ostream &os, unsigned threadCount = 0) {
+      JsonFileOutputStream fout(os);
+      return dumpParallel(fout, threadCount);
+    }
+
+    static constexpr size_t ParallelMinSize = 256 << 10;
+    static constexpr size_t ParallelChunkSize = 1 << 20;
+
+    // Size of the output without formatting numbers or escaping strings:
+    // exact for integers, precision + 2 bytes per double when set and 17
+    // bytes otherwise.
+    size_t estimateSize() const {
+      const bool formatted = (m_indent != -1);
+      const size_t doubleSize = m_precision < 0 ? 17 : m_precision + 2;
+      if (!m_node.isArr() && !m_node.isObj())
+        return scalarSize(m_node, doubleSize);
+      size_t size = 0;
+      std::vector<std::pair<const JsonNode *, size_t>> stack{
+          {&m_node, m_depth}};
+      auto visit = [&](const JsonNode &child, size_t depth) {
+        if (child.isArr() || child.isObj())
+          stack.emplace_back(&child, depth);
+        else
+          size += scalarSize(child, doubleSize);
+      };
+      while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        const size_t n = node->size();
+        size += 2 + (n ? n - 1 : 0);
+        if (formatted && n)
+          size += n * (1 + m_indent * (depth + 1)) + 1 + m_indent * depth;
+        if (node->ty_ == ArrType_) {
+          for (const auto &e : *node->val_.a)
+            visit(e, depth + 1);
+        } else {
+          for (const auto &[key, value] : *node->val_.o) {
+            size += key.size() + 3 + formatted;
+            visit(value, depth + 1);
+          }
+        }
+      }
+      return size;
+    }
+
+  private:
+    template <typename Derived>
+    static void dumpInt64(JsonOutputStreamBase<Derived> &os, int64_t i) {
+      if (i < 0) {
+        os.put('-');
+        dumpUint64(os, 0 - static_cast<uint64_t>(i));
+      } else {
+        dumpUint64(os, i);
+      }
+    }
+
+    // Writes the node, or the header of a container. Returns true for
+    // containers with members to write.
+    template <typename Derived>
+    static bool dumpMsgPackValue(JsonOutputStreamBase<Derived> &os,
+                                 const JsonNode &node) {
+      switch (node.ty_) {
+      case NullType_:
+        os.put('\xc0');
+        return false;
+      case BoolType_:
+        os.put(node.val_.b ? '\xc3' : '\xc2');
+        return false;
+      case DoubleType_: {
+        const double d = node.val_.d;
+        const float f = static_cast<float>(d);
+        if (static_cast<double>(f) == d) {
+          uint32_t bits;
+          std::memcpy(&bits, &f, sizeof(bits));
+          putMsgPack(os, 0xca, bits, 4);
+        } else {
+          uint64_t bits;
+          std::memcpy(&bits, &d, sizeof(bits));
+          putMsgPack(os, 0xcb, bits, 8);
+        }
+        return false;
+      }
+      case IntType_: {
+        const int64_t i = node.val_.i;
+        const uint64_t u = static_cast<uint64_t>(i);
+        if (i >= -32 && i < 0)
+          os.put(static_cast<char>(i));
+        else if (i >= INT8_MIN && i <= INT8_MAX)
+          putMsgPack(os, 0xd0, u, 1);
+        else if (i >= INT16_MIN && i <= INT16_MAX)
+          putMsgPack(os, 0xd1, u, 2);
+        else if (i >= INT32_MIN && i <= INT32_MAX)
+          putMsgPack(os, 0xd2, u, 4);
+        else
+          putMsgPack(os, 0xd3, u, 8);
+        return false;
+      }
+      case UintType_: {
+        const uint64_t u = node.val_.u;
+        if (u < 0x80)
+          os.put(static_cast<char>(u));
+        else if (u <= UINT8_MAX)
+          putMsgPack(os, 0xcc, u, 1);
+        else if (u <= UINT16_MAX)
+          putMsgPack(os, 0xcd, u, 2);
+        else if (u <= UINT32_MAX)
+          putMsgPack(os, 0xce, u, 4);
+        else
+          putMsgPack(os, 0xcf, u, 8);
+        return false;
+      }
+      case StrType_:
+      case StrViewType_:
+      case StrInlineType_:
+        dumpMsgPackStr(os, node.str());
+        return false;
+      case ArrType_:
+      case ObjType_: {
+        const size_t n = node.size();
+        const bool arr = node.ty_ == ArrType_;
+        if (n < 16)
+          os.put(static_cast<char>((arr ? 0x90 : 0x80) | n));
+        else if (n <= UINT16_MAX)
+          putMsgPack(os, arr ? 0xdc : 0xde, n, 2);
+        else
+          putMsgPack(os, arr ? 0xdd : 0xdf, n, 4);
+        return n != 0;
+      }
+      default:
+        os.put('\xc0');
+        return false;
+      }
+    }
+
+    template <typename Derived>
+    static void dumpMsgPackStr(JsonOutputStreamBase<Derived> &os,
+                               std::string_view str) {
+      const size_t n = str.size();
+      if (n < 32)
+        os.put(static_cast<char>(0xa0 | n));
+      else if (n <= UINT8_MAX)
+        putMsgPack(os, 0xd9, n, 1);
+      else if (n <= UINT16_MAX)
+        putMsgPack(os, 0xda, n, 2);
+      else
+        putMsgPack(os, 0xdb, n, 4);
+      os.puts(str.data(), n);
+    }
+
+    // Writes tag followed by the low `bytes` bytes of v, big-endian.
+    template <typename Derived>
+    static void putMsgPack(JsonOutputStreamBase<Derived> &os, uint8_t tag,
+                           uint64_t v, int bytes) {
+      char buf[9];
+      buf[0] = static_cast<char>(tag);
+      for (int i = 0; i < bytes; ++i)
+        buf[bytes - i] = static_cast<char>(v >> (8 * i));
+      os.puts(buf, bytes + 1);
+    }
+
+    static size_t scalarSize(const JsonNode &node, size_t doubleSize) {
+      switch (node.ty_) {
+      case BoolType_:
+        return node.val_.b ? 4 : 5;
+      case DoubleType_:
+        return doubleSize;
+      case IntType_:
+        return node.val_.i < 0
+                   ? 1 + countDigits(0 - static_cast<uint64_t>(node.val_.i))
+                   : countDigits(node.val_.i);
+      case UintType_:
+        return countDigits(node.val_.u);
+      case StrType_:
+      case StrViewType_:
+      case StrInlineType_:
+        return node.str().size() + 2;
+      default:
+        return 4;
+      }
+    }
+
+    static size_t countDigits(uint64_t u) {
+      size_t n = 1;
+      for (; u > 9; u /= 10)
+        ++n;
+      return n;
+    }
+
+    template <typename Derived>
+    static void dumpUint64(JsonOutputStreamBase<Derived> &os, uint64_t u) {
+      char buf[20];
+      char *p = buf + 19;
+      while (u > 9) {
+        *p-- = '0' + u % 10;
+        u /= 10;
+      }
+      *p = '0' + static_cast<char>(u);
+      os.puts(p, buf + 20 - p);
+    }
+
+    template <typename Derived>
+    static void dumpDouble(JsonOutputStreamBase<Derived> &os, double d,
+                           int precision) {
+      char buf[detail::JsonDoubleBufSize];
+      os.puts(buf, detail::formatDouble(buf, d, precision));
+    }
+
+    // Returns whether anything was escaped.
+    template <typename Derived>
+    static bool dumpJsonString(JsonOutputStreamBase<Derived> &os,
+                               std::string_view src, bool ascii) {
+      const char *p = src.data();
+      const char *end = p + src.size();
+      for (bool escaped = false;; escaped = true) {
+        const char *q = detail::scanEscapeSpan(p, end, ascii);
+        os.puts(p, q - p);
+        if (q == end)
+          return escaped;
+        p = static_cast<uint8_t>(*q) < 0x80u ? dumpEscapedChar(os, q)
+                                             : dumpEscapedUtf8(os, q, end);
+      }
+    }
+
+    // Short escapes of the control characters, 0 where \u00XX is written.
+    static constexpr char ShortEscapes[32]{
+        0, 0, 0, 0, 0, 0, 0, 0, 'b', 't', 'n', 0, 'f', 'r'};
+
+    template <typename Derived>
+    static const char *dumpEscapedChar(JsonOutputStreamBase<Derived> &os,
+                                       const char *p) {
+      const uint8_t c = static_cast<uint8_t>(*p);
+      if (c >= 0x20u) {
+        const char escaped[]{'\\', *p};
+        os.puts(escaped, 2);
+      } else if (ShortEscapes[c]) {
+        const char escaped[]{'\\', ShortEscapes[c]};
+        os.puts(escaped, 2);
+      } else {
+        char escaped[6];
+        os.puts(escaped, toUnicodeEscape(escaped, c));
+      }
+      return p + 1;
+    }
+
+    // Writes the code point of the UTF-8 sequence at p as \uXXXX escapes, a
+    // surrogate pair above U+FFFF, or U+FFFD for each byte that is not part
+    // of a valid sequence.
+    template <typename Derived>
+    static const char *dumpEscapedUtf8(JsonOutputStreamBase<Derived> &os,
+                                       const char *p, const char *end) {
+      constexpr uint8_t leadMask[]{0, 0x7F, 0x1F, 0x0F, 0x07};
+      size_t n = detail::utf8SequenceLength(p, end);
+      uint32_t u = 0xFFFD;
+      if (n != 0) {
+        u = static_cast<uint8_t>(*p) & leadMask[n];
+        for (size_t i = 1; i < n; ++i)
+          u = (u << 6) | (static_cast<uint8_t>(p[i]) & 0x3F);
+        // F5..F7 leads decode past U+10FFFF, which has no surrogate pair.
+        if (u > 0x10FFFF) {
+          u = 0xFFFD;
+          n = 0;
+        }
+      }
+      char escaped[12];
+      size_t len;
+      if (u >= 0x10000) {
+        len = toUnicodeEscape(escaped, 0xD800 + ((u - 0x10000) >> 10));
+        len += toUnicodeEscape(escaped + len, 0xDC00 + (u & 0x3FF));
+      } else {
+        len = toUnicodeEscape(escaped, u);
+      }
+      os.puts(escaped, len);
+      return p + (n ? n : 1);
+    }
+
+    static size_t toUnicodeEscape(char *buf, uint32_t u) {
+      constexpr char hex[] = "0123456789abcdef";
+      buf[0] = '\\';
+      buf[1] = 'u';
+      for (int i = 5; i >= 2; --i, u >>= 4)
+        buf[i] = hex[u & 0xF];
+      return 6;
+    }
+
+    // Where dump() counts, null for nested serializers and without
+    // JSON_PARSER_STATS.
+    JsonSerializeStats *statsSink() {
+#ifdef JSON_PARSER_STATS
+      return m_depth == 0 ? &m_stats : nullptr;
+#else
+      return nullptr;
+#endif
+    }
+
+  private:
+    const JsonNode &m_node;
+    int m_precision = -1;
+    int m_indent = -1;
+    bool m_ascii = true;
+    size_t m_depth = 0; // of m_node in the output, for indentation
+#ifdef JSON_PARSER_STATS
+    JsonSerializeStats m_stats;
+    JsonStatsHook *m_statsHook = nullptr;
+#endif
+  };
+
+public:
+  Serializer serializer() const { return Serializer(*this); }
+
+private:
+  enum JsonInternalTypeId : uint8_t {
+    NullType_ = 0,
+    BoolType_,
+    DoubleType_,
+    IntType_,
+    UintType_,
+    StrType_,
+    ArrType_,
+    ObjType_,
+    StrViewType_,   // len_ chars at v, see arena_ and owned_
+    StrInlineType_, // len_ chars at c, null-terminated
+  } ty_ = {};
+
+  // The container, string holder or view characters live in a JsonArena and
+  // must not be deleted. Views without it borrow from the parser input.
+  bool arena_ = false;
+
+  // The view characters were allocated with new[] and belong to the node.
+  bool owned_ = false;
+
+  uint32_t len_ = 0;
+
+  union {
+    bool b;
+    double d;
+    int64_t i;
+    uint64_t u;
+    JsonStr_t *s;
+    JsonArr_t *a;
+    JsonObj_t *o;
+    const char *v;
+    char c[8];
+  } val_;
+
+  static constexpr size_t InlineStrCapacity = sizeof(val_) - 1;
+};
+
+// Binding of C++ types to JSON values without a JsonNode in between, see
+// JsonParser::parseInto and jsonSerializer. A struct is bound by declaring, in
+// its namespace, a function jsonFields(const T *) returning a tuple of
+// (name, member pointer) pairs, which JSON_PARSER_FIELDS writes:
+//
+//   struct Vertex { std::array<float, 3> pos; uint32_t id; };
+//   JSON_PARSER_FIELDS(Vertex, pos, id)
+//
+// Members can be of any type supported by the binding: bool, arithmetic
+// types, std::string, std::optional, bound structs, containers and maps of
+// them, and JsonNode. Other types go through a JsonNode and get<T>().
+#define JSON_PARSER_FIELDS(Type, ...)                                          \
+  [[maybe_unused]] inline constexpr auto jsonFields(const Type *) {            \
+    return std::make_tuple(                                                    \
+        JSON_PARSER_FOR_EACH_(JSON_PARSER_FIELD_, Type, __VA_ARGS__));         \
+  }
+
+#define JSON_PARSER_FIELD_(Type, field)                                        \
+  std::pair<const char *, decltype(&Type::field)>(#field, &Type::field)
+#define JSON_PARSER_EXPAND_(x) x
+#define JSON_PARSER_FE_1_(m, t, x) m(t, x)
+#define JSON_PARSER_FE_2_(m, t, x, ...)                                        \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_1_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_3_(m, t, x, ...)                                        \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_2_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_4_(m, t, x, ...)                                        \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_3_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_5_(m, t, x, ...)                                        \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_4_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_6_(m, t, x, ...)                                        \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_5_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_7_(m, t, x, ...)                                        \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_6_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_8_(m, t, x, ...)                                        \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_7_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_9_(m, t, x, ...)                                        \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_8_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_10_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_9_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_11_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_10_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_12_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_11_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_13_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_12_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_14_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_13_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_15_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_14_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_16_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_15_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_17_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_16_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_18_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_17_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_19_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_18_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_20_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_19_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_21_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_20_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_22_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_21_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_23_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_22_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_24_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_23_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_25_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_24_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_26_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_25_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_27_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_26_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_28_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_27_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_29_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_28_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_30_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_29_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_31_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_30_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_32_(m, t, x, ...)                                       \
+  m(t, x), JSON_PARSER_EXPAND_(JSON_PARSER_FE_31_(m, t, __VA_ARGS__))
+#define JSON_PARSER_FE_GET_(                                                   \
+    _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16,     \
+    _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30,      \
+    _31, _32, NAME, ...) NAME
+#define JSON_PARSER_FOR_EACH_(m, t, ...)                                       \
+  JSON_PARSER_EXPAND_(JSON_PARSER_FE_GET_(__VA_ARGS__,                         \
+                          JSON_PARSER_FE_32_, JSON_PARSER_FE_31_,              \
+                          JSON_PARSER_FE_30_, JSON_PARSER_FE_29_,              \
+                          JSON_PARSER_FE_28_, JSON_PARSER_FE_27_,              \
+                          JSON_PARSER_FE_26_, JSON_PARSER_FE_25_,              \
+                          JSON_PARSER_FE_24_, JSON_PARSER_FE_23_,              \
+                          JSON_PARSER_FE_22_, JSON_PARSER_FE_21_,              \
+                          JSON_PARSER_FE_20_, JSON_PARSER_FE_19_,              \
+                          JSON_PARSER_FE_18_, JSON_PARSER_FE_17_,              \
+                          JSON_PARSER_FE_16_, JSON_PARSER_FE_15_,              \
+                          JSON_PARSER_FE_14_, JSON_PARSER_FE_13_,              \
+                          JSON_PARSER_FE_12_, JSON_PARSER_FE_11_,              \
+                          JSON_PARSER_FE_10_, JSON_PARSER_FE_9_,               \
+                          JSON_PARSER_FE_8_, JSON_PARSER_FE_7_,                \
+                          JSON_PARSER_FE_6_, JSON_PARSER_FE_5_,                \
+                          JSON_PARSER_FE_4_, JSON_PARSER_FE_3_,                \
+                          JSON_PARSER_FE_2_, JSON_PARSER_FE_1_, ~)(m, t,       \
+                                                                   __VA_ARGS__))
+
+namespace detail {
+
+template <typename T, typename = void>
+struct has_json_fields : std::false_type {};
+template <typename T>
+struct has_json_fields<
+    T, std::void_t<decltype(jsonFields(static_cast<const T *>(nullptr)))>>
+    : std::true_type {};
+
+template <typename T> struct is_json_optional : std::false_type {};
+template <typename T>
+struct is_json_optional<std::optional<T>> : std::true_type {};
+
+// Containers growing by emplace_back(), such as std::vector.
+template <typename T, typename = void>
+struct is_json_sequence : std::false_type {};
+template <typename T>
+struct is_json_sequence<T, std::void_t<typename T::value_type,
+                                       decltype(std::declval<T &>().clear()),
+                                       decltype(std::declval<T &>()
+                                                    .emplace_back())>>
+    : std::is_same<decltype(std::declval<T &>().back()),
+                   typename T::value_type &> {};
+
+// Fixed-size arrays, such as std::array.
+template <typename T, typename = void>
+struct is_json_array : std::false_type {};
+template <typename T>
+struct is_json_array<T, std::void_t<decltype(std::tuple_size<T>::value),
+                                    decltype(std::declval<T &>()[0])>>
+    : std::true_type {};
+
+template <typename T, typename = void> struct is_json_map : std::false_type {};
+template <typename T>
+struct is_json_map<
+    T, std::void_t<typename T::key_type, typename T::mapped_type,
+                   decltype(std::declval<T &>().clear()),
+                   decltype(std::declval<T &>().emplace(
+                       std::declval<std::string>(),
+                       std::declval<typename T::mapped_type>()))>>
+    : std::is_constructible<typename T::key_type, std::string> {};
+
+template <typename T, typename = void>
+struct is_json_range : std::false_type {};
+template <typename T>
+struct is_json_range<
+    T, std::void_t<decltype(std::begin(std::declval<const T &>())),
+                   decltype(std::end(std::declval<const T &>()))>>
+    : std::true_type {};
+
+enum class JsonBindKind : uint8_t {
+  Node,
+  Bool,
+  Number,
+  String,
+  Optional,
+  Struct,
+  Map,
+  Sequence,
+  Array,
+  Other, // converted from or to a JsonNode
+};
+
+template <typename T> constexpr JsonBindKind jsonBindKind() {
+  if constexpr (std::is_same_v<T, JsonNode>)
+    return JsonBindKind::Node;
+  else if constexpr (std::is_same_v<T, bool>)
+    return JsonBindKind::Bool;
+  else if constexpr (std::is_arithmetic_v<T> && !std::is_same_v<T, char>)
+    return JsonBindKind::Number;
+  else if constexpr (std::is_same_v<T, std::string>)
+    return JsonBindKind::String;
+  else if constexpr (is_json_optional<T>::value)
+    return JsonBindKind::Optional;
+  else if constexpr (has_json_fields<T>::value)
+    return JsonBindKind::Struct;
+  else if constexpr (is_json_map<T>::value)
+    return JsonBindKind::Map;
+  else if constexpr (is_json_sequence<T>::value)
+    return JsonBindKind::Sequence;
+  else if constexpr (is_json_array<T>::value)
+    return JsonBindKind::Array;
+  else
+    return JsonBindKind::Other;
+}
+
+struct JsonBindOps;
+
+// A value being filled: its address and how events apply to it.
+struct JsonBindTarget {
+  void *p = nullptr;
+  const JsonBindOps *ops = nullptr;
+
+  explicit operator bool() const { return ops != nullptr; }
+};
+
+// Applies parse events to a value of some type. element() and member()
+// return the value receiving the next element or the value of a key.
+struct JsonBindOps {
+  void (*onNull)(void *);
+  void (*onBool)(void *, bool);
+  void (*onInt64)(void *, int64_t);
+  void (*onUint64)(void *, uint64_t);
+  void (*onDouble)(void *, double);
+  void (*onString)(void *, std::string_view);
+  void (*onStartArray)(void *);
+  JsonBindTarget (*element)(void *, size_t);
+  void (*onStartObject)(void *);
+  JsonBindTarget (*member)(void *, std::string_view);
+  // Set for std::optional, engages the value before a non-null event.
+  JsonBindTarget (*resolve)(void *);
+  // Set for types assigned from a JsonNode built from the events.
+  void (*assignNode)(void *, JsonNode &&);
+  // Set for sequences and arrays of numbers, stores element i directly.
+  void (*appendInt64)(void *, size_t, int64_t);
+  void (*appendUint64)(void *, size_t, uint64_t);
+  void (*appendDouble)(void *, size_t, double);
+};
+
+[[noreturn]] inline void throwJsonBindMismatch() {
+  throw std::runtime_error(getJsonErrorMsg(JsonErrorCode::InvalidJsonAccess));
+}
+
+// Ignores the members of structs that are not bound.
+struct JsonBindSkip {
+  static void onNull(void *) {}
+  static void onBool(void *, bool) {}
+  static void onInt64(void *, int64_t) {}
+  static void onUint64(void *, uint64_t) {}
+  static void onDouble(void *, double) {}
+  static void onString(void *, std::string_view) {}
+  static void onContainer(void *) {}
+  static JsonBindTarget element(void *, size_t) { return {nullptr, &ops}; }
+  static JsonBindTarget member(void *, std::string_view) {
+    return {nullptr, &ops};
+  }
+
+  static constexpr JsonBindOps ops{
+      &onNull,      &onBool,  &onInt64,  &onUint64, &onDouble, &onString,
+      &onContainer, &element, &onContainer, &member,  nullptr,   nullptr,
+      nullptr,      nullptr,  nullptr};
+};
+
+template <typename T> struct JsonBinding {
+  static constexpr JsonBindKind Kind = jsonBindKind<T>();
+
+  template <typename U> static JsonBindTarget target(U &u) {
+    return {&u, &JsonBinding<U>::ops};
+  }
+
+  static T &value(void *p) { return *static_cast<T *>(p); }
+
+  static void onNull(void *p) {
+    if constexpr (Kind == JsonBindKind::Optional)
+      value(p).reset();
+    else if constexpr (Kind == JsonBindKind::String)
+      value(p) = "null";
+    else
+      throwJsonBindMismatch();
+  }
+
+  static void onBool(void *p, bool b) {
+    if constexpr (Kind == JsonBindKind::Bool)
+      value(p) = b;
+    else if constexpr (Kind == JsonBindKind::String)
+      value(p) = b ? "true" : "false";
+    else
+      throwJsonBindMismatch();
+  }
+
+  template <typename N> static void onNumber(void *p, N n) {
+    if constexpr (Kind == JsonBindKind::Bool || Kind == JsonBindKind::Number) {
+      value(p) = static_cast<T>(n);
+    } else if constexpr (Kind == JsonBindKind::String) {
+      if constexpr (std::is_same_v<N, double>) {
+        char buf[JsonDoubleBufSize];
+        value(p).assign(buf, formatDouble(buf, n, -1));
+      } else {
+        value(p) = std::to_string(n);
+      }
+    } else {
+      throwJsonBindMismatch();
+    }
+  }
+  static void onInt64(void *p, int64_t i) { onNumber(p, i); }
+  static void onUint64(void *p, uint64_t u) { onNumber(p, u); }
+  static void onDouble(void *p, double d) { onNumber(p, d); }
+
+  static void onString(void *p, std::string_view str) {
+    if constexpr (Kind == JsonBindKind::String)
+      value(p).assign(str);
+    else
+      throwJsonBindMismatch();
+  }
+
+  static void onStartArray(void *p) {
+    if constexpr (Kind == JsonBindKind::Sequence)
+      value(p).clear();
+    else if constexpr (Kind == JsonBindKind::Array)
+      value(p) = T{};
+    else
+      throwJsonBindMismatch();
+  }
+
+  template <typename U> static constexpr bool isNumberContainer() {
+    if constexpr (Kind == JsonBindKind::Sequence || Kind == JsonBindKind::Array)
+      return jsonBindKind<typename U::value_type>() == JsonBindKind::Number;
+    else
+      return false;
+  }
+
+  template <typename N> static void append(void *p, size_t i, N n) {
+    if constexpr (isNumberContainer<T>()) {
+      using Elem = typename T::value_type;
+      if constexpr (Kind == JsonBindKind::Sequence) {
+        value(p).push_back(static_cast<Elem>(n));
+      } else {
+        if (i >= std::tuple_size<T>::value)
+          throwJsonBindMismatch();
+        value(p)[i] = static_cast<Elem>(n);
+      }
+    } else {
+      (void)p;
+      (void)i;
+      (void)n;
+      throwJsonBindMismatch();
+    }
+  }
+
+  static JsonBindTarget element(void *p, size_t i) {
+    if constexpr (Kind == JsonBindKind::Sequence) {
+      value(p).emplace_back();
+      return target(value(p).back());
+    } else if constexpr (Kind == JsonBindKind::Array) {
+      if (i >= std::tuple_size<T>::value)
+        throwJsonBindMismatch();
+      return target(value(p)[i]);
+    } else {
+      (void)p;
+      (void)i;
+      throwJsonBindMismatch();
+    }
+  }
+
+  static void onStartObject(void *p) {
+    if constexpr (Kind == JsonBindKind::Struct)
+      value(p) = T{};
+    else if constexpr (Kind == JsonBindKind::Map)
+      value(p).clear();
+    else
+      throwJsonBindMismatch();
+  }
+
+  static JsonBindTarget member(void *p, std::string_view key) {
+    if constexpr (Kind == JsonBindKind::Struct) {
+      JsonBindTarget ret{nullptr, &JsonBindSkip::ops};
+      std::apply(
+          [&](const auto &...field) {
+            (void)((key == field.first
+                        ? (ret = target(value(p).*field.second), true)
+                        : false) ||
+                   ...);
+          },
+          jsonFields(static_cast<const T *>(nullptr)));
+      return ret;
+    } else if constexpr (Kind == JsonBindKind::Map) {
+      using Mapped = typename T::mapped_type;
+      auto it = value(p).emplace(std::string(key), Mapped{}).first;
+      it->second = Mapped{}; // the last duplicate key wins
+      return target(it->second);
+    } else {
+      (void)p;
+      (void)key;
+      throwJsonBindMismatch();
+    }
+  }
+
+  static JsonBindTarget resolve(void *p) {
+    if constexpr (Kind == JsonBindKind::Optional)
+      return target(value(p).emplace());
+    else
+      return {p, &ops};
+  }
+
+  static void assignNode(void *p, JsonNode &&node) {
+    if constexpr (Kind == JsonBindKind::Node)
+      value(p) = std::move(node);
+    else if constexpr (Kind == JsonBindKind::Other)
+      value(p) = node.get<T>();
+    else
+      throwJsonBindMismatch();
+  }
+
+  static constexpr JsonBindOps ops{
+      &onNull,
+      &onBool,
+      &onInt64,
+      &onUint64,
+      &onDouble,
+      &onString,
+      &onStartArray,
+      &element,
+      &onStartObject,
+      &member,
+      Kind == JsonBindKind::Optional ? &resolve : nullptr,
+      Kind == JsonBindKind::Node || Kind == JsonBindKind::Other ? &assignNode
+                                                                 : nullptr,
+      isNumberContainer<T>() ? &append<int64_t> : nullptr,
+      isNumberContainer<T>() ? &append<uint64_t> : nullptr,
+      isNumberContainer<T>() ? &append<double> : nullptr};
+};
+
+} // namespace detail
+
+// Writes a value of a bound type without building a JsonNode, see
+// JSON_PARSER_FIELDS. Returned by jsonSerializer(value), which has to outlive
+// it. Values of unbound types are converted to a JsonNode first.
+template <typename T> class JsonValueSerializer {
+public:
+  explicit JsonValueSerializer(const T &value) : m_value(value) {}
+
+  JsonValueSerializer &precision(int p) {
+    m_precision = p;
+    return *this;
+  }
+
+  JsonValueSerializer &ascii(bool a) {
+    m_ascii = a;
+    return *this;
+  }
+
+  template <typename Derived>
+  const JsonValueSerializer &
+  dump(JsonNode::JsonOutputStreamBase<Derived> &os) const {
+    write(os, m_value);
+    return *this;
+  }
+
+  std::string dumps() const {
+    std::string str;
+    {
+      JsonNode::JsonStringOutputStream os(str);
+      dump(os);
+    }
+    JsonNode::JsonStringOutputStream::shrink(str);
+    return str;
+  }
+
+  // Like JsonNode::Serializer::dumpTo().
+  size_t dumpTo(char *buf, size_t cap) const {
+    JsonNode::JsonBufferOutputStream os(buf, cap);
+    dump(os);
+    return os.size();
+  }
+
+private:
+  using Serializer = JsonNode::Serializer;
+
+  template <typename Derived, typename U>
+  void write(JsonNode::JsonOutputStreamBase<Derived> &os, const U &v) const {
+    constexpr auto Kind = detail::jsonBindKind<U>();
+    if constexpr (Kind == detail::JsonBindKind::Bool) {
+      v ? os.puts("true", 4) : os.puts("false", 5);
+    } else if constexpr (Kind == detail::JsonBindKind::Number) {
+      if constexpr (std::is_floating_point_v<U>)
+        Serializer::dumpDouble(os, static_cast<double>(v), m_precision);
+      else if constexpr (std::is_signed_v<U>)
+        Serializer::dumpInt64(os, static_cast<int64_t>(v));
+      else
+        Serializer::dumpUint64(os, static_cast<uint64_t>(v));
+    } else if constexpr (Kind == detail::JsonBindKind::String ||
+                         std::is_same_v<U, std::string_view>) {
+      os.put('"');
+      Serializer::dumpJsonString(os, v, m_ascii);
+      os.put('"');
+    } else if constexpr (Kind == detail::JsonBindKind::Optional) {
+      if (v)
+        write(os, *v);
+      else
+        os.puts("null", 4);
+    } else if constexpr (Kind == detail::JsonBindKind::Node) {
+      v.serializer().precision(m_precision).ascii(m_ascii).dump(os);
+    } else if constexpr (Kind == detail::JsonBindKind::Struct) {
+      os.put('{');
+      bool first = true;
+      std::apply(
+          [&](const auto &...field) {
+            ((writeKey(os, field.first, first), write(os, v.*field.second)),
+             ...);
+          },
+          jsonFields(static_cast<const U *>(nullptr)));
+      os.put('}');
+    } else if constexpr (Kind == detail::JsonBindKind::Map) {
+      os.put('{');
+      bool first = true;
+      for (const auto &p : v) {
+        writeKey(os, std::string_view(p.first), first);
+        write(os, p.second);
+      }
+      os.put('}');
+    } else if constexpr (detail::is_json_range<U>::value) {
+      os.put('[');
+      bool first = true;
+      for (const auto &e : v) {
+        if (!first)
+          os.put(',');
+        first = false;
+        write(os, e);
+      }
+      os.put(']');
+    } else {
+      JsonNode(v).serializer().precision(m_precision).ascii(m_ascii).dump(os);
+    }
+  }
+
+  template <typename Derived>
+  void writeKey(JsonNode::JsonOutputStreamBase<Derived> &os,
+                std::string_view key, bool &first) const {
+    if (!first)
+      os.put(',');
+    first = false;
+    os.put('"');
+    Serializer::dumpJsonString(os, key, m_ascii);
+    os.puts("\":", 2);
+  }
+
+private:
+  const T &m_value;
+  int m_precision = -1;
+  bool m_ascii = true;
+};
+
+template <typename T> JsonValueSerializer<T> jsonSerializer(const T &value) {
+  return JsonValueSerializer<T>(value);
+}
+
+// Writes JSON to os call by call, without building a JsonNode. Members of an
+// object are written as key() followed by their value. The output, including
+// indentation, is the same as the serializer's for the equivalent tree. Calls
+// out of order throw std::logic_error. Buffered output reaches os when it is
+// destroyed or flushed.
+template <typename Derived> class JsonWriter {
+public:
+  explicit JsonWriter(JsonNode::JsonOutputStreamBase<Derived> &os) : m_os(os) {}
+  JsonWriter(const JsonWriter &) = delete;
+  JsonWriter &operator=(const JsonWriter &) = delete;
+
+  JsonWriter &precision(int p) {
+    m_precision = p;
+    return *this;
+  }
+
+  JsonWriter &indent(int i) {
+    m_indent = i;
+    return *this;
+  }
+
+  JsonWriter &ascii(bool a) {
+    m_ascii = a;
+    return *this;
+  }
+
+  JsonWriter &beginArray() { return begin(false); }
+  JsonWriter &endArray() { return end(false); }
+  JsonWriter &beginObject() { return begin(true); }
+  JsonWriter &endObject() { return end(true); }
+
+  JsonWriter &key(std::string_view k) {
+    if (m_stack.empty() || !m_stack.back().object || m_afterKey)
+      throw std::logic_error("JsonWriter: unexpected key");
+    separate();
+    m_os.put('"');
+    Serializer::dumpJsonString(m_os, k, m_ascii);
+    m_os.puts("\":", 2);
+    if (m_indent != -1)
+      m_os.put(' ');
+    m_afterKey = true;
+    return *this;
+  }
+
+  JsonWriter &value(std::nullptr_t) {
+    startValue();
+    m_os.puts("null", 4);
+    return *this;
+  }
+  JsonWriter &value(JsonNull_t) { return value(nullptr); }
+
+  JsonWriter &value(bool b) {
+    startValue();
+    b ? m_os.puts("true", 4) : m_os.puts("false", 5);
+    return *this;
+  }
+
+  template <typename T,
+            typename std::enable_if_t<std::is_arithmetic_v<T> &&
+                                          !std::is_same_v<T, bool> &&
+                                          !std::is_same_v<T, char>,
+                                      int> = 0>
+  JsonWriter &value(T num) {
+    startValue();
+    if constexpr (std::is_floating_point_v<T>)
+      Serializer::dumpDouble(m_os, static_cast<double>(num), m_precision);
+    else if constexpr (std::is_signed_v<T>)
+      Serializer::dumpInt64(m_os, static_cast<int64_t>(num));
+    else
+      Serializer::dumpUint64(m_os, static_cast<uint64_t>(num));
+    return *this;
+  }
+
+  JsonWriter &value(std::string_view str) {
+    startValue();
+    m_os.put('"');
+    Serializer::dumpJsonString(m_os, str, m_ascii);
+    m_os.put('"');
+    return *this;
+  }
+  JsonWriter &value(const char *str) { return value(std::string_view(str)); }
+  JsonWriter &value(const std::string &str) {
+    return value(std::string_view(str));
+  }
+  // A one-character string, as for JsonNode(char).
+  JsonWriter &value(char c) { return value(std::string_view(&c, 1)); }
+
+  // Writes node with the options of this writer, indented at this depth.
+  JsonWriter &value(const JsonNode &node) {
+    startValue();
+    Serializer s(node);
+    s.precision(m_precision).indent(m_indent).ascii(m_ascii);
+    s.m_depth = m_stack.size();
+    s.dump(m_os);
+    return *this;
+  }
+
+  // Set once a whole top-level value has been written.
+  bool complete() const { return m_done && m_stack.empty(); }
+
+  void flush() { m_os.flush(); }
+
+private:
+  using Serializer = JsonNode::Serializer;
+
+  struct Level {
+    bool object;
+    bool empty;
+  };
+
+  // Checks that a value may come now and writes what precedes it.
+  void startValue() {
+    if (m_stack.empty()) {
+      if (m_done)
+        throw std::logic_error("JsonWriter: value after the top-level value");
+      m_done = true;
+    } else if (m_stack.back().object) {
+      if (!m_afterKey)
+        throw std::logic_error("JsonWriter: member without a key");
+      m_afterKey = false;
+    } else {
+      separate();
+    }
+  }
+
+  // Writes the comma and line break before an element or member.
+  void separate() {
+    Level &top = m_stack.back();
+    if (!top.empty)
+      m_os.put(',');
+    top.empty = false;
+    if (m_indent != -1) {
+      m_os.put('\n');
+      m_os.put(' ', m_indent * m_stack.size());
+    }
+  }
+
+  JsonWriter &begin(bool object) {
+    startValue();
+    m_os.put(object ? '{' : '[');
+    m_stack.push_back({object, true});
+    return *this;
+  }
+
+  JsonWriter &end(bool object) {
+    if (m_stack.empty() || m_stack.back().object != object || m_afterKey)
+      throw std::logic_error(object ? "JsonWriter: unexpected endObject"
+                                    : "JsonWriter: unexpected endArray");
+    const bool empty = m_stack.back().empty;
+    m_stack.pop_back();
+    if (m_indent != -1 && !empty) {
+      m_os.put('\n');
+      m_os.put(' ', m_indent * m_stack.size());
+    }
+    m_os.put(object ? '}' : ']');
+    return *this;
+  }
+
+private:
+  JsonNode::JsonOutputStreamBase<Derived> &m_os;
+  std::vector<Level> m_stack;
+  bool m_afterKey = false;
+  bool m_done = false;
+  int m_precision = -1;
+  int m_indent = -1;
+  bool m_ascii = true;
+};
+
+// Receives the events of JsonParser::saxParse. Handlers derive from this class
+// and hide the methods they need; returning false stops parsing. Strings and
+// keys are only valid during the call. A handler may also provide
+// onString(std::string_view, bool inInput) and onKey(std::string_view, bool
+// inInput), inInput telling whether the characters are part of the input, and
+// onStartArray(size_t) and onStartObject(size_t), called with the member count
+// when the input gives it up front. A handler providing bool wantsValue() is
+// asked before each value whether it wants it, a skipped value is scanned
+// past without being decoded or reported.
+class JsonSaxHandler {
+public:
+  bool onNull() { return true; }
+  bool onBool(bool) { return true; }
+  bool onInt64(int64_t) { return true; }
+  bool onUint64(uint64_t) { return true; }
+  bool onDouble(double) { return true; }
+  bool onString(std::string_view) { return true; }
+  bool onKey(std::string_view) { return true; }
+  bool onStartArray() { return true; }
+  bool onEndArray() { return true; }
+  bool onStartObject() { return true; }
+  bool onEndObject() { return true; }
+};
+
+namespace detail {
+
+template <typename Handler, typename = void>
+struct has_on_string_in_input : std::false_type {};
+
+template <typename Handler>
+struct has_on_string_in_input<
+    Handler, std::void_t<decltype(std::declval<Handler &>().onString(
+                 std::string_view{}, true))>> : std::true_type {};
+
+template <typename Handler, typename = void>
+struct has_on_key_in_input : std::false_type {};
+
+template <typename Handler>
+struct has_on_key_in_input<
+    Handler, std::void_t<decltype(std::declval<Handler &>().onKey(
+                 std::string_view{}, true))>> : std::true_type {};
+
+template <typename Handler>
+inline bool callOnString(Handler &handler, std::string_view str,
+                         bool inInput) {
+  if constexpr (has_on_string_in_input<Handler>::value)
+    return handler.onString(str, inInput);
+  else
+    return handler.onString(str);
+}
+
+template <typename Handler>
+inline bool callOnKey(Handler &handler, std::string_view key, bool inInput) {
+  if constexpr (has_on_key_in_input<Handler>::value)
+    return handler.onKey(key, inInput);
+  else
+    return handler.onKey(key);
+}
+
+template <typename Handler, typename = void>
+struct has_on_start_sized : std::false_type {};
+
+template <typename Handler>
+struct has_on_start_sized<
+    Handler,
+    std::void_t<decltype(std::declval<Handler &>().onStartArray(size_t{})),
+                decltype(std::declval<Handler &>().onStartObject(size_t{}))>>
+    : std::true_type {};
+
+template <typename Handler>
+inline bool callOnStart(Handler &handler, bool isObj, size_t size) {
+  if constexpr (has_on_start_sized<Handler>::value)
+    return isObj ? handler.onStartObject(size) : handler.onStartArray(size);
+  else
+    return isObj ? handler.onStartObject() : handler.onStartArray();
+}
+
+template <typename Handler, typename = void>
+struct has_wants_value : std::false_type {};
+
+template <typename Handler>
+struct has_wants_value<
+    Handler, std::void_t<decltype(std::declval<Handler &>().wantsValue())>>
+    : std::true_type {};
+
+#ifdef JSON_PARSER_STATS
+template <typename Stream, typename = void>
+struct has_input_pos : std::false_type {};
+
+template <typename Stream>
+struct has_input_pos<Stream,
+                     std::void_t<decltype(std::declval<const Stream &>().pos())>>
+    : std::true_type {};
+#endif
+
+template <typename Handler> class JsonProjectionFilter;
+
+} // namespace detail
+
+// A set of paths selecting the parts of a document JsonParser::parse builds.
+// A path is a JSON Pointer ("/items/0/price") or uses the dotted form
+// ("$.items[0].price"); a "*" segment matches every member or element, and
+// the empty path (or "$") selects the whole document. Selected values are
+// built with their descendants, the containers leading to them are kept and
+// everything else is skipped without being decoded.
+class JsonProjection {
+public:
+  JsonProjection() = default;
+  JsonProjection(std::initializer_list<std::string_view> paths) {
+    for (auto path : paths)
+      add(path);
+  }
+
+  // Throws std::invalid_argument if the path is malformed.
+  JsonProjection &add(std::string_view path) {
+    std::vector<Segment> segments;
+    if (!path.empty() && path[0] == '/')
+      parsePointer(path, segments);
+    else if (!path.empty() && path[0] == '$')
+      parseDotted(path, segments);
+    else if (!path.empty())
+      throw std::invalid_argument("JsonProjection: invalid path");
+    insert(0, segments, 0);
+    return *this;
+  }
+
+private:
+  template <typename> friend class detail::JsonProjectionFilter;
+
+  // Node ids, 0 being the root. Whole stands for a selected value.
+  static constexpr uint32_t None = 0;
+  static constexpr uint32_t Whole = UINT32_MAX;
+
+  struct Segment {
+    std::string key;
+    bool any;
+  };
+
+  // Every exact child also holds the paths of the wildcard child, so a value
+  // matches at most one node.
+  struct Node {
+    std::vector<std::pair<std::string, uint32_t>> children;
+    uint32_t any = None;
+    bool whole = false;
+  };
+
+  uint32_t member(uint32_t node, std::string_view key) const {
+    const Node &n = m_nodes[node];
+    uint32_t ret = n.any;
+    for (const auto &[k, child] : n.children)
+      if (k == key) {
+        ret = child;
+        break;
+      }
+    return ret != None && m_nodes[ret].whole ? Whole : ret;
+  }
+
+  uint32_t element(uint32_t node, size_t index) const {
+    const Node &n = m_nodes[node];
+    if (n.children.empty())
+      return n.any != None && m_nodes[n.any].whole ? Whole : n.any;
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), index);
+    return member(node, std::string_view(buf, res.ptr - buf));
+  }
+
+  uint32_t root() const { return m_nodes[0].whole ? Whole : 0; }
+
+  void insert(uint32_t node, const std::vector<Segment> &path, size_t i) {
+    if (m_nodes[node].whole)
+      return;
+    if (i == path.size()) {
+      m_nodes[node] = Node{};
+      m_nodes[node].whole = true;
+      return;
+    }
+    if (path[i].any) {
+      insert(anyChild(node), path, i + 1);
+      for (size_t j = 0; j < m_nodes[node].children.size(); ++j)
+        insert(m_nodes[node].children[j].second, path, i + 1);
+    } else {
+      insert(exactChild(node, path[i].key), path, i + 1);
+    }
+  }
+
+  uint32_t anyChild(uint32_t node) {
+    if (m_nodes[node].any == None) {
+      uint32_t id = newNode();
+      m_nodes[node].any = id;
+    }
+    return m_nodes[node].any;
+  }
+
+  uint32_t exactChild(uint32_t node, const std::string &key) {
+    for (const auto &[k, child] : m_nodes[node].children)
+      if (k == key)
+        return child;
+    uint32_t id = newNode();
+    if (m_nodes[node].any != None)
+      copy(id, m_nodes[node].any);
+    m_nodes[node].children.emplace_back(key, id);
+    return id;
+  }
+
+  void copy(uint32_t dst, uint32_t src) {
+    m_nodes[dst].whole = m_nodes[src].whole;
+    for (size_t i = 0; i < m_nodes[src].children.size(); ++i) {
+      uint32_t id = newNode();
+      copy(id, m_nodes[src].children[i].second);
+      m_nodes[dst].children.emplace_back(m_nodes[src].children[i].first, id);
+    }
+    if (m_nodes[src].any != None) {
+      uint32_t id = newNode();
+      copy(id, m_nodes[src].any);
+      m_nodes[dst].any = id;
+    }
+  }
+
+  uint32_t newNode() {
+    m_nodes.emplace_back();
+    return static_cast<uint32_t>(m_nodes.size() - 1);
+  }
+
+  static void parsePointer(std::string_view path,
+                           std::vector<Segment> &segments) {
+    // Each segment follows a '/', "~0" and "~1" stand for '~' and '/'.
+    for (size_t pos = 1, next; pos <= path.size(); pos = next + 1) {
+      next = std::min(path.find('/', pos), path.size());
+      std::string key;
+      for (size_t i = pos; i < next; ++i) {
+        if (path[i] != '~') {
+          key.push_back(path[i]);
+          continue;
+        }
+        if (++i == next || (path[i] != '0' && path[i] != '1'))
+          throw std::invalid_argument("JsonProjection: invalid path");
+        key.push_back(path[i] == '0' ? '~' : '/');
+      }
+      bool any = key == "*";
+      segments.push_back({std::move(key), any});
+    }
+  }
+
+  static void parseDotted(std::string_view path,
+                          std::vector<Segment> &segments) {
+    // ".name", ".*", "[index]", "[*]" and "['name']" after the '$'.
+    for (size_t i = 1; i < path.size();) {
+      size_t end;
+      if (path[i] == '.') {
+        end = std::min(path.find_first_of(".[", i + 1), path.size());
+        if (end == i + 1)
+          throw std::invalid_argument("JsonProjection: invalid path");
+        std::string_view key = path.substr(i + 1, end - i - 1);
+        segments.push_back({std::string(key), key == "*"});
+      } else if (path[i] == '[') {
+        const char quote = i + 1 < path.size() ? path[i + 1] : '\0';
+        if (quote == '\'' || quote == '"') {
+          size_t close = path.find(quote, i + 2);
+          if (close == std::string_view::npos || close + 1 >= path.size() ||
+              path[close + 1] != ']')
+            throw std::invalid_argument("JsonProjection: invalid path");
+          segments.push_back(
+              {std::string(path.substr(i + 2, close - i - 2)), false});
+          end = close + 2;
+        } else {
+          size_t close = path.find(']', i + 1);
+          if (close == std::string_view::npos || close == i + 1)
+            throw std::invalid_argument("JsonProjection: invalid path");
+          std::string_view index = path.substr(i + 1, close - i - 1);
+          if (index != "*" &&
+              index.find_first_not_of("0123456789") != std::string_view::npos)
+            throw std::invalid_argument("JsonProjection: invalid path");
+          segments.push_back({std::string(index), index == "*"});
+          end = close + 1;
+        }
+      } else {
+        throw std::invalid_argument("JsonProjection: invalid path");
+      }
+      i = end;
+    }
+  }
+
+private:
+  std::vector<Node> m_nodes{1};
+};
+
+namespace detail {
+
+// Passes the events of the values selected by a projection on to handler and
+// tells the parser to skip the others. A key is held back until its value
+// turns out to be selected.
+template <typename Handler> class JsonProjectionFilter {
+public:
+  JsonProjectionFilter(const JsonProjection &projection, Handler &handler)
+      : m_projection(projection), m_handler(handler) {}
+
+  bool wantsValue() {
+    if (m_stack.empty()) {
+      m_next = m_projection.root();
+      return true;
+    }
+    Scope &top = m_stack.back();
+    if (top.node == JsonProjection::Whole)
+      m_next = JsonProjection::Whole;
+    else if (top.isObj)
+      m_next = top.member;
+    else
+      m_next = m_projection.element(top.node, top.index++);
+    return m_next != JsonProjection::None;
+  }
+
+  bool onNull() { return !selected() || (emitKey() && m_handler.onNull()); }
+  bool onBool(bool b) {
+    return !selected() || (emitKey() && m_handler.onBool(b));
+  }
+  bool onInt64(int64_t i) {
+    return !selected() || (emitKey() && m_handler.onInt64(i));
+  }
+  bool onUint64(uint64_t u) {
+    return !selected() || (emitKey() && m_handler.onUint64(u));
+  }
+  bool onDouble(double d) {
+    return !selected() || (emitKey() && m_handler.onDouble(d));
+  }
+  bool onString(std::string_view str, bool inInput) {
+    return !selected() ||
+           (emitKey() && callOnString(m_handler, str, inInput));
+  }
+
+  bool onKey(std::string_view key) {
+    Scope &top = m_stack.back();
+    if (top.node == JsonProjection::Whole)
+      return callOnKey(m_handler, key, false);
+    top.member = m_projection.member(top.node, key);
+    if (top.member != JsonProjection::None) {
+      m_key.assign(key);
+      m_keyPending = true;
+    }
+    return true;
+  }
+
+  bool onStartArray() { return startScope(false) && m_handler.onStartArray(); }
+  bool onStartObject() {
+    return startScope(true) && m_handler.onStartObject();
+  }
+  bool onEndArray() {
+    m_stack.pop_back();
+    return m_handler.onEndArray();
+  }
+  bool onEndObject() {
+    m_stack.pop_back();
+    return m_handler.onEndObject();
+  }
+
+private:
+  struct Scope {
+    uint32_t node;
+    bool isObj;
+    size_t index = 0;
+    uint32_t member = JsonProjection::None;
+  };
+
+  // Scalars that only lead to a selected path are dropped.
+  bool selected() {
+    if (m_next == JsonProjection::Whole)
+      return true;
+    m_keyPending = false;
+    return false;
+  }
+
+  bool emitKey() {
+    if (!m_keyPending)
+      return true;
+    m_keyPending = false;
+    return callOnKey(m_handler, m_key, false);
+  }
+
+  bool startScope(bool isObj) {
+    if (!emitKey())
+      return false;
+    m_stack.push_back({m_next, isObj});
+    return true;
+  }
+
+private:
+  const JsonProjection &m_projection;
+  Handler &m_handler;
+  std::vector<Scope> m_stack;
+  uint32_t m_next = JsonProjection::None;
+  std::string m_key;
+  bool m_keyPending = false;
+};
+
+} // namespace detail
+
+using JsonErrorCode = detail::JsonErrorCode;
+
+// Outcome of JsonParser::tryParse. offset is where parsing stopped: the end of
+// the input, or of the value if no end check was asked for, or the position
+// at which the error was found.
+struct JsonParseResult {
+  JsonNode value;
+  size_t offset = 0;
+  bool failed = false;
+  JsonErrorCode error = JsonErrorCode::InvalidJson; // set if failed
+
+  explicit operator bool() const { return !failed; }
+  const char *message() const {
+    return failed ? detail::getJsonErrorMsg(error) : "";
+  }
+};
+
+class JsonParser {
+public:
+  JsonParser() = default;
+  // Containers and strings of parsed trees are allocated from arena, which
+  // must outlive them.
+  explicit JsonParser(JsonArena &arena) : m_arena(&arena) {}
+  JsonParser(const JsonParser &) = delete;
+  JsonParser &operator=(const JsonParser &) = delete;
+
+  // When parsing from a std::string_view, string values without escape
+  // sequences refer to the input instead of being copied. The input must
+  // outlive the returned tree. Strings shorter than 8 bytes are still stored
+  // in their node.
+  JsonParser &borrowStrings(bool b) {
+    m_borrowStrings = b;
+    return *this;
+  }
+
+  // Object keys longer than JsonKey::InlineCapacity are kept in a table and
+  // shared by every tree this parser builds, so each distinct key is stored
+  // once and compared by address. Keys stay in the table until releasePool().
+  JsonParser &internKeys(bool b) {
+    m_internKeys = b;
+    return *this;
+  }
+
+  // std::ifstream input is read in blocks of ReadAheadBlockSize, the next one
+  // on a separate thread while the current one is parsed. Without an end
+  // check the stream is left after the value, as without read-ahead.
+  JsonParser &readAhead(bool b) {
+    m_readAhead = b;
+    return *this;
+  }
+
+  static constexpr size_t ReadAheadBlockSize = 1 << 20;
+
+#ifdef JSON_PARSER_STATS
+  // Stats of the last document parsed; feed() reports when the document is
+  // finished and parseParallel() once for the whole array.
+  const JsonParseStats &stats() const { return m_lastStats; }
+  // Receives the stats of every document, instead of the installed hook.
+  JsonParser &statsHook(JsonStatsHook *hook) {
+    m_statsHook = hook;
+    return *this;
+  }
+#endif
+
+  JsonNode parse(std::string_view, size_t *offset = nullptr);
+  JsonNode parse(std::ifstream &, bool checkEnd = true);
+  JsonNode parse(std::istream &, bool checkEnd = true);
+  // The mapping has to outlive the result when strings are borrowed.
+  JsonNode parse(const JsonMappedFile &, bool checkEnd = true);
+
+  // Like parse(), but invalid input is reported in the result instead of
+  // by an exception. Running out of memory still terminates.
+  JsonParseResult tryParse(std::string_view, size_t *offset = nullptr) noexcept;
+  JsonParseResult tryParse(const JsonMappedFile &,
+                           bool checkEnd = true) noexcept;
+
+  // Builds only the values selected by projection. Skipped values are not
+  // validated beyond matching brackets and quotes. Skipped array elements are
+  // left out, so the indices of the kept ones may change.
+  JsonNode parse(std::string_view, const JsonProjection &projection,
+                 size_t *offset = nullptr);
+  JsonNode parse(std::istream &, const JsonProjection &projection,
+                 bool checkEnd = true);
+  JsonNode parse(const JsonMappedFile &, const JsonProjection &projection,
+                 bool checkEnd = true);
+
+  JsonNode streamParse(std::string_view, size_t *offset = nullptr,
+                       bool *isComplete = nullptr);
+  JsonNode streamParse(std::ifstream &, bool *isComplete = nullptr);
+  JsonNode streamParse(std::istream &, bool *isComplete = nullptr);
+  JsonNode streamParse(const JsonMappedFile &, bool *isComplete = nullptr);
+
+  // Parses a top-level array on up to threadCount threads, 0 meaning one per
+  // hardware thread. The result is the same as parse(input). Inputs that are
+  // not arrays or smaller than ParallelMinSize, and parsers with an arena, are
+  // parsed sequentially.
+  JsonNode parseParallel(std::string_view input, unsigned threadCount = 0);
+
+  static constexpr size_t ParallelMinSize = 256 << 10;
+
+  // Incremental parsing of one document arriving in pieces. feed() returns
+  // true once the value is complete (trailing whitespace may still be fed);
+  // finish() returns the tree and makes the parser ready for the next
+  // document. Only a token split between chunks is kept and parsed again, so
+  // the total work is linear in the input. Strings are never borrowed. If
+  // either throws, the partial document is dropped.
+  bool feed(std::string_view chunk);
+  JsonNode finish();
+
+  // Frees the storage collected by JsonNode::recycle and the interned keys.
+  void releasePool() {
+    m_pool.release();
+    m_keys.clear();
+  }
+
+  template <typename Derived> class JsonInputStreamBase {
+  public:
+    // Streams over a contiguous buffer set this to true and provide cur(),
+    // end() and seek(), which lets the parser scan whole spans at once.
+    static constexpr bool contiguous = false;
+
+    char ch() const {
+      return (static_cast<const Derived *>(this))->ch();
+    } // peek
+    void next() { (static_cast<Derived *>(this))->next(); }
+    char get() { return (static_cast<Derived *>(this))->get(); }
+    bool eoi() const {
+      return (static_cast<const Derived *>(this))->eoi();
+    } // end of input
+  };
+
+  template <typename Derived>
+  JsonNode parse(JsonInputStreamBase<Derived> &, bool checkEnd = true);
+
+  template <typename Derived>
+  JsonParseResult tryParse(JsonInputStreamBase<Derived> &,
+                           bool checkEnd = true) noexcept;
+
+  template <typename Derived>
+  JsonNode streamParse(JsonInputStreamBase<Derived> &,
+                       bool *isComplete = nullptr);
+
+  // Reports the value to handler instead of building a tree, see
+  // JsonSaxHandler. Returns false if a handler method returned false.
+  template <typename Handler>
+  bool saxParse(std::string_view, Handler &, size_t *offset = nullptr);
+  template <typename Handler>
+  bool saxParse(std::ifstream &, Handler &, bool checkEnd = true);
+  template <typename Handler>
+  bool saxParse(std::istream &, Handler &, bool checkEnd = true);
+  template <typename Handler>
+  bool saxParse(const JsonMappedFile &, Handler &, bool checkEnd = true);
+  template <typename Derived, typename Handler>
+  bool saxParse(JsonInputStreamBase<Derived> &, Handler &,
+                bool checkEnd = true);
+
+  // Decodes one MessagePack value, as written by
+  // JsonNode::Serializer::dumpMsgPack. Map keys must be strings, binary values
+  // are read as strings and extension types are rejected; string contents are
+  // not validated. Containers are reserved from the counts in the input. With
+  // offset, decoding starts there and it is set past the value; otherwise
+  // the value has to end the input.
+  JsonNode parseMsgPack(std::string_view, size_t *offset = nullptr);
+  JsonNode parseMsgPack(const JsonMappedFile &);
+  JsonNode parseMsgPack(std::istream &);
+  template <typename Handler>
+  bool saxParseMsgPack(std::string_view, Handler &, size_t *offset = nullptr);
+  template <typename Derived, typename Handler>
+  bool saxParseMsgPack(JsonInputStreamBase<Derived> &, Handler &);
+
+  // Fills value straight from the input, without building a tree, see
+  // JSON_PARSER_FIELDS. Throws like get<T>() on a type mismatch, value is then
+  // partially assigned. Unknown struct members are skipped.
+  template <typename T>
+  void parseInto(std::string_view, T &value, size_t *offset = nullptr);
+  template <typename T>
+  void parseInto(std::ifstream &, T &value, bool checkEnd = true);
+  template <typename T>
+  void parseInto(std::istream &, T &value, bool checkEnd = true);
+  template <typename T>
+  void parseInto(const JsonMappedFile &, T &value, bool checkEnd = true);
+
+private:
+  template <size_t BufSize>
+  class JsonFileInputStream
+      : public JsonInputStreamBase<JsonFileInputStream<BufSize>> {
+  public:
+    JsonFileInputStream(std::istream &is, JsonParseStats *stats = nullptr)
+        : m_is(is), m_bufPos(BufSize), m_endPos(static_cast<size_t>(-1))
+#ifdef JSON_PARSER_STATS
+          ,
+          m_stats(stats)
+#endif
+    {
+      (void)stats;
+      fillBuf();
+    }
+
+    ~JsonFileInputStream() {
+      if (m_is.eof()) {
+        if (!eoi()) {
+          m_is.clear();
+          m_is.seekg(m_bufPos - m_endPos, std::ios_base::end);
+        }
+      } else if (m_bufPos != BufSize) {
+        m_is.seekg(m_bufPos - BufSize, std::ios_base::cur);
+      }
+    }
+
+    char ch() const { return m_buf[m_bufPos]; }
+    void next() {
+      ++m_bufPos;
+      if (m_bufPos == BufSize)
+        fillBuf();
+    }
+    char get() {
+      char c = m_buf[m_bufPos++];
+      if (m_bufPos == BufSize)
+        fillBuf();
+      return c;
+    }
+    bool eoi() const { return m_bufPos == m_endPos; }
+
+#ifdef JSON_PARSER_STATS
+    // Bytes consumed since the stream was created.
+    size_t pos() const { return m_base + m_bufPos; }
+#endif
+
+  private:
+    // Where refills are counted, null without JSON_PARSER_STATS.
+    JsonParseStats *statsSink() {
+#ifdef JSON_PARSER_STATS
+      return m_stats;
+#else
+      return nullptr;
+#endif
+    }
+
+    void fillBuf() {
+      JSON_PARSER_COUNT(statsSink(), refills, 1);
+#ifdef JSON_PARSER_STATS
+      detail::JsonStatsTimer timer(m_stats ? &m_stats->ioTime : nullptr);
+#endif
+      m_is.read(m_buf, BufSize);
+      m_bufPos = 0;
+      if (!m_is)
+        m_endPos = m_is.gcount();
+#ifdef JSON_PARSER_STATS
+      m_base += m_filled;
+      m_filled = m_is.gcount();
+#endif
+    }
+
+  private:
+    std::istream &m_is;
+    char m_buf[BufSize];
+    size_t m_bufPos;
+    size_t m_endPos;
+#ifdef JSON_PARSER_STATS
+    JsonParseStats *m_stats;
+    // Bytes in the buffers before the current one, and in the current one.
+    size_t m_base = 0;
+    size_t m_filled = 0;
+#endif
+  };
+
+  // Double-buffered file input: a reader thread fills one block while the
+  // parser consumes the other. Blocks are read synchronously if the thread
+  // cannot be started.
+  class JsonReadAheadInputStream
+      : public JsonInputStreamBase<JsonReadAheadInputStream> {
+  public:
+    explicit JsonReadAheadInputStream(std::istream &is,
+                                      JsonParseStats *stats = nullptr)
+        : m_is(is), m_start(is.tellg())
+#ifdef JSON_PARSER_STATS
+          ,
+          m_stats(stats)
+#endif
+    {
+      (void)stats;
+      for (auto &block : m_blocks)
+        block.reset(new char[ReadAheadBlockSize]);
+      JSON_PARSER_COUNT(statsSink(), refills, 1);
+#ifdef JSON_PARSER_STATS
+      {
+        detail::JsonStatsTimer timer(m_stats ? &m_stats->ioTime : nullptr);
+        m_size = read(m_blocks[0].get());
+      }
+#else
+      m_size = read(m_blocks[0].get());
+#endif
+      m_data = m_blocks[0].get();
+      if (m_size != ReadAheadBlockSize)
+        return;
+      m_requested = true;
+      try {
+        m_thread = std::thread([this] { run(); });
+      } catch (const std::system_error &) {
+        m_requested = false;
+      }
+    }
+
+    ~JsonReadAheadInputStream() {
+      if (m_thread.joinable()) {
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_stop = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+      }
+      if (eoi() && m_last)
+        return;
+      // Give back what was read past the value.
+      m_is.clear();
+      if (m_start != std::streampos(-1))
+        m_is.seekg(m_start + std::streamoff(m_consumed + m_pos));
+    }
+
+    char ch() const { return m_data[m_pos]; }
+    void next() {
+      if (++m_pos == m_size)
+        nextBlock();
+    }
+    char get() {
+      char c = m_data[m_pos];
+      next();
+      return c;
+    }
+    bool eoi() const { return m_pos == m_size; }
+
+#ifdef JSON_PARSER_STATS
+    size_t pos() const { return m_consumed + m_pos; }
+#endif
+
+  private:
+    // Where refills are counted, null without JSON_PARSER_STATS.
+    JsonParseStats *statsSink() {
+#ifdef JSON_PARSER_STATS
+      return m_stats;
+#else
+      return nullptr;
+#endif
+    }
+
+    size_t read(char *buf) {
+      try {
+        m_is.read(buf, ReadAheadBlockSize);
+      } catch (...) {
+      }
+      const size_t n = static_cast<size_t>(m_is.gcount());
+      m_last = n != ReadAheadBlockSize;
+      return n;
+    }
+
+    void run() {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      for (;;) {
+        m_wake.wait(lock, [this] { return m_requested || m_stop; });
+        if (m_stop)
+          return;
+        char *buf = m_blocks[1 - m_current].get();
+        lock.unlock();
+        const size_t n = read(buf);
+        lock.lock();
+        m_readSize = n;
+        m_requested = false;
+        m_ready.notify_one();
+      }
+    }
+
+    void nextBlock() {
+      m_consumed += m_size;
+      m_pos = m_size = 0;
+      if (!m_thread.joinable() && m_last)
+        return;
+      JSON_PARSER_COUNT(statsSink(), refills, 1);
+#ifdef JSON_PARSER_STATS
+      detail::JsonStatsTimer timer(m_stats ? &m_stats->ioTime : nullptr);
+#endif
+      if (!m_thread.joinable()) {
+        m_current = 1 - m_current;
+        m_data = m_blocks[m_current].get();
+        m_size = read(m_blocks[m_current].get());
+        return;
+      }
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_ready.wait(lock, [this] { return !m_requested; });
+      m_current = 1 - m_current;
+      m_data = m_blocks[m_current].get();
+      m_size = m_readSize;
+      m_readSize = 0;
+      if (m_last)
+        return;
+      m_requested = true;
+      m_wake.notify_one();
+    }
+
+  private:
+    std::istream &m_is;
+    std::streampos m_start;
+    std::unique_ptr<char[]> m_blocks[2];
+    const char *m_data;
+    size_t m_pos = 0;
+    size_t m_size = 0;
+    // Bytes in the blocks before the current one.
+    size_t m_consumed = 0;
+    int m_current = 0;
+#ifdef JSON_PARSER_STATS
+    JsonParseStats *m_stats;
+#endif
+
+    // Shared with the reader thread. m_last is written by read(), on the
+    // reader thread only while a block is requested.
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_ready;
+    bool m_requested = false;
+    bool m_stop = false;
+    bool m_last = false;
+    size_t m_readSize = 0;
+  };
+
+  class JsonStringViewInputStream
+      : public JsonInputStreamBase<JsonStringViewInputStream> {
+  public:
+    static constexpr bool contiguous = true;
+
+    JsonStringViewInputStream(const std::string_view &input, size_t offset)
+        : m_begin(input.data()), m_end(input.data() + input.size()),
+          m_pos(m_begin + offset) {}
+    char ch() const { return *m_pos; }
+    void next() { ++m_pos; }
+    char get() { return *m_pos++; }
+    bool eoi() const { return m_pos == m_end; }
+
+    const char *cur() const { return m_pos; }
+    const char *end() const { return m_end; }
+    void seek(const char *p) { m_pos = p; }
+
+    size_t pos() const { return m_pos - m_begin; }
+
+  private:
+    const char *m_begin;
+    const char *m_end;
+    const char *m_pos;
+  };
+
+private:
+  // Storage handed back by JsonNode::recycle. Containers are kept empty with
+  // their capacity, strings with their characters.
+  struct NodePool {
+    static constexpr size_t MaxSize = 1 << 16; // of each kind
+
+    NodePool() = default;
+    NodePool(const NodePool &) = delete;
+    NodePool &operator=(const NodePool &) = delete;
+    ~NodePool() { release(); }
+
+    void release() {
+      for (auto *p : arrs)
+        JsonNode::releaseShared(p);
+      for (auto *p : objs)
+        JsonNode::releaseShared(p);
+      for (auto *p : strs)
+        delete p;
+      arrs = {};
+      objs = {};
+      strs = {};
+      stack = {};
+      recycled = {};
+      used = false;
+    }
+
+    std::vector<JsonArr_t *> arrs;
+    std::vector<JsonObj_t *> objs;
+    std::vector<JsonStr_t *> strs;
+    // Reused by DomBuilder and recycle().
+    std::vector<JsonNode *> stack;
+    std::vector<JsonNode> recycled;
+    // Set once trees are recycled; parsed containers then keep their
+    // capacity for the next time.
+    bool used = false;
+  };
+
+  // Builds a JsonNode tree from parse events.
+  class DomBuilder : public JsonSaxHandler {
+  public:
+    DomBuilder(JsonNode &root, JsonArena *arena, bool borrowStrings,
+               NodePool *pool = nullptr, detail::JsonKeyTable *keys = nullptr,
+               JsonParseStats *stats = nullptr)
+        : m_root(&root), m_arena(arena), m_borrowStrings(borrowStrings),
+          m_pool(arena == nullptr ? pool : nullptr), m_stackPool(pool),
+          m_keys(keys)
+#ifdef JSON_PARSER_STATS
+          ,
+          m_stats(stats)
+#endif
+    {
+      (void)stats;
+      if (pool != nullptr)
+        m_stack.swap(pool->stack);
+    }
+    DomBuilder(const DomBuilder &) = delete;
+    DomBuilder &operator=(const DomBuilder &) = delete;
+    ~DomBuilder() {
+      if (m_stackPool != nullptr) {
+        m_stack.clear();
+        m_stack.swap(m_stackPool->stack);
+      }
+    }
+
+    bool onNull() {
+      *slot() = JsonNull;
+      return true;
+    }
+    bool onBool(bool b) {
+      *slot() = b;
+      return true;
+    }
+    bool onInt64(int64_t i) {
+      *slot() = i;
+      return true;
+    }
+    bool onUint64(uint64_t u) {
+      *slot() = u;
+      return true;
+    }
+    bool onDouble(double d) {
+      *slot() = d;
+      return true;
+    }
+
+    bool onString(std::string_view str, bool inInput) {
+      JsonNode *node = slot();
+      if (m_borrowStrings && inInput &&
+          str.size() > JsonNode::InlineStrCapacity) {
+        node->resetView(str.data(), static_cast<uint32_t>(str.size()));
+        if (m_arena == nullptr && !m_stack.empty())
+          m_stack.back()->header().borrows = true;
+      } else if (m_pool != nullptr && m_pool->used &&
+                 str.size() > JsonNode::InlineStrCapacity) {
+        // Once trees are recycled, long strings are built as JsonStr_t,
+        // which recycle() can pool, rather than as exact-size buffers.
+        if (m_pool->strs.empty()) {
+          node->adoptHolder(new JsonStr_t(str));
+        } else {
+          node->adoptHolder(takePooledStr(str.size()));
+          node->val_.s->assign(str);
+        }
+        countHeap(2, node->val_.s->capacity() + 1);
+      } else {
+        node->resetStr(m_arena, str);
+        if (m_arena == nullptr && str.size() > JsonNode::InlineStrCapacity)
+          countHeap(1, str.size() + 1);
+      }
+      return true;
+    }
+
+    bool onStartArray() {
+      JsonNode *node = slot();
+      if (m_pool != nullptr && !m_pool->arrs.empty()) {
+        node->adoptHolder(m_pool->arrs.back());
+        m_pool->arrs.pop_back();
+      } else
+        node->resetHolder<JsonArr_t>(m_arena);
+      if (m_arena == nullptr)
+        countHeap(1, 0);
+      m_stack.push_back(node);
+      return true;
+    }
+    bool onStartArray(size_t size) {
+      onStartArray();
+      m_stack.back()->val_.a->reserve(size);
+      return true;
+    }
+    bool onEndArray() {
+      if (m_arena == nullptr && (m_pool == nullptr || !m_pool->used))
+        m_stack.back()->val_.a->shrink_to_fit();
+      if (m_arena == nullptr) {
+        const size_t capacity = m_stack.back()->val_.a->capacity();
+        countHeap(capacity != 0, capacity * sizeof(JsonNode));
+      }
+      endContainer();
+      return true;
+    }
+
+    bool onStartObject() {
+      JsonNode *node = slot();
+      if (m_pool != nullptr && !m_pool->objs.empty()) {
+        node->adoptHolder(m_pool->objs.back());
+        m_pool->objs.pop_back();
+      } else
+        node->resetHolder<JsonObj_t>(m_arena);
+      if (m_arena == nullptr)
+        countHeap(1, 0);
+      m_stack.push_back(node);
+      return true;
+    }
+    bool onStartObject(size_t size) {
+      onStartObject();
+      m_stack.back()->val_.o->reserve(size);
+      return true;
+    }
+    bool onKey(std::string_view key, bool inInput) {
+      auto obj = m_stack.back()->val_.o;
+      if (m_borrowStrings && inInput && key.size() > JsonKey::InlineCapacity) {
+        m_member = &obj->append(JsonKey::borrow(key));
+        if (m_arena == nullptr)
+          m_stack.back()->header().borrows = true;
+        return true;
+      }
+      // Keys are not allocated from the arena.
+      if (m_arena != nullptr && key.size() > JsonKey::InlineCapacity)
+        m_heapAllocated = true;
+      m_member = &(m_keys != nullptr ? obj->append(m_keys->intern(key))
+                                     : obj->append(key));
+      if (m_keys == nullptr && key.size() > JsonKey::InlineCapacity)
+        countHeap(1, key.size() + 1);
+      return true;
+    }
+    bool onKey(std::string_view key) { return onKey(key, false); }
+    bool onEndObject() {
+      m_stack.back()->val_.o->finalize();
+      if (m_arena == nullptr && (m_pool == nullptr || !m_pool->used))
+        m_stack.back()->val_.o->shrink_to_fit();
+      if (m_arena == nullptr) {
+        const size_t size = m_stack.back()->val_.o->size();
+        countHeap(size != 0, size * sizeof(JsonObj_t::value_type));
+      }
+      endContainer();
+      return true;
+    }
+
+    // Sorts and deduplicates objects left open by a parse error.
+    void finalizeOpenObjects() {
+      for (auto *node : m_stack)
+        if (node->isObj())
+          node->val_.o->finalize();
+      m_stack.clear();
+    }
+
+    // Set when a tree built in an arena also holds heap memory.
+    bool heapAllocated() const { return m_heapAllocated; }
+
+  private:
+    // The node receiving the next value.
+    JsonNode *slot() {
+      if (m_stack.empty())
+        return m_root;
+      JsonNode *top = m_stack.back();
+      if (top->ty_ == JsonNode::ArrType_)
+        return &top->val_.a->emplace_back();
+      return m_member;
+    }
+
+    // Takes a pooled string, preferring the smallest of the last few that
+    // can hold size characters without growing.
+    JsonStr_t *takePooledStr(size_t size) {
+      auto &strs = m_pool->strs;
+      const size_t last = strs.size() - 1;
+      size_t best = last;
+      for (size_t i = last, n = 0; n < 8 && i != size_t(-1); --i, ++n) {
+        const size_t capacity = strs[i]->capacity();
+        if (capacity >= size && (strs[best]->capacity() < size ||
+                                 capacity < strs[best]->capacity()))
+          best = i;
+      }
+      std::swap(strs[best], strs[last]);
+      JsonStr_t *p = strs.back();
+      strs.pop_back();
+      return p;
+    }
+
+    // Where heap blocks are counted, null without JSON_PARSER_STATS.
+    JsonParseStats *statsSink() {
+#ifdef JSON_PARSER_STATS
+      return m_stats;
+#else
+      return nullptr;
+#endif
+    }
+
+    // Heap blocks of the tree, for statsSink(). Elements of containers are
+    // counted once the container is complete.
+    void countHeap(size_t blocks, size_t bytes) {
+      JSON_PARSER_COUNT(statsSink(), heapBlocks, blocks);
+      JSON_PARSER_COUNT(statsSink(), heapBytes, bytes);
+      (void)blocks;
+      (void)bytes;
+    }
+
+    // Containers holding borrowed strings mark their parent in turn.
+    void endContainer() {
+      JsonNode *node = m_stack.back();
+      m_stack.pop_back();
+      if (m_arena == nullptr && !m_stack.empty() && node->header().borrows)
+        m_stack.back()->header().borrows = true;
+    }
+
+  private:
+    JsonNode *m_root;
+    JsonArena *m_arena;
+    bool m_borrowStrings;
+    bool m_heapAllocated = false;
+    // Source of heap containers and strings, null with an arena.
+    NodePool *m_pool;
+    // Lends its capacity to m_stack.
+    NodePool *m_stackPool;
+    // Interns object keys when set.
+    detail::JsonKeyTable *m_keys;
+#ifdef JSON_PARSER_STATS
+    JsonParseStats *m_stats;
+#endif
+    std::vector<JsonNode *> m_stack;
+    JsonNode *m_member = nullptr;
+  };
+
+  // Applies parse events to a bound value, see detail::JsonBinding. Values
+  // assigned from a JsonNode are built with a DomBuilder first.
+  class BindBuilder : public JsonSaxHandler {
+  public:
+    explicit BindBuilder(detail::JsonBindTarget root) : m_root(root) {}
+
+    bool onNull() {
+      if (auto t = target(false))
+        t.ops->onNull(t.p);
+      else
+        m_dom->onNull();
+      return captured();
+    }
+    bool onBool(bool b) {
+      if (auto t = target())
+        t.ops->onBool(t.p, b);
+      else
+        m_dom->onBool(b);
+      return captured();
+    }
+    bool onInt64(int64_t i) {
+      if (Frame *f = numberArray()) {
+        f->value.ops->appendInt64(f->value.p, f->index++, i);
+        return true;
+      }
+      if (auto t = target())
+        t.ops->onInt64(t.p, i);
+      else
+        m_dom->onInt64(i);
+      return captured();
+    }
+    bool onUint64(uint64_t u) {
+      if (Frame *f = numberArray()) {
+        f->value.ops->appendUint64(f->value.p, f->index++, u);
+        return true;
+      }
+      if (auto t = target())
+        t.ops->onUint64(t.p, u);
+      else
+        m_dom->onUint64(u);
+      return captured();
+    }
+    bool onDouble(double d) {
+      if (Frame *f = numberArray()) {
+        f->value.ops->appendDouble(f->value.p, f->index++, d);
+        return true;
+      }
+      if (auto t = target())
+        t.ops->onDouble(t.p, d);
+      else
+        m_dom->onDouble(d);
+      return captured();
+    }
+    bool onString(std::string_view str) {
+      if (auto t = target())
+        t.ops->onString(t.p, str);
+      else
+        m_dom->onString(str, false);
+      return captured();
+    }
+
+    bool onStartArray() {
+      if (auto t = target()) {
+        t.ops->onStartArray(t.p);
+        m_stack.push_back({t, {}, 0, true});
+      } else {
+        m_dom->onStartArray();
+        ++m_domDepth;
+      }
+      return true;
+    }
+    bool onEndArray() {
+      if (!m_dom) {
+        m_stack.pop_back();
+        return true;
+      }
+      m_dom->onEndArray();
+      --m_domDepth;
+      return captured();
+    }
+
+    bool onStartObject() {
+      if (auto t = target()) {
+        t.ops->onStartObject(t.p);
+        m_stack.push_back({t, {}, 0, false});
+      } else {
+        m_dom->onStartObject();
+        ++m_domDepth;
+      }
+      return true;
+    }
+    bool onKey(std::string_view key) {
+      if (m_dom)
+        return m_dom->onKey(key);
+      Frame &f = m_stack.back();
+      f.member = f.value.ops->member(f.value.p, key);
+      return true;
+    }
+    bool onEndObject() {
+      if (!m_dom) {
+        m_stack.pop_back();
+        return true;
+      }
+      m_dom->onEndObject();
+      --m_domDepth;
+      return captured();
+    }
+
+  private:
+    struct Frame {
+      detail::JsonBindTarget value;
+      detail::JsonBindTarget member;
+      size_t index;
+      bool array;
+    };
+
+    // The innermost array when its elements are numbers stored without
+    // resolving a target for each of them.
+    Frame *numberArray() {
+      if (m_dom || m_stack.empty())
+        return nullptr;
+      Frame &f = m_stack.back();
+      return f.array && f.value.ops->appendDouble != nullptr ? &f : nullptr;
+    }
+
+    // The value receiving the next event, or an empty target when the event
+    // goes to m_dom. Optional values are engaged unless the event is null.
+    detail::JsonBindTarget target(bool resolve = true) {
+      if (m_dom)
+        return {};
+      detail::JsonBindTarget t = m_root;
+      if (!m_stack.empty()) {
+        Frame &f = m_stack.back();
+        t = f.array ? f.value.ops->element(f.value.p, f.index++) : f.member;
+      }
+      while (resolve && t.ops->resolve != nullptr)
+        t = t.ops->resolve(t.p);
+      if (t.ops->assignNode == nullptr)
+        return t;
+      m_domTarget = t;
+      m_dom.emplace(m_domRoot, nullptr, false);
+      return {};
+    }
+
+    // Assigns the captured value once it is complete.
+    bool captured() {
+      if (m_dom && m_domDepth == 0) {
+        m_dom.reset();
+        m_domTarget.ops->assignNode(m_domTarget.p, std::move(m_domRoot));
+        m_domRoot = JsonNode{};
+      }
+      return true;
+    }
+
+    detail::JsonBindTarget m_root;
+    std::vector<Frame> m_stack;
+    JsonNode m_domRoot;
+    std::optional<DomBuilder> m_dom;
+    detail::JsonBindTarget m_domTarget;
+    size_t m_domDepth = 0;
+  };
+
+  enum class ParseState : uint8_t {
+    Value,
+    ArrayFirst,  // after '['
+    ObjectFirst, // after '{'
+    Key,
+    Colon,
+    AfterValue,
+  };
+  // Failed: the input is invalid, see fail().
+  enum class ParseStatus : uint8_t { Complete, Stopped, NeedMore, Failed };
+  // Kind of the token cut off at the end of a fed chunk.
+  enum class PendingToken : uint8_t { Other, String, Number };
+
+  template <typename Derived, typename Handler>
+  bool parseValue(JsonInputStreamBase<Derived> &, Handler &);
+  // Parses a value and, with checkEnd, the whitespace after it. Returns false
+  // if the handler stopped or the input is invalid, which sets m_failed.
+  template <typename Derived, typename Handler>
+  bool parseDocument(JsonInputStreamBase<Derived> &, Handler &, bool checkEnd);
+
+  // Records a syntax error. The parsing functions return false after it, up
+  // to the caller that reports m_error.
+  JSON_PARSER_COLD bool fail(detail::JsonErrorCode code) {
+    m_error = code;
+    m_failed = true;
+    return false;
+  }
+
+  template <typename Derived, typename Handler>
+  bool parseMsgPackDocument(JsonInputStreamBase<Derived> &, Handler &,
+                            bool checkEnd);
+  template <typename Derived, typename Handler>
+  bool parseMsgPackValue(JsonInputStreamBase<Derived> &, Handler &);
+  template <typename Derived>
+  static uint64_t readMsgPackUint(JsonInputStreamBase<Derived> &, int bytes);
+  template <typename Derived>
+  static std::string_view readMsgPackBytes(JsonInputStreamBase<Derived> &,
+                                           size_t n, std::string &buf);
+
+  template <bool Push, typename Derived, typename Handler>
+  ParseStatus parseTokens(JsonInputStreamBase<Derived> &, Handler &);
+
+  bool pendingTokenMayEnd();
+  void resetPush();
+
+  // Calls f with the input stream for is, see readAhead().
+  template <typename F> decltype(auto) readFile(std::ifstream &is, F &&f) {
+    if (m_readAhead) {
+      JsonReadAheadInputStream s(is, statsSink());
+      return f(s);
+    }
+    JsonFileInputStream<JSON_PARSER_IO_BUFFER_SIZE> s(is, statsSink());
+    return f(s);
+  }
+
+  template <typename Derived> void skipSpace(JsonInputStreamBase<Derived> &);
+  template <typename Derived> bool skipValue(JsonInputStreamBase<Derived> &);
+
+  template <typename Derived, typename Handler>
+  bool parseLiteral(JsonInputStreamBase<Derived> &, Handler &);
+
+  // Sets str to the string after the opening quote, either in the input
+  // (inInput) or in m_strBuf.
+  template <typename Derived>
+  bool parseStringToken(JsonInputStreamBase<Derived> &, std::string_view &str,
+                        bool &inInput);
+
+  template <typename Derived>
+  bool parseString(JsonInputStreamBase<Derived> &, JsonStr_t &);
+
+  template <typename Derived>
+  bool parseEscape(JsonInputStreamBase<Derived> &, JsonStr_t &);
+
+  template <typename Derived>
+  bool parseUtf8(JsonInputStreamBase<Derived> &, JsonStr_t &);
+
+  template <typename Derived>
+  bool parseHex4(JsonInputStreamBase<Derived> &, uint32_t &u);
+
+  void encodeUtf8(JsonStr_t &, uint32_t);
+
+  template <typename Derived, typename Handler>
+  bool parseKeyWithColon(JsonInputStreamBase<Derived> &, Handler &);
+
+  template <typename Derived, typename Handler>
+  bool parseNumber(JsonInputStreamBase<Derived> &, Handler &);
+
+  void parseElements(std::string_view, JsonArr_t &);
+
+private:
+  // Open containers of the value being parsed, true for objects.
+  std::vector<bool> m_scopeStack;
+  ParseState m_state = ParseState::Value;
+  // Set by fail(), reset when a parse starts.
+  bool m_failed = false;
+  detail::JsonErrorCode m_error = detail::JsonErrorCode::InvalidJson;
+
+  // State of feed(): the tree so far and the unconsumed input, which starts
+  // with the incomplete token. m_scanPos and m_scanEscape track the search
+  // for the end of a pending string.
+  std::optional<DomBuilder> m_pushBuilder;
+  JsonNode m_pushRoot;
+  std::string m_pushBuf;
+  bool m_pushDone = false;
+  PendingToken m_pendingToken = PendingToken::Other;
+  size_t m_scanPos = 0;
+  bool m_scanEscape = false;
+
+  JsonArena *m_arena = nullptr;
+  bool m_borrowStrings = false;
+  bool m_internKeys = false;
+  bool m_readAhead = false;
+  detail::JsonKeyTable m_keys;
+  detail::JsonKeyTable *keyTable() { return m_internKeys ? &m_keys : nullptr; }
+  // Scratch buffer for strings that can not be referenced in the input.
+  JsonStr_t m_strBuf;
+  // Text of the current number for non-contiguous input.
+  std::string m_numBuf;
+  // Set when a tree parsed into the arena also holds heap memory (object keys
+  // longer than JsonKey::InlineCapacity).
+  bool m_heapAllocated = false;
+  NodePool m_pool;
+
+  // Where streams and builders count, null without JSON_PARSER_STATS.
+  JsonParseStats *statsSink() {
+#ifdef JSON_PARSER_STATS
+    return &m_stats;
+#else
+    return nullptr;
+#endif
+  }
+
+#ifdef JSON_PARSER_STATS
+  // Stats gathered since the last document was reported, which includes
+  // blocks read ahead for the next one.
+  JsonParseStats m_stats;
+  JsonParseStats m_lastStats;
+  JsonStatsHook *m_statsHook = nullptr;
+  // Cleared for the workers of parseParallel(), whose stats are summed.
+  bool m_reportStats = true;
+
+  void reportStats(bool failed) {
+    if (!m_reportStats)
+      return;
+    m_stats.failed = failed;
+    m_lastStats = m_stats;
+    m_stats = {};
+    if (JsonStatsHook *hook =
+            m_statsHook ? m_statsHook : JsonStatsHook::installed())
+      hook->onParse(m_lastStats);
+  }
+
+  template <typename Derived>
+  static size_t inputPos(const JsonInputStreamBase<Derived> &is) {
+    if constexpr (detail::has_input_pos<Derived>::value)
+      return static_cast<const Derived &>(is).pos();
+    else
+      return 0;
+  }
+#endif
+
+  friend class JsonNode;
+  friend class JsonDocument;
+  friend class JsonLazyValue;
+};
+
+// Reads a generic std::istream through its stream buffer, which consumes
+// exactly the characters parsed without a sentry per character.
+template <>
+class JsonParser::JsonFileInputStream<1>
+    : public JsonInputStreamBase<JsonFileInputStream<1>> {
+  using Traits = std::istream::traits_type;
+
+public:
+  JsonFileInputStream(std::istream &is)
+      : m_is(is), m_sb(is.good() ? is.rdbuf() : nullptr) {
+    if (m_sb != nullptr && is.tie() != nullptr)
+      is.tie()->flush();
+  }
+  ~JsonFileInputStream() {
+    if (eoi())
+      m_is.setstate(std::ios_base::eofbit);
+  }
+  char ch() const {
+    return m_sb != nullptr ? Traits::to_char_type(m_sb->sgetc()) : '\0';
+  }
+  void next() { m_sb->sbumpc(); }
+  char get() { return Traits::to_char_type(m_sb->sbumpc()); }
+  bool eoi() const {
+    return m_sb == nullptr || Traits::eq_int_type(m_sb->sgetc(), Traits::eof());
+  }
+
+private:
+  std::istream &m_is;
+  std::streambuf *m_sb;
+};
+
+template <typename Derived, typename Handler>
+inline bool JsonParser::parseValue(JsonInputStreamBase<Derived> &is,
+                                   Handler &handler) {
+  m_state = ParseState::Value;
+  m_scopeStack.clear();
+  m_failed = false;
+#ifdef JSON_PARSER_STATS
+  const size_t start = inputPos(is);
+  bool ok;
+  {
+    detail::JsonStatsTimer timer(&m_stats.parseTime);
+    ok = parseTokens<false>(is, handler) == ParseStatus::Complete;
+  }
+  m_stats.bytes += inputPos(is) - start;
+  return ok;
+#else
+  return parseTokens<false>(is, handler) == ParseStatus::Complete;
+#endif
+}
+
+template <typename Derived, typename Handler>
+inline bool JsonParser::parseDocument(JsonInputStreamBase<Derived> &is,
+                                      Handler &handler, bool checkEnd) {
+  bool ok = parseValue(is, handler);
+  if (ok) {
+    skipSpace(is);
+    if (checkEnd && !is.eoi())
+      ok = fail(detail::JsonErrorCode::InvalidJson);
+  }
+#ifdef JSON_PARSER_STATS
+  reportStats(m_failed);
+#endif
+  return ok;
+}
+
+template <bool Push, typename Derived, typename Handler>
+inline JsonParser::ParseStatus
+JsonParser::parseTokens(JsonInputStreamBase<Derived> &is, Handler &handler) {
+  // In push mode a token cut off by the end of the input is rewound and
+  // reported as NeedMore, to be parsed again once more input arrived.
+  const char *tokenStart = nullptr;
+  auto token = [&](PendingToken kind, auto &&parseToken) {
+    if constexpr (Push) {
+      static_assert(Derived::contiguous);
+      auto &s = static_cast<Derived &>(is);
+      tokenStart = s.cur();
+      // A number is only complete once a character after it is known.
+      if (kind == PendingToken::Number &&
+          detail::skipNumberSpan(tokenStart, s.end()) == s.end()) {
+        m_pendingToken = kind;
+        return std::optional<bool>();
+      }
+      bool ok = parseToken();
+      if (ok || !m_failed || s.cur() != s.end())
+        return std::optional<bool>(ok);
+      m_failed = false;
+      s.seek(tokenStart);
+      m_pendingToken = kind;
+      return std::optional<bool>();
+    } else {
+      (void)kind;
+      return std::optional<bool>(parseToken());
+    }
+  };
+  auto scalar = [&]() {
+    switch (is.ch()) {
+    case 'n':
+    case 't':
+    case 'f':
+      return token(PendingToken::Other,
+                   [&]() { return parseLiteral(is, handler); });
+    case '"':
+      return token(PendingToken::String, [&]() {
+        is.next();
+        std::string_view str;
+        bool inInput;
+        if (!parseStringToken(is, str, inInput))
+          return false;
+        JSON_PARSER_COUNT(statsSink(), strings, 1);
+        return detail::callOnString(handler, str, inInput);
+      });
+    default:
+      if (!detail::isDigit(is.ch()) && is.ch() != '-')
+        return std::optional<bool>(fail(detail::JsonErrorCode::InvalidJson));
+      return token(PendingToken::Number,
+                   [&]() { return parseNumber(is, handler); });
+    }
+  };
+  auto key = [&]() {
+    return token(PendingToken::String, [&]() {
+      is.next();
+      std::string_view str;
+      bool inInput;
+      if (!parseStringToken(is, str, inInput))
+        return false;
+      JSON_PARSER_COUNT(statsSink(), keys, 1);
+      return detail::callOnKey(handler, str, inInput);
+    });
+  };
+
+  for (;;) {
+    if (m_state == ParseState::AfterValue && m_scopeStack.empty())
+      return ParseStatus::Complete;
+    skipSpace(is);
+    if (is.eoi()) {
+      if constexpr (Push)
+        return ParseStatus::NeedMore;
+      fail(m_state == ParseState::Colon
+               ? detail::JsonErrorCode::InvalidKeyValuePair
+               : detail::JsonErrorCode::UnexpectedEndOfInput);
+      return ParseStatus::Failed;
+    }
+
+    std::optional<bool> ok = true;
+    switch (m_state) {
+    case ParseState::ArrayFirst:
+      if (is.ch() == ']') {
+        is.next();
+        m_scopeStack.pop_back();
+        m_state = ParseState::AfterValue;
+        ok = handler.onEndArray();
+        break;
+      }
+      [[fallthrough]];
+    case ParseState::Value:
+      if constexpr (!Push && detail::has_wants_value<Handler>::value) {
+        if (!handler.wantsValue()) {
+          if ((ok = skipValue(is)))
+            m_state = ParseState::AfterValue;
+          break;
+        }
+      }
+      switch (is.ch()) {
+      case '[':
+        is.next();
+        m_scopeStack.push_back(false);
+        JSON_PARSER_COUNT(statsSink(), arrays, 1);
+        JSON_PARSER_COUNT_MAX(statsSink(), maxDepth, m_scopeStack.size());
+        m_state = ParseState::ArrayFirst;
+        ok = handler.onStartArray();
+        break;
+      case '{':
+        is.next();
+        m_scopeStack.push_back(true);
+        JSON_PARSER_COUNT(statsSink(), objects, 1);
+        JSON_PARSER_COUNT_MAX(statsSink(), maxDepth, m_scopeStack.size());
+        m_state = ParseState::ObjectFirst;
+        ok = handler.onStartObject();
+        break;
+      case ',':
+        ok = fail(detail::JsonErrorCode::InvalidArrayOrObject);
+        break;
+      default:
+        if ((ok = scalar()))
+          m_state = ParseState::AfterValue;
+      }
+      break;
+    case ParseState::ObjectFirst:
+      if (is.ch() == '}') {
+        is.next();
+        m_scopeStack.pop_back();
+        m_state = ParseState::AfterValue;
+        ok = handler.onEndObject();
+        break;
+      }
+      [[fallthrough]];
+    case ParseState::Key:
+      if (is.ch() != '"') {
+        ok = fail(m_state == ParseState::ObjectFirst
+                      ? detail::JsonErrorCode::InvalidKeyValuePair
+                      : detail::JsonErrorCode::UnexpectedEndOfInput);
+        break;
+      }
+      if ((ok = key()))
+        m_state = ParseState::Colon;
+      break;
+    case ParseState::Colon:
+      if (is.get() != ':') {
+        ok = fail(detail::JsonErrorCode::InvalidKeyValuePair);
+        break;
+      }
+      m_state = ParseState::Value;
+      break;
+    case ParseState::AfterValue: {
+      bool inObject = m_scopeStack.back();
+      char c = is.get();
+      if (c == ',') {
+        m_state = inObject ? ParseState::Key : ParseState::Value;
+        break;
+      }
+      if (c != (inObject ? '}' : ']')) {
+        ok = fail(detail::JsonErrorCode::InvalidJson);
+        break;
+      }
+      m_scopeStack.pop_back();
+      ok = inObject ? handler.onEndObject() : handler.onEndArray();
+    } break;
+    }
+
+    if (!ok)
+      return ParseStatus::NeedMore;
+    if (!*ok)
+      return m_failed ? ParseStatus::Failed : ParseStatus::Stopped;
+  }
+}
+
+template <typename Derived, typename Handler>
+inline bool JsonParser::saxParse(JsonInputStreamBase<Derived> &is,
+                                 Handler &handler, bool checkEnd) {
+  bool ret = parseDocument(is, handler, checkEnd);
+  if (m_failed)
+    detail::throwJsonError(m_error);
+  return ret;
+}
+
+template <typename Derived>
+inline uint64_t JsonParser::readMsgPackUint(JsonInputStreamBase<Derived> &is,
+                                            int bytes) {
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; ++i) {
+    if (is.eoi())
+      throw std::runtime_error(
+          getJsonErrorMsg(detail::JsonErrorCode::UnexpectedEndOfInput));
+    v = (v << 8) | static_cast<uint8_t>(is.get());
+  }
+  return v;
+}
+
+// Returns the next n bytes, which are copied to buf unless the input is
+// contiguous.
+template <typename Derived>
+inline std::string_view
+JsonParser::readMsgPackBytes(JsonInputStreamBase<Derived> &is, size_t n,
+                             std::string &buf) {
+  if constexpr (Derived::contiguous) {
+    auto &s = static_cast<Derived &>(is);
+    if (static_cast<size_t>(s.end() - s.cur()) < n)
+      throw std::runtime_error(
+          getJsonErrorMsg(detail::JsonErrorCode::UnexpectedEndOfInput));
+    std::string_view ret(s.cur(), n);
+    s.seek(s.cur() + n);
+    return ret;
+  } else {
+    buf.clear();
+    for (size_t i = 0; i < n; ++i) {
+      if (is.eoi())
+        throw std::runtime_error(
+            getJsonErrorMsg(detail::JsonErrorCode::UnexpectedEndOfInput));
+      buf.push_back(is.get());
+    }
+    return buf;
+  }
+}
+
+template <typename Derived, typename Handler>
+inline bool JsonParser::saxParseMsgPack(JsonInputStreamBase<Derived> &is,
+                                        Handler &handler) {
+  return parseMsgPackDocument(is, handler, false);
+}
+
+template <typename Derived, typename Handler>
+inline bool JsonParser::parseMsgPackDocument(JsonInputStreamBase<Derived> &is,
+                                             Handler &handler, bool checkEnd) {
+#ifdef JSON_PARSER_STATS
+  const size_t start = inputPos(is);
+  std::optional<detail::JsonStatsTimer> timer(&m_stats.parseTime);
+  bool ok;
+  try {
+    ok = parseMsgPackValue(is, handler);
+    if (ok && checkEnd && !is.eoi())
+      detail::throwJsonError(detail::JsonErrorCode::InvalidMsgPack);
+  } catch (...) {
+    timer.reset();
+    reportStats(true);
+    throw;
+  }
+  timer.reset();
+  m_stats.bytes += inputPos(is) - start;
+  reportStats(!ok);
+  return ok;
+#else
+  bool ok = parseMsgPackValue(is, handler);
+  if (ok && checkEnd && !is.eoi())
+    detail::throwJsonError(detail::JsonErrorCode::InvalidMsgPack);
+  return ok;
+#endif
+}
+
+template <typename Derived, typename Handler>
+inline bool JsonParser::parseMsgPackValue(JsonInputStreamBase<Derived> &is,
+                                          Handler &handler) {
+  using detail::JsonErrorCode;
+  auto fail = [](JsonErrorCode code) {
+    throw std::runtime_error(getJsonErrorMsg(code));
+  };
+  // A container and how many values (keys included) it still holds.
+  struct Frame {
+    uint64_t remaining;
+    bool isObj;
+  };
+  std::vector<Frame> stack;
+  std::string buf;
+  constexpr bool inInput = Derived::contiguous;
+
+  for (;;) {
+    bool isKey = false;
+    if (!stack.empty()) {
+      Frame &f = stack.back();
+      if (f.remaining == 0) {
+        if (!(f.isObj ? handler.onEndObject() : handler.onEndArray()))
+          return false;
+        stack.pop_back();
+        if (stack.empty())
+          return true;
+        continue;
+      }
+      isKey = f.isObj && f.remaining % 2 == 0;
+      --f.remaining;
+    }
+
+    if (is.eoi())
+      fail(JsonErrorCode::UnexpectedEndOfInput);
+    const uint8_t b = static_cast<uint8_t>(is.get());
+    if (isKey && !((b >= 0xa0 && b <= 0xbf) || (b >= 0xc4 && b <= 0xc6) ||
+                   (b >= 0xd9 && b <= 0xdb)))
+      fail(JsonErrorCode::InvalidKeyValuePair);
+    bool ok = true;
+    // Strings and containers set their size.
+    int sizeBytes = -1;
+    uint64_t size = 0;
+    enum { None, Str, Arr, Map } kind = None;
+    if (b <= 0x7f) {
+      JSON_PARSER_COUNT(statsSink(), uints, 1);
+      ok = handler.onUint64(b);
+    } else if (b <= 0x8f) {
+      kind = Map;
+      size = b & 0x0f;
+    } else if (b <= 0x9f) {
+      kind = Arr;
+      size = b & 0x0f;
+    } else if (b <= 0xbf) {
+      kind = Str;
+      size = b & 0x1f;
+    } else if (b >= 0xe0) {
+      JSON_PARSER_COUNT(statsSink(), ints, 1);
+      ok = handler.onInt64(static_cast<int8_t>(b));
+    } else {
+      switch (b) {
+      case 0xc0:
+        JSON_PARSER_COUNT(statsSink(), nulls, 1);
+        ok = handler.onNull();
+        break;
+      case 0xc2:
+      case 0xc3:
+        JSON_PARSER_COUNT(statsSink(), bools, 1);
+        ok = handler.onBool(b == 0xc3);
+        break;
+      case 0xc4: // bin 8, 16, 32
+      case 0xc5:
+      case 0xc6:
+        kind = Str;
+        sizeBytes = 1 << (b - 0xc4);
+        break;
+      case 0xca: {
+        const uint32_t bits = static_cast<uint32_t>(readMsgPackUint(is, 4));
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        JSON_PARSER_COUNT(statsSink(), doubles, 1);
+        ok = handler.onDouble(f);
+      } break;
+      case 0xcb: {
+        const uint64_t bits = readMsgPackUint(is, 8);
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        JSON_PARSER_COUNT(statsSink(), doubles, 1);
+        ok = handler.onDouble(d);
+      } break;
+      case 0xcc: // uint 8, 16, 32, 64
+      case 0xcd:
+      case 0xce:
+      case 0xcf:
+        JSON_PARSER_COUNT(statsSink(), uints, 1);
+        ok = handler.onUint64(readMsgPackUint(is, 1 << (b - 0xcc)));
+        break;
+      case 0xd0:
+        JSON_PARSER_COUNT(statsSink(), ints, 1);
+        ok = handler.onInt64(static_cast<int8_t>(readMsgPackUint(is, 1)));
+        break;
+      case 0xd1:
+        JSON_PARSER_COUNT(statsSink(), ints, 1);
+        ok = handler.onInt64(static_cast<int16_t>(readMsgPackUint(is, 2)));
+        break;
+      case 0xd2:
+        JSON_PARSER_COUNT(statsSink(), ints, 1);
+        ok = handler.onInt64(static_cast<int32_t>(readMsgPackUint(is, 4)));
+        break;
+      case 0xd3:
+        JSON_PARSER_COUNT(statsSink(), ints, 1);
+        ok = handler.onInt64(static_cast<int64_t>(readMsgPackUint(is, 8)));
+        break;
+      case 0xd9: // str 8, 16, 32
+      case 0xda:
+      case 0xdb:
+        kind = Str;
+        sizeBytes = 1 << (b - 0xd9);
+        break;
+      case 0xdc: // array 16, 32
+      case 0xdd:
+        kind = Arr;
+        sizeBytes = b == 0xdc ? 2 : 4;
+        break;
+      case 0xde: // map 16, 32
+      case 0xdf:
+        kind = Map;
+        sizeBytes = b == 0xde ? 2 : 4;
+        break;
+      default: // 0xc1 and the extension types
+        fail(JsonErrorCode::InvalidMsgPack);
+      }
+    }
+    if (sizeBytes > 0)
+      size = readMsgPackUint(is, sizeBytes);
+
+    if (kind == Str) {
+      std::string_view str = readMsgPackBytes(is, size, buf);
+      if (isKey)
+        JSON_PARSER_COUNT(statsSink(), keys, 1);
+      else
+        JSON_PARSER_COUNT(statsSink(), strings, 1);
+      ok = isKey ? detail::callOnKey(handler, str, inInput)
+                 : detail::callOnString(handler, str, inInput);
+    } else if (kind != None) {
+      // Reserve no more than the input could hold, each value taking a byte.
+      size_t reserve = static_cast<size_t>(size);
+      if constexpr (Derived::contiguous) {
+        auto &s = static_cast<Derived &>(is);
+        reserve = std::min<size_t>(reserve, s.end() - s.cur());
+      } else {
+        reserve = std::min<size_t>(reserve, JSON_PARSER_IO_BUFFER_SIZE);
+      }
+      ok = detail::callOnStart(handler, kind == Map, reserve);
+      stack.push_back({kind == Map ? size * 2 : size, kind == Map});
+      if (kind == Map)
+        JSON_PARSER_COUNT(statsSink(), objects, 1);
+      else
+        JSON_PARSER_COUNT(statsSink(), arrays, 1);
+      JSON_PARSER_COUNT_MAX(statsSink(), maxDepth, stack.size());
+    }
+    if (!ok)
+      return false;
+    if (stack.empty())
+      return true;
+  }
+}
+
+template <typename Handler>
+inline bool JsonParser::saxParseMsgPack(std::string_view input,
+                                        Handler &handler, size_t *offset) {
+  auto is = JsonStringViewInputStream(input, offset == nullptr ? 0 : *offset);
+  bool ret = parseMsgPackDocument(is, handler, offset == nullptr);
+  if (offset != nullptr)
+    *offset = is.pos();
+  return ret;
+}
+
+inline JsonNode JsonParser::parse(std::string_view input,
+                                  const JsonProjection &projection,
+                                  size_t *offset) {
+  JsonNode ret;
+  DomBuilder builder(ret, m_arena, m_borrowStrings, &m_pool, keyTable(),
+                     statsSink());
+  detail::JsonProjectionFilter<DomBuilder> filter(projection, builder);
+  saxParse(input, filter, offset);
+  m_heapAllocated = builder.heapAllocated();
+  return ret;
+}
+
+inline JsonNode JsonParser::parse(std::istream &is,
+                                  const JsonProjection &projection,
+                                  bool checkEnd) {
+  JsonNode ret;
+  DomBuilder builder(ret, m_arena, false, &m_pool, keyTable(), statsSink());
+  detail::JsonProjectionFilter<DomBuilder> filter(projection, builder);
+  saxParse(is, filter, checkEnd);
+  m_heapAllocated = builder.heapAllocated();
+  return ret;
+}
+
+inline JsonNode JsonParser::parse(const JsonMappedFile &file,
+                                  const JsonProjection &projection,
+                                  bool checkEnd) {
+  JsonNode ret;
+  DomBuilder builder(ret, m_arena, m_borrowStrings, &m_pool, keyTable(),
+                     statsSink());
+  detail::JsonProjectionFilter<DomBuilder> filter(projection, builder);
+  saxParse(file, filter, checkEnd);
+  m_heapAllocated = builder.heapAllocated();
+  return ret;
+}
+
+inline JsonNode JsonParser::parseMsgPack(std::string_view input,
+                                         size_t *offset) {
+  JsonNode ret;
+  DomBuilder builder(ret, m_arena, m_borrowStrings, &m_pool, keyTable(),
+                     statsSink());
+  saxParseMsgPack(input, builder, offset);
+  m_heapAllocated = builder.heapAllocated();
+  return ret;
+}
+
+inline JsonNode JsonParser::parseMsgPack(const JsonMappedFile &file) {
+  return parseMsgPack(file.view());
+}
+
+inline JsonNode JsonParser::parseMsgPack(std::istream &is) {
+  JsonNode ret;
+  DomBuilder builder(ret, m_arena, false, &m_pool, keyTable(), statsSink());
+  auto fileInputStream = JsonFileInputStream<1>(is);
+  saxParseMsgPack(fileInputStream, builder);
+  m_heapAllocated = builder.heapAllocated();
+  return ret;
+}
+
+template <typename Derived>
+inline JsonNode JsonParser::parse(JsonInputStreamBase<Derived> &is,
+                                  bool checkEnd) {
+  JsonNode ret;
+  DomBuilder builder(ret, m_arena, m_borrowStrings, &m_pool, keyTable(),
+                     statsSink());
+  saxParse(is, builder, checkEnd);
+  m_heapAllocated = builder.heapAllocated();
+  return ret;
+}
+
+template <typename Derived>
+inline JsonNode JsonParser::streamParse(JsonInputStreamBase<Derived> &is,
+                                        bool *isComplete) {
+  JsonNode ret;
+  DomBuilder builder(ret, m_arena, m_borrowStrings, &m_pool, keyTable(),
+                     statsSink());
+
+  if (isComplete != nullptr)
+    *isComplete = true;
+  if (!parseValue(is, builder) && m_failed) {
+    if (isComplete != nullptr)
+      *isComplete = false;
+    builder.finalizeOpenObjects();
+  }
+#ifdef JSON_PARSER_STATS
+  reportStats(m_failed);
+#endif
+  m_heapAllocated = builder.heapAllocated();
+
+  return ret;
+}
+
+template <typename Handler>
+inline bool JsonParser::saxParse(std::string_view inputView, Handler &handler,
+                                 size_t *offset) {
+  auto stringViewInputStream =
+      JsonStringViewInputStream(inputView, offset == nullptr ? 0 : *offset);
+  bool ret = saxParse(stringViewInputStream, handler, offset == nullptr);
+  if (offset != nullptr)
+    *offset = stringViewInputStream.pos();
+  return ret;
+}
+
+template <typename Handler>
+inline bool JsonParser::saxParse(const JsonMappedFile &file, Handler &handler,
+                                 bool checkEnd) {
+  auto stringViewInputStream = JsonStringViewInputStream(file.view(), 0);
+  return saxParse(stringViewInputStream, handler, checkEnd);
+}
+
+template <typename Handler>
+inline bool JsonParser::saxParse(std::ifstream &is, Handler &handler,
+                                 bool checkEnd) {
+  return readFile(is, [&](auto &s) { return saxParse(s, handler, checkEnd); });
+}
+
+template <typename Handler>
+inline bool JsonParser::saxParse(std::istream &is, Handler &handler,
+                                 bool checkEnd) {
+  auto fileInputStream = JsonFileInputStream<1>(is);
+  return saxParse(fileInputStream, handler, checkEnd);
+}
+
+template <typename T>
+inline void JsonParser::parseInto(std::string_view inputView, T &value,
+                                  size_t *offset) {
+  BindBuilder builder(detail::JsonBinding<T>::target(value));
+  saxParse(inputView, builder, offset);
+}
+
+template <typename T>
+inline void JsonParser::parseInto(const JsonMappedFile &file, T &value,
+                                  bool checkEnd) {
+  BindBuilder builder(detail::JsonBinding<T>::target(value));
+  saxParse(file, builder, checkEnd);
+}
+
+template <typename T>
+inline void JsonParser::parseInto(std::ifstream &is, T &value,
+                                  bool checkEnd) {
+  BindBuilder builder(detail::JsonBinding<T>::target(value));
+  saxParse(is, builder, checkEnd);
+}
+
+template <typename T>
+inline void JsonParser::parseInto(std::istream &is, T &value, bool checkEnd) {
+  BindBuilder builder(detail::JsonBinding<T>::target(value));
+  saxParse(is, builder, checkEnd);
+}
+
+inline JsonNode JsonParser::parse(std::string_view inputView, size_t *offset) {
+  auto stringViewInputStream =
+      JsonStringViewInputStream(inputView, offset == nullptr ? 0 : *offset);
+  auto ret = parse(stringViewInputStream, offset == nullptr);
+  if (offset != nullptr)
+    *offset = stringViewInputStream.pos();
+  return ret;
+}
+
+inline JsonNode JsonParser::parse(const JsonMappedFile &file, bool checkEnd) {
+  auto stringViewInputStream = JsonStringViewInputStream(file.view(), 0);
+  return parse(stringViewInputStream, checkEnd);
+}
+
+template <typename Derived>
+inline JsonParseResult
+JsonParser::tryParse(JsonInputStreamBase<Derived> &is, bool checkEnd) noexcept {
+  JsonParseResult ret;
+  {
+    DomBuilder builder(ret.value, m_arena, m_borrowStrings, &m_pool,
+                       keyTable(), statsSink());
+    parseDocument(is, builder, checkEnd);
+    m_heapAllocated = builder.heapAllocated();
+  }
+  ret.offset = static_cast<Derived &>(is).pos();
+  if (m_failed) {
+    ret.value = JsonNode{};
+    ret.failed = true;
+    ret.error = m_error;
+  }
+  return ret;
+}
+
+inline JsonParseResult JsonParser::tryParse(std::string_view inputView,
+                                            size_t *offset) noexcept {
+  auto stringViewInputStream =
+      JsonStringViewInputStream(inputView, offset == nullptr ? 0 : *offset);
+  auto ret = tryParse(stringViewInputStream, offset == nullptr);
+  if (offset != nullptr)
+    *offset = ret.offset;
+  return ret;
+}
+
+inline JsonParseResult JsonParser::tryParse(const JsonMappedFile &file,
+                                            bool checkEnd) noexcept {
+  auto stringViewInputStream = JsonStringViewInputStream(file.view(), 0);
+  return tryParse(stringViewInputStream, checkEnd);
+}
 
-  private:
-    std::ostream &m_os;
-  };
+inline JsonNode JsonParser::parse(std::ifstream &is, bool checkEnd) {
+  return readFile(is, [&](auto &s) { return parse(s, checkEnd); });
+}
 
-public:
-  class Serializer {
-    friend class JsonNode;
+inline JsonNode JsonParser::parse(std::istream &is, bool checkEnd) {
+  auto fileInputStream = JsonFileInputStream<1>(is);
+  return parse(fileInputStream, checkEnd);
+}
 
-    Serializer(const JsonNode &node) : m_node(node) {}
+inline JsonNode JsonParser::streamParse(std::string_view inputView,
+                                        size_t *offset, bool *isComplete) {
+  auto stringViewInputStream =
+      JsonStringViewInputStream(inputView, offset == nullptr ? 0 : *offset);
+  auto ret = streamParse(stringViewInputStream, isComplete);
+  if (offset != nullptr)
+    *offset = stringViewInputStream.pos();
+  return ret;
+}
 
-  public:
-    Serializer(const Serializer &) = delete;
-    Serializer &operator=(const Serializer &) = delete;
+inline JsonNode JsonParser::streamParse(const JsonMappedFile &file,
+                                        bool *isComplete) {
+  auto stringViewInputStream = JsonStringViewInputStream(file.view(), 0);
+  return streamParse(stringViewInputStream, isComplete);
+}
 
-    Serializer &precision(int p) {
-      m_precision = p;
-      return *this;
+inline JsonNode JsonParser::streamParse(std::ifstream &is, bool *isComplete) {
+  return readFile(is, [&](auto &s) { return streamParse(s, isComplete); });
+}
+
+inline JsonNode JsonParser::streamParse(std::istream &is, bool *isComplete) {
+  auto fileInputStream = JsonFileInputStream<1>(is);
+  return streamParse(fileInputStream, isComplete);
+}
+
+inline JsonNode JsonParser::parseParallel(std::string_view input,
+                                          unsigned threadCount) {
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  const char *end = input.data() + input.size();
+  const char *open = detail::skipSpaceSpan(input.data(), end);
+  if (threadCount < 2 || m_arena != nullptr ||
+      input.size() < ParallelMinSize || open == end || *open != '[')
+    return parse(input);
+
+  // A few chunks per thread even out differences in parse speed.
+  std::vector<const char *> commas;
+  const char *close = detail::splitJsonArray(
+      open, end, input.size() / (threadCount * 4) + 1, commas);
+  if (close == nullptr || commas.empty() ||
+      detail::skipSpaceSpan(close + 1, end) != end)
+    return parse(input);
+
+  size_t chunkCount = commas.size() + 1;
+  std::vector<JsonArr_t> chunks(chunkCount);
+  std::atomic<size_t> nextChunk{0};
+  std::atomic<bool> failed{false};
+#ifdef JSON_PARSER_STATS
+  const auto start = std::chrono::steady_clock::now();
+  std::mutex statsMutex;
+#endif
+  auto worker = [&]() {
+    JsonParser parser;
+    parser.borrowStrings(m_borrowStrings).internKeys(m_internKeys);
+#ifdef JSON_PARSER_STATS
+    parser.m_reportStats = false;
+#endif
+    for (size_t i; !failed && (i = nextChunk++) < chunkCount;) {
+      const char *first = i == 0 ? open + 1 : commas[i - 1] + 1;
+      const char *last = i == chunkCount - 1 ? close : commas[i];
+      try {
+        parser.parseElements({first, static_cast<size_t>(last - first)},
+                             chunks[i]);
+      } catch (const std::exception &) {
+        failed = true;
+      }
     }
+#ifdef JSON_PARSER_STATS
+    std::lock_guard<std::mutex> lock(statsMutex);
+    m_stats += parser.m_stats;
+#endif
+  };
 
-    Serializer &indent(int i) {
-      m_indent = i;
-      return *this;
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < threadCount && t < chunkCount; ++t) {
+    try {
+      threads.emplace_back(worker);
+    } catch (const std::system_error &) {
+      break; // the remaining chunks are parsed by this thread
     }
+  }
+  worker();
+  for (auto &t : threads)
+    t.join();
+
+  // Reparse to report the same error as a sequential parse.
+  if (failed) {
+#ifdef JSON_PARSER_STATS
+    m_stats = {};
+#endif
+    return parse(input);
+  }
 
-    Serializer &ascii(bool a) {
-      m_ascii = a;
-      return *this;
+  size_t total = 0;
+  for (const auto &c : chunks)
+    total += c.size();
+  JsonArr_t arr = std::move(chunks[0]);
+  arr.reserve(total);
+  for (size_t i = 1; i < chunkCount; ++i)
+    arr.insert(arr.end(), std::make_move_iterator(chunks[i].begin()),
+               std::make_move_iterator(chunks[i].end()));
+  JsonNode ret(std::move(arr));
+  if (m_borrowStrings)
+    ret.header().borrows = true;
+#ifdef JSON_PARSER_STATS
+  // The elements were counted by the workers, the array is counted here.
+  m_stats.bytes = input.size();
+  ++m_stats.arrays;
+  ++m_stats.maxDepth;
+  m_stats.heapBlocks += 2;
+  m_stats.heapBytes += ret.val_.a->capacity() * sizeof(JsonNode);
+  m_stats.parseTime = std::chrono::steady_clock::now() - start;
+  reportStats(false);
+#endif
+  return ret;
+}
+
+// Parses the comma-separated values of an array without the brackets.
+inline void JsonParser::parseElements(std::string_view input, JsonArr_t &out) {
+  size_t offset = 0;
+  for (;;) {
+    out.push_back(parse(input, &offset));
+    if (offset == input.size())
+      return;
+    if (input[offset] != ',')
+      throw std::runtime_error(
+          getJsonErrorMsg(detail::JsonErrorCode::InvalidJson));
+    ++offset;
+  }
+}
+
+inline void JsonNode::recycle(JsonParser &parser) {
+  auto &pool = parser.m_pool;
+  auto &work = pool.recycled;
+  pool.used = true;
+  work.push_back(std::move(*this));
+  while (!work.empty()) {
+    JsonNode node = std::move(work.back());
+    work.pop_back();
+    if (node.arena_)
+      continue; // released with the arena
+    if (node.releaseIfShared())
+      continue;
+    switch (node.ty_) {
+    case ArrType_:
+      for (auto &child : *node.val_.a)
+        if (child.isInternalPtr())
+          work.push_back(std::move(child));
+      if (pool.arrs.size() < JsonParser::NodePool::MaxSize) {
+        node.val_.a->clear();
+        header(node.val_.a).borrows = false;
+        header(node.val_.a).pinned = false;
+        pool.arrs.push_back(node.val_.a);
+        node.drop();
+      }
+      break;
+    case ObjType_:
+      for (auto &member : *node.val_.o)
+        if (member.second.isInternalPtr())
+          work.push_back(std::move(member.second));
+      if (pool.objs.size() < JsonParser::NodePool::MaxSize) {
+        node.val_.o->clear();
+        header(node.val_.o).borrows = false;
+        header(node.val_.o).pinned = false;
+        pool.objs.push_back(node.val_.o);
+        node.drop();
+      }
+      break;
+    case StrType_:
+      if (pool.strs.size() < JsonParser::NodePool::MaxSize) {
+        pool.strs.push_back(node.val_.s);
+        node.drop();
+      }
+      break;
+    default:
+      break;
     }
+  }
+}
 
-    template <typename Derived>
-    Serializer &dump(JsonOutputStreamBase<Derived> &os) {
-      bool formatted = (m_indent != -1);
+inline bool JsonParser::feed(std::string_view chunk) {
+  if (!m_pushBuilder) {
+    m_pushBuilder.emplace(m_pushRoot, m_arena, false, nullptr, keyTable(),
+                          statsSink());
+    m_state = ParseState::Value;
+    m_scopeStack.clear();
+  }
 
-      std::stack<ConstTraverseState> stateStack;
-      stateStack.emplace(&m_node);
+#ifdef JSON_PARSER_STATS
+  std::optional<detail::JsonStatsTimer> timer(&m_stats.parseTime);
+  m_stats.bytes += chunk.size();
+#endif
 
-      while (!stateStack.empty()) {
-        auto node = stateStack.top().node;
-        switch (node->ty_) {
-        case NullType_:
-          os.puts("null", 4);
-          stateStack.pop();
-          break;
-        case BoolType_:
-          node->val_.b ? os.puts("true", 4) : os.puts("false", 5);
-          stateStack.pop();
-          break;
-        case DoubleType_:
-          dumpDouble(os, node->val_.d, m_precision);
-          stateStack.pop();
-          break;
-        case IntType_:
-          dumpInt64(os, node->val_.i);
-          stateStack.pop();
-          break;
-        case UintType_:
-          dumpUint64(os, node->val_.u);
-          stateStack.pop();
-          break;
-        case StrType_:
-          os.put('"');
-          dumpJsonString(os, *(node->val_.s), m_ascii);
-          os.put('"');
-          stateStack.pop();
-          break;
-        case ArrType_: {
-          const auto &arr = *node->val_.a;
-          if (arr.empty()) {
-            os.puts("[]", 2);
-            stateStack.pop();
-            break;
-          }
-          auto &it = stateStack.top().arrIt;
-          if (it == arr.cbegin()) {
-            os.put('[');
-            if (formatted) {
-              os.put('\n');
-              os.put(' ', m_indent * stateStack.size());
-            }
-          } else if (it != arr.cend()) {
-            os.put(',');
-            if (formatted) {
-              os.put('\n');
-              os.put(' ', m_indent * stateStack.size());
-            }
-          }
-          if (it != arr.cend()) {
-            const auto child = &(*it);
-            ++it;
-            stateStack.emplace(child);
-          } else {
-            if (formatted) {
-              os.put('\n');
-              os.put(' ', m_indent * (stateStack.size() - 1));
-            }
-            os.put(']');
-            stateStack.pop();
-          }
-        } break;
-        case ObjType_: {
-          const auto &obj = *node->val_.o;
-          if (obj.empty()) {
-            os.puts("{}", 2);
-            stateStack.pop();
-            break;
-          }
-          auto &it = stateStack.top().objIt;
-          if (it == obj.cbegin()) {
-            os.put('{');
-            if (formatted) {
-              os.put('\n');
-              os.put(' ', m_indent * stateStack.size());
-            }
-          } else if (it != obj.cend()) {
-            os.put(',');
-            if (formatted) {
-              os.put('\n');
-              os.put(' ', m_indent * stateStack.size());
-            }
-          }
+  // Chunks are parsed in place unless a token is pending.
+  std::string_view input = chunk;
+  if (!m_pushBuf.empty()) {
+    m_pushBuf.append(chunk);
+    if (!pendingTokenMayEnd())
+      return false;
+    input = m_pushBuf;
+  }
 
-          if (it != obj.cend()) {
-            os.put('"');
-            dumpJsonString(os, it->first, m_ascii);
-            os.puts("\":", 2);
-            if (formatted)
-              os.put(' ');
-            const auto child = &(it->second);
-            ++it;
-            stateStack.emplace(child);
-          } else {
-            if (formatted) {
-              os.put('\n');
-              os.put(' ', m_indent * (stateStack.size() - 1));
-            }
-            os.put('}');
-            stateStack.pop();
-          }
-        } break;
-        default:
-          stateStack.pop();
-          break;
-        }
-      }
-      return *this;
+  auto s = JsonStringViewInputStream(input, 0);
+  m_failed = false;
+  try {
+    if (!m_pushDone) {
+      ParseStatus status = parseTokens<true>(s, *m_pushBuilder);
+      if (status == ParseStatus::Failed)
+        detail::throwJsonError(m_error);
+      m_pushDone = status == ParseStatus::Complete;
     }
+    if (m_pushDone) {
+      skipSpace(s);
+      if (!s.eoi())
+        detail::throwJsonError(detail::JsonErrorCode::InvalidJson);
+    }
+  } catch (...) {
+#ifdef JSON_PARSER_STATS
+    timer.reset();
+    reportStats(true);
+#endif
+    resetPush();
+    throw;
+  }
 
-    std::string dumps() {
-      std::string str;
-      JsonStringOutputStream os(str);
-      dump(os);
-      return str;
+  if (input.data() == m_pushBuf.data())
+    m_pushBuf.erase(0, s.pos());
+  else
+    m_pushBuf.assign(s.cur(), s.end());
+  m_scanPos = 1; // after the opening quote
+  m_scanEscape = false;
+  return m_pushDone;
+}
+
+inline JsonNode JsonParser::finish() {
+  if (!m_pushBuilder)
+    feed({});
+#ifdef JSON_PARSER_STATS
+  std::optional<detail::JsonStatsTimer> timer(&m_stats.parseTime);
+#endif
+  try {
+    if (!m_pushDone) {
+      // Without more input the pending token is complete or invalid.
+      auto s = JsonStringViewInputStream(m_pushBuf, 0);
+      m_failed = false;
+      if (parseTokens<false>(s, *m_pushBuilder) == ParseStatus::Failed)
+        detail::throwJsonError(m_error);
+      skipSpace(s);
+      if (!s.eoi())
+        detail::throwJsonError(detail::JsonErrorCode::InvalidJson);
     }
+  } catch (...) {
+#ifdef JSON_PARSER_STATS
+    timer.reset();
+    reportStats(true);
+#endif
+    resetPush();
+    throw;
+  }
+#ifdef JSON_PARSER_STATS
+  timer.reset();
+  reportStats(false);
+#endif
+  m_heapAllocated = m_pushBuilder->heapAllocated();
+  JsonNode ret = std::move(m_pushRoot);
+  resetPush();
+  return ret;
+}
 
-  private:
-    template <typename Derived>
-    static void dumpInt64(JsonOutputStreamBase<Derived> &os, int64_t i) {
-      if (i < 0) {
-        os.put('-');
-        dumpUint64(os, -i);
-      } else {
-        dumpUint64(os, i);
-      }
+// Tells whether the input appended to m_pushBuf may complete the pending
+// token, so that a long string is not parsed again for every chunk.
+inline bool JsonParser::pendingTokenMayEnd() {
+  const char *end = m_pushBuf.data() + m_pushBuf.size();
+  const char *p = m_pushBuf.data() + m_scanPos;
+  m_scanPos = m_pushBuf.size();
+  switch (m_pendingToken) {
+  case PendingToken::String:
+    for (; p != end; ++p) {
+      if (m_scanEscape)
+        m_scanEscape = false;
+      else if (*p == '\\')
+        m_scanEscape = true;
+      else if (*p == '"')
+        return true;
     }
+    return false;
+  case PendingToken::Number:
+    return detail::skipNumberSpan(p, end) != end;
+  default:
+    return true;
+  }
+}
 
-    template <typename Derived>
-    static void dumpUint64(JsonOutputStreamBase<Derived> &os, uint64_t u) {
-      char buf[20];
-      char *p = buf + 19;
-      while (u > 9) {
-        *p-- = '0' + u % 10;
-        u /= 10;
+inline void JsonParser::resetPush() {
+  m_pushBuilder.reset();
+  m_pushRoot = JsonNode{};
+  m_pushBuf.clear();
+  m_pushDone = false;
+  m_pendingToken = PendingToken::Other;
+}
+
+template <typename Derived>
+inline bool JsonParser::skipValue(JsonInputStreamBase<Derived> &is) {
+  if (is.ch() == ',')
+    return fail(detail::JsonErrorCode::InvalidArrayOrObject);
+  if constexpr (Derived::contiguous) {
+    auto &s = static_cast<Derived &>(is);
+    const char *p = detail::skipValueSpan(s.cur(), s.end());
+    if (p == nullptr)
+      return fail(detail::JsonErrorCode::UnexpectedEndOfInput);
+    if (p == s.cur())
+      return fail(detail::JsonErrorCode::InvalidJson);
+    s.seek(p);
+  } else {
+    char c = is.ch();
+    if (c != '"' && c != '[' && c != '{') {
+      if (c == ']' || c == '}')
+        return fail(detail::JsonErrorCode::InvalidJson);
+      while (!is.eoi() && !detail::isJsonSpace(is.ch()) && is.ch() != ',' &&
+             is.ch() != ']' && is.ch() != '}')
+        is.next();
+      return true;
+    }
+    size_t depth = 0;
+    do {
+      if (is.eoi())
+        return fail(detail::JsonErrorCode::UnexpectedEndOfInput);
+      switch (is.get()) {
+      case '"':
+        for (;;) {
+          if (is.eoi())
+            return fail(detail::JsonErrorCode::UnexpectedEndOfInput);
+          c = is.get();
+          if (c == '"')
+            break;
+          if (c == '\\' && !is.eoi())
+            is.next();
+        }
+        break;
+      case '[':
+      case '{':
+        ++depth;
+        break;
+      case ']':
+      case '}':
+        --depth;
+        break;
       }
-      *p = '0' + static_cast<char>(u);
-      os.puts(p, buf + 20 - p);
+    } while (depth != 0);
+  }
+  return true;
+}
+
+template <typename Derived>
+inline void JsonParser::skipSpace(JsonInputStreamBase<Derived> &is) {
+  if constexpr (Derived::contiguous) {
+    auto &s = static_cast<Derived &>(is);
+    s.seek(detail::skipSpaceSpan(s.cur(), s.end()));
+    return;
+  }
+  while (!is.eoi() && (is.ch() == ' ' || is.ch() == '\t' || is.ch() == '\n' ||
+                       is.ch() == '\r')) {
+    is.next();
+  }
+}
+
+template <typename Derived, typename Handler>
+inline bool JsonParser::parseLiteral(JsonInputStreamBase<Derived> &is,
+                                     Handler &handler) {
+  switch (is.get()) {
+  case 'n':
+    if (!is.eoi() && is.get() == 'u' && !is.eoi() && is.get() == 'l' &&
+        !is.eoi() && is.get() == 'l') {
+      JSON_PARSER_COUNT(statsSink(), nulls, 1);
+      return handler.onNull();
+    }
+    break;
+  case 't':
+    if (!is.eoi() && is.get() == 'r' && !is.eoi() && is.get() == 'u' &&
+        !is.eoi() && is.get() == 'e') {
+      JSON_PARSER_COUNT(statsSink(), bools, 1);
+      return handler.onBool(true);
+    }
+    break;
+  case 'f':
+    if (!is.eoi() && is.get() == 'a' && !is.eoi() && is.get() == 'l' &&
+        !is.eoi() && is.get() == 's' && !is.eoi() && is.get() == 'e') {
+      JSON_PARSER_COUNT(statsSink(), bools, 1);
+      return handler.onBool(false);
     }
+    break;
+  }
+  return fail(detail::JsonErrorCode::InvalidLiteral);
+}
 
-    template <typename Derived>
-    static void dumpDouble(JsonOutputStreamBase<Derived> &os, double d,
-                           int precision) {
-#ifdef JSON_PARSER_USE_STD_FORMAT
-      std::string num = precision != -1 ? std::format("{:.{}f}", d, precision)
-                                        : std::format("{}", d);
-      os.puts(num.c_str(), num.size());
-#elif defined(JSON_PARSER_USE_LIBFMT)
-      std::string num = precision != -1 ? fmt::format("{:.{}f}", d, precision)
-                                        : fmt::format("{}", d);
-      os.puts(num.c_str(), num.size());
-#else
-      char buf[64];
-      int len = precision >= 0 ? std::snprintf(buf, 64, "%.*g", precision, d)
-                               : std::snprintf(buf, 64, "%g", d);
-      os.puts(buf, len);
-#endif
+template <typename Derived>
+inline bool JsonParser::parseStringToken(JsonInputStreamBase<Derived> &is,
+                                         std::string_view &str, bool &inInput) {
+  // Characters already scanned by the fast path.
+  const char *prefix = nullptr, *prefixEnd = nullptr;
+
+  if constexpr (Derived::contiguous) {
+    auto &s = static_cast<Derived &>(is);
+    const char *begin = s.cur(), *end = s.end(), *p = begin;
+    while ((p = detail::scanStringSpan(p, end)) != end &&
+           static_cast<uint8_t>(*p) >= 0x80u) {
+      size_t n = detail::utf8SequenceLength(p, end);
+      if (n == 0)
+        break;
+      p += n;
     }
-
-    template <typename Derived>
-    static void dumpJsonString(JsonOutputStreamBase<Derived> &os,
-                               const JsonStr_t &src, bool ascii) {
-      for (auto ite = src.begin(); ite != src.end(); ++ite) {
-        switch (*ite) {
-        case '"':
-        case '\\':
-          os.put('\\');
-          os.put(*ite);
-          break;
-        case '\b':
-          os.puts("\\b", 2);
-          break;
-        case '\f':
-          os.puts("\\f", 2);
-          break;
-        case '\n':
-          os.puts("\\n", 2);
-          break;
-        case '\r':
-          os.puts("\\r", 2);
-          break;
-        case '\t':
-          os.puts("\\t", 2);
-          break;
-        default: {
-          if (static_cast<unsigned char>(*ite) < 0x20u) {
-            const char escaped[]{
-                '\\',
-                'u',
-                '0',
-                '0',
-                char('0' + *ite / 16),
-                char(*ite % 16 + ((*ite % 16) > 9 ? 'a' - 10 : '0'))};
-            os.puts(escaped, 6);
-          } else if (ascii && *ite & 0x80)
-            decodeUtf8(os, ite);
-          else
-            os.put(*ite);
-        } break;
-        }
-      }
+    if (p != end && *p == '"' &&
+        static_cast<size_t>(p - begin) <= UINT32_MAX) {
+      s.seek(p + 1);
+      inInput = true;
+      str = {begin, static_cast<size_t>(p - begin)};
+      return true;
     }
+    // Escape sequence or error ahead, continue with a copy.
+    prefix = begin;
+    prefixEnd = p;
+    s.seek(p);
+  }
 
-    template <typename Derived>
-    static void decodeUtf8(JsonOutputStreamBase<Derived> &os,
-                           std::string::const_iterator &ite) {
-      uint32_t u = 0;
-      if (!(*ite & 0x20)) {
-        u = ((*ite & 0x1F) << 6) | (*(ite + 1) & 0x3F);
-        ++ite;
-      } else if (!(*ite & 0x10)) {
-        u = ((*ite & 0xF) << 12) | ((*(ite + 1) & 0x3F) << 6) |
-            (*(ite + 2) & 0x3F);
-        ite += 2;
-      } else {
-        u = ((*ite & 0x7) << 18) | ((*(ite + 1) & 0x3F) << 12) |
-            ((*(ite + 2) & 0x3F) << 6) | (*(ite + 3) & 0x3F);
-        ite += 3;
-      }
+  m_strBuf.clear();
+  m_strBuf.append(prefix, prefixEnd);
+  if (!parseString(is, m_strBuf))
+    return false;
+  inInput = false;
+  str = m_strBuf;
+  return true;
+}
 
-      if (u >= 0x10000) {
-        uint32_t l = 0xDC00 + (u & 0x3FF);
-        uint32_t u0 = ((u - 0x10000) >> 10) + 0xD800;
-        if (u0 <= 0xDBFF) {
-          toHex4(os, u0);
-          toHex4(os, l);
+template <typename Derived>
+inline bool JsonParser::parseString(JsonInputStreamBase<Derived> &is,
+                                    JsonStr_t &ret) {
+  [[maybe_unused]] bool escaped = false;
+  while (!is.eoi() && is.ch() != '"') {
+    switch (is.ch()) {
+    case '\\':
+      is.next();
+      if (!parseEscape(is, ret))
+        return false;
+      escaped = true;
+      break;
+    default:
+      if (static_cast<uint8_t>(is.ch()) < 0x20u)
+        return fail(detail::JsonErrorCode::InvalidCharacter);
+
+      if constexpr (Derived::contiguous) {
+        if (static_cast<uint8_t>(is.ch()) < 0x80u) {
+          auto &s = static_cast<Derived &>(is);
+          const char *p = detail::scanStringSpan(s.cur() + 1, s.end());
+          ret.append(s.cur(), p);
+          s.seek(p);
+          break;
         }
       }
-      toHex4(os, u);
-    }
-
-    template <typename Derived>
-    static void toHex4(JsonOutputStreamBase<Derived> &os, uint32_t u) {
-      char h[4];
-      for (int i = 3; i >= 0; --i) {
-        h[i] = u & 0xF;
-        h[i] = h[i] < 10 ? (h[i] + '0') : (h[i] - 10 + 'a');
-        u >>= 4;
-      }
-      os.puts("\\u", 2);
-      os.puts(h, 4);
+      if (!parseUtf8(is, ret))
+        return false;
     }
+  }
 
-  private:
-    const JsonNode &m_node;
-    int m_precision = -1;
-    int m_indent = -1;
-    bool m_ascii = true;
-  };
+  if (is.eoi())
+    return fail(detail::JsonErrorCode::InvalidString);
 
-public:
-  Serializer serializer() const { return Serializer(*this); }
+  is.next();
+  JSON_PARSER_COUNT(statsSink(), escapedStrings, escaped);
+  return true;
+}
 
-private:
-  enum JsonInternalTypeId : size_t {
-    NullType_ = 0,
-    BoolType_,
-    DoubleType_,
-    IntType_,
-    UintType_,
-    StrType_,
-    ArrType_,
-    ObjType_,
-  } ty_ = {};
+template <typename Derived>
+inline bool JsonParser::parseEscape(JsonInputStreamBase<Derived> &is,
+                                    JsonStr_t &ret) {
+  if (is.eoi())
+    return fail(detail::JsonErrorCode::InvalidString);
 
-  union {
-    bool b;
-    double d;
-    int64_t i;
-    uint64_t u;
-    JsonStr_t *s;
-    JsonArr_t *a;
-    JsonObj_t *o;
-  } val_;
-};
+  switch (is.ch()) {
+  case '"':
+  case '\\':
+  case '/':
+    ret.push_back(is.ch());
+    is.next();
+    break;
+  case 'b':
+    ret.push_back('\b');
+    is.next();
+    break;
+  case 'f':
+    ret.push_back('\f');
+    is.next();
+    break;
+  case 'n':
+    ret.push_back('\n');
+    is.next();
+    break;
+  case 'r':
+    ret.push_back('\r');
+    is.next();
+    break;
+  case 't':
+    ret.push_back('\t');
+    is.next();
+    break;
+  case 'u': {
+    is.next();
+    uint32_t u;
+    if (!parseHex4(is, u))
+      return false;
+    if (u >= 0xD800 && u <= 0xDBFF) {
+      if (is.eoi() || is.get() != '\\')
+        return fail(detail::JsonErrorCode::InvalidUnicode);
 
-class JsonParser {
-public:
-  JsonParser() = default;
-  JsonParser(const JsonParser &) = delete;
-  JsonParser &operator=(const JsonParser &) = delete;
+      if (is.eoi() || is.get() != 'u')
+        return fail(detail::JsonErrorCode::InvalidUnicode);
 
-  JsonNode parse(std::string_view, size_t *offset = nullptr);
-  JsonNode parse(std::ifstream &, bool checkEnd = true);
-  JsonNode parse(std::istream &, bool checkEnd = true);
+      uint32_t u2;
+      if (!parseHex4(is, u2))
+        return false;
+      if (u2 < 0xDC00 || u2 > 0xDFFF)
+        return fail(detail::JsonErrorCode::InvalidUnicode);
 
-  JsonNode streamParse(std::string_view, size_t *offset = nullptr,
-                       bool *isComplete = nullptr);
-  JsonNode streamParse(std::ifstream &, bool *isComplete = nullptr);
-  JsonNode streamParse(std::istream &, bool *isComplete = nullptr);
+      u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
+    }
+    encodeUtf8(ret, u);
+  } break;
+  default:
+    return fail(detail::JsonErrorCode::InvalidEscapeSequence);
+  }
+  return true;
+}
 
-  template <typename Derived> class JsonInputStreamBase {
-  public:
-    char ch() const {
-      return (static_cast<const Derived *>(this))->ch();
-    } // peek
-    void next() { (static_cast<Derived *>(this))->next(); }
-    char get() { return (static_cast<Derived *>(this))->get(); }
-    bool eoi() const {
-      return (static_cast<const Derived *>(this))->eoi();
-    } // end of input
-  };
+template <typename Derived>
+inline bool JsonParser::parseHex4(JsonInputStreamBase<Derived> &is,
+                                  uint32_t &u) {
+  u = 0;
+  for (int i = 0; i < 4; ++i) {
+    if (is.eoi())
+      return fail(detail::JsonErrorCode::InvalidString);
 
-  template <typename Derived>
-  JsonNode parse(JsonInputStreamBase<Derived> &, bool checkEnd = true);
+    char c = is.get();
+    u <<= 4;
+    if (c >= '0' && c <= '9') {
+      u |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      u |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      u |= c - 'A' + 10;
+    } else {
+      return fail(detail::JsonErrorCode::InvalidUnicode);
+    }
+  }
+  return true;
+}
 
-  template <typename Derived>
-  JsonNode streamParse(JsonInputStreamBase<Derived> &,
-                       bool *isComplete = nullptr);
+template <typename Derived>
+inline bool JsonParser::parseUtf8(JsonInputStreamBase<Derived> &is,
+                                  JsonStr_t &ret) {
+  uint8_t byteCount = detail::utf8ByteCount(static_cast<uint8_t>(is.ch()));
+  if (byteCount == 0)
+    return fail(detail::JsonErrorCode::InvalidCharacter);
 
-private:
-  template <size_t BufSize>
-  class JsonFileInputStream
-      : public JsonInputStreamBase<JsonFileInputStream<BufSize>> {
-  public:
-    JsonFileInputStream(std::istream &is)
-        : m_is(is), m_bufPos(BufSize), m_endPos(static_cast<size_t>(-1)) {
-      fillBuf();
-    }
+  ret.push_back(is.get());
+  while (byteCount-- > 1) {
+    if (!is.eoi() && detail::isUtf8Continuation(static_cast<uint8_t>(is.ch())))
+      ret.push_back(is.get());
+    else
+      return fail(detail::JsonErrorCode::InvalidCharacter);
+  }
+  return true;
+}
 
-    ~JsonFileInputStream() {
-      if (m_is.eof()) {
-        if (!eoi()) {
-          m_is.clear();
-          m_is.seekg(m_bufPos - m_endPos, std::ios_base::end);
-        }
-      } else if (m_bufPos != BufSize) {
-        m_is.seekg(m_bufPos - BufSize, std::ios_base::cur);
-      }
-    }
+inline void JsonParser::encodeUtf8(JsonStr_t &ret, uint32_t u) {
+  if (u <= 0x7F)
+    ret.push_back(u & 0xFF);
+  else if (u <= 0x7FF) {
+    ret.push_back(0xC0 | ((u >> 6) & 0xFF));
+    ret.push_back(0x80 | (u & 0x3F));
+  } else if (u <= 0xFFFF) {
+    ret.push_back(0xE0 | ((u >> 12) & 0xFF));
+    ret.push_back(0x80 | ((u >> 6) & 0x3F));
+    ret.push_back(0x80 | (u & 0x3F));
+  } else {
+    ret.push_back(0xF0 | ((u >> 18) & 0xFF));
+    ret.push_back(0x80 | ((u >> 12) & 0x3F));
+    ret.push_back(0x80 | ((u >> 6) & 0x3F));
+    ret.push_back(0x80 | (u & 0x3F));
+  }
+}
 
-    char ch() const { return m_buf[m_bufPos]; }
-    void next() {
-      ++m_bufPos;
-      if (m_bufPos == BufSize)
-        fillBuf();
-    }
-    char get() {
-      char c = m_buf[m_bufPos++];
-      if (m_bufPos == BufSize)
-        fillBuf();
-      return c;
-    }
-    bool eoi() const { return m_bufPos == m_endPos; }
+template <typename Derived, typename Handler>
+inline bool JsonParser::parseKeyWithColon(JsonInputStreamBase<Derived> &is,
+                                          Handler &handler) {
+  std::string_view key;
+  bool inInput;
+  if (!parseStringToken(is, key, inInput))
+    return false;
+  skipSpace(is);
+  if (is.eoi() || is.get() != ':')
+    return fail(detail::JsonErrorCode::InvalidKeyValuePair);
 
-  private:
-    void fillBuf() {
-      m_is.read(m_buf, BufSize);
-      m_bufPos = 0;
-      if (m_is.eof())
-        m_endPos = m_is.gcount();
-    }
+  // The key may refer to the scratch buffer, which is still unchanged.
+  return handler.onKey(key);
+}
 
-  private:
-    std::istream &m_is;
-    char m_buf[BufSize];
-    size_t m_bufPos;
-    size_t m_endPos;
+template <typename Derived, typename Handler>
+inline bool JsonParser::parseNumber(JsonInputStreamBase<Derived> &is,
+                                    Handler &handler) {
+  // The digits are accumulated while scanning. The text itself is only
+  // needed when the fast paths do not apply; contiguous input is referenced
+  // in place, other streams are copied into m_numBuf.
+  const char *text = nullptr;
+  if constexpr (Derived::contiguous)
+    text = static_cast<Derived &>(is).cur();
+  else
+    m_numBuf.clear();
+  auto take = [&]() {
+    char c = is.get();
+    if constexpr (!Derived::contiguous)
+      m_numBuf.push_back(c);
+    return c;
   };
 
-  class JsonStringViewInputStream
-      : public JsonInputStreamBase<JsonStringViewInputStream> {
-  public:
-    JsonStringViewInputStream(const std::string_view &input, size_t offset)
-        : m_input(input), m_pos(input.cbegin() + offset) {}
-    char ch() const { return *m_pos; }
-    void next() { ++m_pos; }
-    char get() { return *m_pos++; }
-    bool eoi() const { return m_pos == m_input.cend(); }
+  bool negative = false;
+  bool isFloatingPoint = false;
+  uint64_t mantissa = 0; // first 19 significant digits
+  int significantDigits = 0;
+  bool truncated = false;
+  int64_t exp10 = 0;
+  int lastDigit = 0;
+
+  auto addDigit = [&](int d, bool fraction) {
+    lastDigit = d;
+    if (significantDigits < 19) {
+      mantissa = mantissa * 10 + d;
+      if (mantissa != 0)
+        ++significantDigits;
+      if (fraction)
+        --exp10;
+    } else {
+      truncated = true;
+      if (!fraction)
+        ++exp10;
+    }
+  };
 
-    size_t pos() const { return std::distance(m_input.cbegin(), m_pos); }
+  if (is.ch() == '-') {
+    negative = true;
+    take();
+  }
+  if (is.eoi())
+    return fail(detail::JsonErrorCode::InvalidNumber);
+  if (is.ch() == '0') {
+    take();
+  } else {
+    if (!detail::isDigit(is.ch()))
+      return fail(detail::JsonErrorCode::InvalidNumber);
+    while (!is.eoi() && detail::isDigit(is.ch()))
+      addDigit(take() - '0', false);
+  }
+  if (!is.eoi() && is.ch() == '.') {
+    isFloatingPoint = true;
+    take();
+    if (is.eoi() || !detail::isDigit(is.ch()))
+      return fail(detail::JsonErrorCode::InvalidNumber);
+    while (!is.eoi() && detail::isDigit(is.ch()))
+      addDigit(take() - '0', true);
+  }
+  if (!is.eoi() && (is.ch() == 'e' || is.ch() == 'E')) {
+    isFloatingPoint = true;
+    take();
+    if (is.eoi())
+      return fail(detail::JsonErrorCode::InvalidNumber);
+    bool negativeExp = false;
+    if (is.ch() == '+' || is.ch() == '-')
+      negativeExp = take() == '-';
+    if (is.eoi() || !detail::isDigit(is.ch()))
+      return fail(detail::JsonErrorCode::InvalidNumber);
+    int64_t e = 0;
+    while (!is.eoi() && detail::isDigit(is.ch())) {
+      int d = take() - '0';
+      if (e < 100000) // far beyond the range of double either way
+        e = e * 10 + d;
+    }
+    exp10 += negativeExp ? -e : e;
+  }
 
-  private:
-    std::string_view m_input;
-    std::string_view::const_iterator m_pos;
-  };
+  if (!isFloatingPoint) {
+    // A 20 digit integer only lost its last digit.
+    if (exp10 == 1 && mantissa <= (UINT64_MAX - lastDigit) / 10) {
+      mantissa = mantissa * 10 + lastDigit;
+      exp10 = 0;
+    }
+    if (exp10 == 0) {
+      if (!negative) {
+        JSON_PARSER_COUNT(statsSink(), uints, 1);
+        return handler.onUint64(mantissa);
+      }
+      if (mantissa <= uint64_t(1) << 63) { // -2^63 is the smallest int64_t
+        JSON_PARSER_COUNT(statsSink(), ints, 1);
+        return handler.onInt64(mantissa == 0
+                                   ? int64_t(0)
+                                   : -static_cast<int64_t>(mantissa - 1) - 1);
+      }
+    }
+  }
 
-private:
-  template <typename Derived> void parseLoop(JsonInputStreamBase<Derived> &);
+  double num;
+  if (!truncated && mantissa <= (uint64_t(1) << 53) && exp10 >= -22 &&
+      exp10 <= 22) {
+    // Both operands are exact, so one rounding gives the correct result.
+    num = static_cast<double>(mantissa);
+    num = exp10 < 0 ? num / detail::pow10Exact(-exp10)
+                    : num * detail::pow10Exact(exp10);
+    if (negative)
+      num = -num;
+  } else if constexpr (Derived::contiguous) {
+    num = detail::parseDouble(text, static_cast<Derived &>(is).cur());
+  } else {
+    num = detail::parseDouble(m_numBuf.data(),
+                              m_numBuf.data() + m_numBuf.size());
+  }
+  if (std::isinf(num))
+    return fail(detail::JsonErrorCode::InvalidNumber);
+  JSON_PARSER_COUNT(statsSink(), doubles, 1);
+  return handler.onDouble(num);
+}
 
-  template <typename Derived> void skipSpace(JsonInputStreamBase<Derived> &);
+// A parsed tree together with the arena its containers and strings are
+// allocated from. Everything is freed at once when the document is destroyed
+// or cleared; if the tree was only read through root(), no per-node work is
+// done at all.
+//
+// Nodes moved out of the tree keep referring to the arena and must not
+// outlive the document; copies are independent.
+class JsonDocument {
+public:
+  JsonDocument() : m_arena(std::make_unique<JsonArena>()) {}
+  JsonDocument(std::string_view input, size_t *offset = nullptr)
+      : JsonDocument() {
+    parse(input, offset);
+  }
 
-  template <typename Derived>
-  void parseLiteral(JsonInputStreamBase<Derived> &, JsonNode *);
+  JsonDocument(const JsonDocument &) = delete;
+  JsonDocument &operator=(const JsonDocument &) = delete;
 
-  template <typename Derived>
-  JsonStr_t parseString(JsonInputStreamBase<Derived> &);
+  JsonDocument(JsonDocument &&other) noexcept
+      : m_arena(std::move(other.m_arena)), m_root(std::move(other.m_root)),
+        m_trivial(other.m_trivial), m_borrowStrings(other.m_borrowStrings),
+        m_file(std::move(other.m_file)),
+        m_fileCopy(std::move(other.m_fileCopy)) {
+    other.m_trivial = true;
+  }
 
-  template <typename Derived>
-  void parseEscape(JsonInputStreamBase<Derived> &, JsonStr_t &);
+  JsonDocument &operator=(JsonDocument &&other) noexcept {
+    JsonDocument tmp(std::move(other));
+    swap(tmp);
+    return *this;
+  }
 
-  template <typename Derived>
-  void parseUtf8(JsonInputStreamBase<Derived> &, JsonStr_t &);
+  ~JsonDocument() {
+    if (m_trivial)
+      m_root.drop();
+  }
 
-  template <typename Derived>
-  uint32_t parseHex4(JsonInputStreamBase<Derived> &);
+  void swap(JsonDocument &other) noexcept {
+    std::swap(m_arena, other.m_arena);
+    m_root.swap(other.m_root);
+    std::swap(m_trivial, other.m_trivial);
+    std::swap(m_borrowStrings, other.m_borrowStrings);
+    std::swap(m_file, other.m_file);
+    m_fileCopy.swap(other.m_fileCopy);
+  }
 
-  void encodeUtf8(JsonStr_t &, uint32_t);
+  // See JsonParser::borrowStrings, the input must outlive the document.
+  JsonDocument &borrowStrings(bool b) {
+    m_borrowStrings = b;
+    return *this;
+  }
 
-  template <typename Derived> void beginArray(JsonInputStreamBase<Derived> &);
+  void parse(std::string_view input, size_t *offset = nullptr) {
+    clear();
+    size_t start = offset == nullptr ? 0 : *offset;
+    m_arena->reserve(input.size() > start ? input.size() - start : 0);
+    JsonParser parser(*m_arena);
+    parser.borrowStrings(m_borrowStrings);
+    m_root = parser.parse(input, offset);
+    m_trivial = !parser.m_heapAllocated;
+  }
 
-  template <typename Derived> void beginObject(JsonInputStreamBase<Derived> &);
+  // Parses a whole file. The document keeps the mapping (or a copy of the
+  // file if it cannot be mapped), so borrowed strings stay valid.
+  void parseFile(const std::filesystem::path &filename) {
+    clear();
+    m_file = JsonMappedFile(filename);
+    if (!m_file.isOpen()) {
+      std::ifstream ifs(filename, std::ios::binary);
+      m_fileCopy.assign(std::istreambuf_iterator<char>(ifs),
+                        std::istreambuf_iterator<char>());
+    }
+    std::string_view input = m_file.isOpen() ? m_file.view() : m_fileCopy;
+    m_arena->reserve(input.size());
+    JsonParser parser(*m_arena);
+    parser.borrowStrings(m_borrowStrings);
+    m_root = parser.parse(input);
+    m_trivial = !parser.m_heapAllocated;
+  }
 
-  template <typename Derived>
-  JsonStr_t parseKeyWithColon(JsonInputStreamBase<Derived> &);
+  const JsonNode &root() const { return m_root; }
 
-  template <typename Derived> void handleComma(JsonInputStreamBase<Derived> &);
+  // Values assigned through the returned reference may be heap-allocated, so
+  // the tree is walked on destruction from then on.
+  JsonNode &mutableRoot() {
+    m_trivial = false;
+    return m_root;
+  }
 
-  template <typename Derived>
-  void parseNumber(JsonInputStreamBase<Derived> &, JsonNode *);
+  JsonArena &arena() { return *m_arena; }
 
-  void popStack() {
-    if (!m_nodeStack.empty())
-      m_nodeStack.pop();
+  // Drops the tree and keeps one chunk of the arena for the next parse.
+  void clear() {
+    if (m_trivial)
+      m_root.drop();
     else
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidJson));
+      m_root = JsonNode{};
+    m_trivial = true;
+    if (!m_arena)
+      m_arena = std::make_unique<JsonArena>();
+    else
+      m_arena->reset();
+    m_file.close();
+    m_fileCopy.clear();
   }
 
 private:
-  std::stack<JsonNode *> m_nodeStack;
+  std::unique_ptr<JsonArena> m_arena;
+  JsonNode m_root;
+  bool m_trivial = true;
+  bool m_borrowStrings = false;
+  JsonMappedFile m_file;
+  std::string m_fileCopy;
 };
 
-template <>
-class JsonParser::JsonFileInputStream<1>
-    : public JsonInputStreamBase<JsonFileInputStream<1>> {
+// Destroys trees and documents on a background thread, keeping the time to
+// free large trees off the caller's thread. retire() takes ownership in O(1);
+// values without heap storage are dropped right away. Retired nodes
+// allocated from an arena need the arena to outlive the reclaimer, or
+// drain(). The destructor frees whatever is left. If the thread cannot be
+// started, retire() frees on the caller's thread.
+class JsonReclaimer {
 public:
-  JsonFileInputStream(std::istream &is) : m_is(is) {}
-  char ch() const { return m_is.peek(); }
-  void next() { m_is.get(); }
-  char get() { return m_is.get(); }
-  bool eoi() const { return m_is.eof(); }
+  JsonReclaimer() {
+    try {
+      m_thread = std::thread([this] { run(); });
+    } catch (const std::system_error &) {
+    }
+  }
+  JsonReclaimer(const JsonReclaimer &) = delete;
+  JsonReclaimer &operator=(const JsonReclaimer &) = delete;
+
+  ~JsonReclaimer() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_one();
+    if (m_thread.joinable())
+      m_thread.join();
+  }
+
+  // node is null afterwards.
+  void retire(JsonNode &&node) {
+    if (!node.isInternalPtr() || !m_thread.joinable()) {
+      node = JsonNode{};
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_nodes.push_back(std::move(node));
+      ++m_pending;
+    }
+    m_wake.notify_one();
+  }
+
+  // doc is empty afterwards.
+  void retire(JsonDocument &&doc) {
+    if (!m_thread.joinable()) {
+      doc.clear();
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_docs.push_back(std::move(doc));
+      ++m_pending;
+    }
+    m_wake.notify_one();
+  }
+
+  // Waits until everything retired so far has been freed.
+  void drain() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_pending == 0; });
+  }
+
+  // Number of trees and documents retired but not freed yet.
+  size_t pending() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pending;
+  }
 
 private:
-  std::istream &m_is;
+  void run() {
+    std::vector<JsonNode> nodes;
+    std::vector<JsonDocument> docs;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+      m_wake.wait(lock, [this] {
+        return m_stop || !m_nodes.empty() || !m_docs.empty();
+      });
+      if (m_nodes.empty() && m_docs.empty())
+        return; // stopped
+      // Take the whole batch and free it unlocked, nodes first, as they may
+      // live in the arena of a document retired with them.
+      nodes.swap(m_nodes);
+      docs.swap(m_docs);
+      lock.unlock();
+      const size_t n = nodes.size() + docs.size();
+      nodes.clear();
+      docs.clear();
+      lock.lock();
+      m_pending -= n;
+      if (m_pending == 0)
+        m_idle.notify_all();
+    }
+  }
+
+private:
+  mutable std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_idle;
+  std::vector<JsonNode> m_nodes;
+  std::vector<JsonDocument> m_docs;
+  size_t m_pending = 0;
+  bool m_stop = false;
+  std::thread m_thread;
 };
 
-template <typename Derived>
-inline void JsonParser::parseLoop(JsonInputStreamBase<Derived> &is) {
-  while (!m_nodeStack.empty()) {
-    skipSpace(is);
-    if (is.eoi())
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::UnexpectedEndOfInput));
+// Reads newline-delimited JSON, one document per line; blank lines are
+// skipped. Records are parsed in batches, the lines of a batch on up to
+// threadCount threads (0 means one per hardware thread), which are started
+// with the first batch and kept until the reader is destroyed. The nodes of a
+// batch are recycled into the parsers of the next one, so the consumer sets
+// the pace and steady batches do not allocate.
+class JsonLinesReader {
+public:
+  explicit JsonLinesReader(std::string_view input, unsigned threadCount = 0,
+                           size_t batchSize = 1024)
+      : m_input(input), m_batchSize(std::max<size_t>(batchSize, 1)),
+        m_parsers(parserCount(threadCount)) {}
+
+  // Maps the file, or reads it if it cannot be mapped. Only taken for an
+  // actual path, strings are input.
+  template <typename Path, typename = std::enable_if_t<
+                               std::is_same_v<Path, std::filesystem::path>>>
+  explicit JsonLinesReader(const Path &filename, unsigned threadCount = 0,
+                           size_t batchSize = 1024)
+      : m_file(filename), m_batchSize(std::max<size_t>(batchSize, 1)),
+        m_parsers(parserCount(threadCount)) {
+    if (m_file.isOpen()) {
+      m_input = m_file.view();
+    } else {
+      std::ifstream ifs(filename, std::ios::binary);
+      m_fileCopy.assign(std::istreambuf_iterator<char>(ifs),
+                        std::istreambuf_iterator<char>());
+      m_input = m_fileCopy;
+    }
+  }
 
-    auto *node = m_nodeStack.top();
+  JsonLinesReader(const JsonLinesReader &) = delete;
+  JsonLinesReader &operator=(const JsonLinesReader &) = delete;
 
-    switch (is.ch()) {
-    case 'n':
-    case 't':
-    case 'f':
-      parseLiteral(is, node);
-      popStack();
-      break;
-    case '"':
-      is.next();
-      *node = JsonStr_t{};
-      *node->val_.s = parseString(is);
-      popStack();
-      break;
-    case '[':
-      is.next();
-      beginArray(is);
-      break;
-    case ']':
-      is.next();
-      if (!node->isArr())
-        throw std::runtime_error(
-            getJsonErrorMsg(detail::JsonErrorCode::InvalidJson));
-      popStack();
-      break;
-    case '{':
-      is.next();
-      beginObject(is);
-      break;
-    case '}':
-      is.next();
-      if (!node->isObj())
-        throw std::runtime_error(
-            getJsonErrorMsg(detail::JsonErrorCode::InvalidJson));
-      popStack();
-      break;
-    case ',':
-      is.next();
-      handleComma(is);
-      break;
-    default:
-      if (std::isdigit(is.ch()) || is.ch() == '-') {
-        parseNumber(is, node);
-        popStack();
-      } else {
-        throw std::runtime_error(
-            getJsonErrorMsg(detail::JsonErrorCode::InvalidJson));
-      }
+  ~JsonLinesReader() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
     }
+    m_wake.notify_all();
+    for (auto &t : m_threads)
+      t.join();
   }
-}
 
-template <typename Derived>
-inline JsonNode JsonParser::parse(JsonInputStreamBase<Derived> &is,
-                                  bool checkEnd) {
-  JsonNode ret;
+  // See JsonParser::borrowStrings; file input stays alive with the reader.
+  JsonLinesReader &borrowStrings(bool b) {
+    for (auto &p : m_parsers)
+      p.borrowStrings(b);
+    return *this;
+  }
 
-  m_nodeStack = {};
-  m_nodeStack.push(&ret);
+  // See JsonParser::internKeys; each parser keeps one table for all records.
+  JsonLinesReader &internKeys(bool b) {
+    for (auto &p : m_parsers)
+      p.internKeys(b);
+    return *this;
+  }
 
-  parseLoop(is);
+  bool eof() const { return m_pos == m_input.size(); }
+
+  // Parses the next lines and returns their documents, empty at the end of
+  // input. Throws if a record is invalid; the message names the line.
+  std::vector<JsonNode> &nextBatch() {
+    m_lines.clear();
+    m_lineNumbers.clear();
+    const char *begin = m_input.data();
+    const char *end = begin + m_input.size();
+    while (m_lines.size() < m_batchSize && m_pos != m_input.size()) {
+      const char *first = begin + m_pos;
+      auto *nl = static_cast<const char *>(
+          std::memchr(first, '\n', static_cast<size_t>(end - first)));
+      const char *last = nl == nullptr ? end : nl;
+      m_pos = nl == nullptr ? m_input.size() : (nl - begin) + 1;
+      ++m_lineNumber;
+      if (detail::skipSpaceSpan(first, last) != last) {
+        m_lines.emplace_back(first, static_cast<size_t>(last - first));
+        m_lineNumbers.push_back(m_lineNumber);
+      }
+    }
 
-  skipSpace(is);
-  if (checkEnd && !is.eoi())
-    throw std::runtime_error(
-        getJsonErrorMsg(detail::JsonErrorCode::InvalidJson));
+    const size_t n = m_lines.size();
+    m_batch.resize(n);
+    if (n == 0)
+      return m_batch;
+    m_parts = std::min(m_parsers.size(), n);
+    m_failedAt.assign(m_parts, n);
+    m_errors.assign(m_parts, nullptr);
+
+    // Parts 1 to helpers go to the workers, the others to this thread.
+    startWorkers(m_parts - 1);
+    const size_t helpers = std::min(m_threads.size(), m_parts - 1);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_helpers = helpers;
+      m_pendingParts = helpers;
+      ++m_generation;
+    }
+    m_wake.notify_all();
+    for (size_t t = helpers + 1; t < m_parts; ++t)
+      parsePart(t);
+    parsePart(0);
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_idle.wait(lock, [this] { return m_pendingParts == 0; });
+    }
 
-  return ret;
-}
+    for (size_t t = 0; t < m_parts; ++t) {
+      if (m_errors[t]) {
+        try {
+          std::rethrow_exception(m_errors[t]);
+        } catch (const std::exception &e) {
+          throw std::runtime_error(
+              std::string(e.what()) + " at line " +
+              std::to_string(m_lineNumbers[m_failedAt[t]]));
+        }
+      }
+    }
+    return m_batch;
+  }
 
-template <typename Derived>
-inline JsonNode JsonParser::streamParse(JsonInputStreamBase<Derived> &is,
-                                        bool *isComplete) {
-  JsonNode ret;
+  // Calls f(JsonNode &) for each record in order, stopping early if f returns
+  // false. Returns the number of records visited.
+  template <typename F> size_t forEach(F &&f) {
+    size_t count = 0;
+    for (;;) {
+      auto &batch = nextBatch();
+      if (batch.empty())
+        return count;
+      for (auto &node : batch) {
+        ++count;
+        if constexpr (std::is_same_v<std::invoke_result_t<F &, JsonNode &>,
+                                     bool>) {
+          if (!f(node))
+            return count;
+        } else {
+          f(node);
+        }
+      }
+    }
+  }
 
-  m_nodeStack = {};
-  m_nodeStack.push(&ret);
+private:
+  static size_t parserCount(unsigned threadCount) {
+    return threadCount != 0 ? threadCount
+                            : std::max(1u, std::thread::hardware_concurrency());
+  }
 
-  if (isComplete != nullptr)
-    *isComplete = true;
-  try {
-    parseLoop(is);
-  } catch (const std::exception &) {
-    if (isComplete != nullptr)
-      *isComplete = false;
+  // Parses the lines of part t of the batch with parser t, recycling the
+  // nodes they replace into it.
+  void parsePart(size_t t) {
+    const size_t n = m_lines.size();
+    const size_t first = n * t / m_parts;
+    const size_t last = n * (t + 1) / m_parts;
+    for (size_t i = first; i < last; ++i) {
+      try {
+        m_batch[i].recycle(m_parsers[t]);
+        m_batch[i] = m_parsers[t].parse(m_lines[i]);
+      } catch (...) {
+        m_failedAt[t] = i;
+        m_errors[t] = std::current_exception();
+        return;
+      }
+    }
   }
 
-  return ret;
-}
+  // Starts workers until there are count, or as many as the system allows.
+  void startWorkers(size_t count) {
+    while (m_threads.size() < count) {
+      try {
+        const size_t index = m_threads.size();
+        m_threads.emplace_back(
+            [this, index, seen = m_generation] { runWorker(index, seen); });
+      } catch (const std::system_error &) {
+        return; // the remaining parts are parsed by the calling thread
+      }
+    }
+  }
 
-inline JsonNode JsonParser::parse(std::string_view inputView, size_t *offset) {
-  auto stringViewInputStream =
-      JsonStringViewInputStream(inputView, offset == nullptr ? 0 : *offset);
-  auto ret = parse(stringViewInputStream, offset == nullptr);
-  if (offset != nullptr)
-    *offset = stringViewInputStream.pos();
-  return ret;
-}
+  // Worker index parses part index + 1 of each batch that has one.
+  void runWorker(size_t index, size_t seen) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+      m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+      if (m_stop)
+        return;
+      seen = m_generation;
+      if (index >= m_helpers)
+        continue;
+      lock.unlock();
+      parsePart(index + 1);
+      lock.lock();
+      if (--m_pendingParts == 0)
+        m_idle.notify_one();
+    }
+  }
 
-inline JsonNode JsonParser::parse(std::ifstream &is, bool checkEnd) {
-  auto fileInputStream = JsonFileInputStream<JSON_PARSER_IO_BUFFER_SIZE>(is);
-  return parse(fileInputStream, checkEnd);
-}
+private:
+  JsonMappedFile m_file;
+  std::string m_fileCopy;
+  std::string_view m_input;
+  size_t m_pos = 0;
+  size_t m_lineNumber = 0;
+  size_t m_batchSize;
+  std::vector<JsonParser> m_parsers;
+  std::vector<std::string_view> m_lines;
+  std::vector<size_t> m_lineNumbers;
+  std::vector<JsonNode> m_batch;
+
+  // State of the current batch, see nextBatch().
+  size_t m_parts = 0;
+  std::vector<size_t> m_failedAt;
+  std::vector<std::exception_ptr> m_errors;
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_idle;
+  size_t m_generation = 0; // of the batch handed to the workers
+  size_t m_helpers = 0;
+  size_t m_pendingParts = 0;
+  bool m_stop = false;
+  std::vector<std::thread> m_threads;
+};
 
-inline JsonNode JsonParser::parse(std::istream &is, bool checkEnd) {
-  auto fileInputStream = JsonFileInputStream<1>(is);
-  return parse(fileInputStream, checkEnd);
-}
+namespace detail {
 
-inline JsonNode JsonParser::streamParse(std::string_view inputView,
-                                        size_t *offset, bool *isComplete) {
-  auto stringViewInputStream =
-      JsonStringViewInputStream(inputView, offset == nullptr ? 0 : *offset);
-  auto ret = streamParse(stringViewInputStream, isComplete);
-  if (offset != nullptr)
-    *offset = stringViewInputStream.pos();
-  return ret;
-}
+enum class JsonTapeType : uint8_t {
+  Null,
+  Bool,
+  Int,
+  Uint,
+  Double,
+  Str,
+  Key,
+  Arr,
+  Obj,
+};
 
-inline JsonNode JsonParser::streamParse(std::ifstream &is, bool *isComplete) {
-  auto fileInputStream = JsonFileInputStream<JSON_PARSER_IO_BUFFER_SIZE>(is);
-  return streamParse(fileInputStream, isComplete);
-}
+// One value of a JsonLazyDocument. Containers are followed by their
+// descendants. Objects store the index past the last one; arrays store the
+// offset of their element indices in the document's element list, which is
+// followed by the index past the last descendant. Strings point into the
+// input or, if they had to be unescaped, into the document's string buffer.
+struct JsonTapeEntry {
+  JsonTapeType ty;
+  bool copied; // string in the string buffer, val.off is an offset
+  uint32_t len; // string length or number of elements/members
+  union {
+    bool b;
+    int64_t i;
+    uint64_t u;
+    double d;
+    const char *p;
+    size_t off; // into the string buffer, or the element list for arrays
+    size_t end;
+  } val;
+};
 
-inline JsonNode JsonParser::streamParse(std::istream &is, bool *isComplete) {
-  auto fileInputStream = JsonFileInputStream<1>(is);
-  return streamParse(fileInputStream, isComplete);
-}
+class JsonTapeBuilder : public JsonSaxHandler {
+public:
+  JsonTapeBuilder(std::vector<JsonTapeEntry> &tape, std::string &strings,
+                  std::vector<size_t> &elements)
+      : m_tape(tape), m_strings(strings), m_elements(elements) {}
 
-template <typename Derived>
-inline void JsonParser::skipSpace(JsonInputStreamBase<Derived> &is) {
-  while (!is.eoi() && (is.ch() == ' ' || is.ch() == '\t' || is.ch() == '\n' ||
-                       is.ch() == '\r')) {
-    is.next();
+  bool onNull() {
+    value(JsonTapeType::Null);
+    return true;
   }
-}
+  bool onBool(bool b) {
+    value(JsonTapeType::Bool).val.b = b;
+    return true;
+  }
+  bool onInt64(int64_t i) {
+    value(JsonTapeType::Int).val.i = i;
+    return true;
+  }
+  bool onUint64(uint64_t u) {
+    value(JsonTapeType::Uint).val.u = u;
+    return true;
+  }
+  bool onDouble(double d) {
+    value(JsonTapeType::Double).val.d = d;
+    return true;
+  }
+  bool onString(std::string_view str, bool inInput) {
+    string(value(JsonTapeType::Str), str, inInput);
+    return true;
+  }
+  bool onKey(std::string_view key, bool inInput) {
+    string(entry(JsonTapeType::Key), key, inInput);
+    return true;
+  }
+  bool onStartArray() {
+    value(JsonTapeType::Arr);
+    m_stack.push_back(m_tape.size() - 1);
+    return true;
+  }
+  bool onStartObject() {
+    value(JsonTapeType::Obj);
+    m_stack.push_back(m_tape.size() - 1);
+    return true;
+  }
+  bool onEndArray() { return end(); }
+  bool onEndObject() { return end(); }
 
-template <typename Derived>
-inline void JsonParser::parseLiteral(JsonInputStreamBase<Derived> &is,
-                                     JsonNode *node) {
-  if (is.ch() == 'n') {
-    is.next();
-    if (!is.eoi() && is.get() == 'u' && !is.eoi() && is.get() == 'l' &&
-        !is.eoi() && is.get() == 'l') {
-      *node = JsonNull;
-      return;
+private:
+  JsonTapeEntry &entry(JsonTapeType ty) {
+    auto &e = m_tape.emplace_back();
+    e.ty = ty;
+    e.copied = false;
+    e.len = 0;
+    e.val.u = 0;
+    return e;
+  }
+
+  JsonTapeEntry &value(JsonTapeType ty) {
+    if (!m_stack.empty()) {
+      auto &parent = m_tape[m_stack.back()];
+      ++parent.len;
+      if (parent.ty == JsonTapeType::Arr)
+        m_items.push_back(m_tape.size());
+    }
+    return entry(ty);
+  }
+
+  void string(JsonTapeEntry &e, std::string_view str, bool inInput) {
+    if (str.size() > UINT32_MAX)
+      throw std::runtime_error(
+          getJsonErrorMsg(detail::JsonErrorCode::InvalidString));
+    e.len = static_cast<uint32_t>(str.size());
+    e.copied = !inInput;
+    if (inInput) {
+      e.val.p = str.data();
+    } else {
+      e.val.off = m_strings.size();
+      m_strings.append(str);
     }
   }
-  if (is.ch() == 't') {
-    is.next();
-    if (!is.eoi() && is.get() == 'r' && !is.eoi() && is.get() == 'u' &&
-        !is.eoi() && is.get() == 'e') {
-      *node = true;
-      return;
-    }
+
+  bool end() {
+    auto &e = m_tape[m_stack.back()];
+    if (e.ty == JsonTapeType::Arr) {
+      // The elements of the array are the last ones of the open arrays.
+      e.val.off = m_elements.size();
+      m_elements.insert(m_elements.end(), m_items.end() - e.len,
+                        m_items.end());
+      m_elements.push_back(m_tape.size());
+      m_items.resize(m_items.size() - e.len);
+    } else {
+      e.val.end = m_tape.size();
+    }
+    m_stack.pop_back();
+    return true;
+  }
+
+private:
+  std::vector<JsonTapeEntry> &m_tape;
+  std::string &m_strings;
+  std::vector<size_t> &m_elements;
+  std::vector<size_t> m_stack;
+  // Tape indices of the elements of the open arrays.
+  std::vector<size_t> m_items;
+};
+
+} // namespace detail
+
+class JsonLazyDocument;
+
+// Read-only view of a value in a JsonLazyDocument, with the accessors of a
+// const JsonNode. Nothing is decoded until a value is accessed; toNode()
+// builds a JsonNode from a subtree. Objects are searched linearly in input
+// order, the last of duplicate keys wins as in a JsonNode.
+class JsonLazyValue {
+public:
+  class iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = JsonLazyValue;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = JsonLazyValue;
+
+    JsonLazyValue operator*() const {
+      return {m_doc, m_isObj ? m_index + 1 : m_index};
+    }
+    iterator &operator++() {
+      m_index = JsonLazyValue{m_doc, m_isObj ? m_index + 1 : m_index}.next();
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator ret = *this;
+      ++*this;
+      return ret;
+    }
+    bool operator==(const iterator &other) const {
+      return m_index == other.m_index;
+    }
+    bool operator!=(const iterator &other) const {
+      return m_index != other.m_index;
+    }
+
+  private:
+    friend class JsonLazyValue;
+    iterator(const JsonLazyDocument *doc, size_t index, bool isObj)
+        : m_doc(doc), m_index(index), m_isObj(isObj) {}
+
+    const JsonLazyDocument *m_doc;
+    size_t m_index; // the element, or the key of a member
+    bool m_isObj;
+  };
+
+  JsonType type() const;
+  bool isNull() const { return type() == JsonType::Null; }
+  bool isBool() const { return type() == JsonType::Bool; }
+  bool isNum() const { return type() == JsonType::Num; }
+  bool isStr() const { return type() == JsonType::Str; }
+  bool isArr() const { return type() == JsonType::Arr; }
+  bool isObj() const { return type() == JsonType::Obj; }
+
+  // Length of a string, number of elements or members, 0 otherwise.
+  size_t size() const {
+    auto ty = entry().ty;
+    return ty == detail::JsonTapeType::Str || ty == detail::JsonTapeType::Arr ||
+                   ty == detail::JsonTapeType::Obj
+               ? entry().len
+               : 0;
+  }
+
+  JsonLazyValue operator[](size_t i) const { return at(i); }
+  JsonLazyValue at(size_t i) const {
+    require(detail::JsonTapeType::Arr);
+    if (i >= entry().len)
+      throw std::out_of_range("JsonLazyValue::at");
+    return {m_doc, element(entry(), i)};
   }
-  if (is.ch() == 'f') {
-    is.next();
-    if (!is.eoi() && is.get() == 'a' && !is.eoi() && is.get() == 'l' &&
-        !is.eoi() && is.get() == 's' && !is.eoi() && is.get() == 'e') {
-      *node = false;
-      return;
-    }
+
+  JsonLazyValue operator[](std::string_view key) const { return at(key); }
+  JsonLazyValue at(std::string_view key) const {
+    size_t index = findIndex(key);
+    if (index == 0)
+      throw std::out_of_range("JsonLazyValue::at");
+    return {m_doc, index};
   }
-  throw std::runtime_error(
-      getJsonErrorMsg(detail::JsonErrorCode::InvalidLiteral));
-}
+  bool contains(std::string_view key) const { return findIndex(key) != 0; }
 
-template <typename Derived>
-inline JsonStr_t JsonParser::parseString(JsonInputStreamBase<Derived> &is) {
-  JsonStr_t ret;
+  // Key of a value that is an object member.
+  std::string_view key() const;
 
-  while (!is.eoi() && is.ch() != '"') {
-    switch (is.ch()) {
-    case '\\':
-      is.next();
-      parseEscape(is, ret);
-      break;
-    default:
-      if (static_cast<uint8_t>(is.ch()) < 0x20u)
-        throw std::runtime_error(
-            getJsonErrorMsg(detail::JsonErrorCode::InvalidCharacter));
+  // Elements of an array, or the member values of an object (see key()).
+  iterator begin() const {
+    auto ty = entry().ty;
+    if (ty != detail::JsonTapeType::Arr && ty != detail::JsonTapeType::Obj)
+      throw std::runtime_error(
+          getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+    return {m_doc, m_index + 1, ty == detail::JsonTapeType::Obj};
+  }
+  iterator end() const {
+    return {m_doc, next(), entry().ty == detail::JsonTapeType::Obj};
+  }
 
-      parseUtf8(is, ret);
-    }
+  std::string_view str() const {
+    require(detail::JsonTapeType::Str);
+    return string(entry());
   }
 
-  if (is.eoi())
+  template <typename T> T get() const {
+    const auto &e = entry();
+    if constexpr (std::is_same_v<T, bool>) {
+      switch (e.ty) {
+      case detail::JsonTapeType::Bool:
+        return e.val.b;
+      case detail::JsonTapeType::Int:
+        return static_cast<bool>(e.val.i);
+      case detail::JsonTapeType::Uint:
+        return static_cast<bool>(e.val.u);
+      case detail::JsonTapeType::Double:
+        return static_cast<bool>(e.val.d);
+      default:
+        break;
+      }
+    } else if constexpr (std::is_arithmetic_v<T>) {
+      switch (e.ty) {
+      case detail::JsonTapeType::Int:
+        return static_cast<T>(e.val.i);
+      case detail::JsonTapeType::Uint:
+        return static_cast<T>(e.val.u);
+      case detail::JsonTapeType::Double:
+        return static_cast<T>(e.val.d);
+      default:
+        break;
+      }
+    } else if constexpr (std::is_same_v<T, std::string_view>) {
+      if (e.ty == detail::JsonTapeType::Str)
+        return string(e);
+    } else if constexpr (std::is_same_v<T, std::string>) {
+      if (e.ty == detail::JsonTapeType::Str)
+        return std::string(string(e));
+      return toNode().get<T>();
+    } else {
+      return toNode().get<T>();
+    }
     throw std::runtime_error(
-        getJsonErrorMsg(detail::JsonErrorCode::InvalidString));
+        getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+  }
 
-  is.next();
-  return ret;
-}
+  // Decodes the value and its descendants into a tree.
+  JsonNode toNode() const;
 
-template <typename Derived>
-inline void JsonParser::parseEscape(JsonInputStreamBase<Derived> &is,
-                                    JsonStr_t &ret) {
-  if (is.eoi())
-    throw std::runtime_error(
-        getJsonErrorMsg(detail::JsonErrorCode::InvalidString));
+private:
+  friend class JsonLazyDocument;
+  JsonLazyValue(const JsonLazyDocument *doc, size_t index)
+      : m_doc(doc), m_index(index) {}
 
-  switch (is.ch()) {
-  case '"':
-  case '\\':
-  case '/':
-    ret.push_back(is.ch());
-    is.next();
-    break;
-  case 'b':
-    ret.push_back('\b');
-    is.next();
-    break;
-  case 'f':
-    ret.push_back('\f');
-    is.next();
-    break;
-  case 'n':
-    ret.push_back('\n');
-    is.next();
-    break;
-  case 'r':
-    ret.push_back('\r');
-    is.next();
-    break;
-  case 't':
-    ret.push_back('\t');
-    is.next();
-    break;
-  case 'u': {
-    is.next();
-    uint32_t u = parseHex4(is);
-    if (u >= 0xD800 && u <= 0xDBFF) {
-      if (is.eoi() || is.get() != '\\')
-        throw std::runtime_error(
-            getJsonErrorMsg(detail::JsonErrorCode::InvalidUnicode));
+  const detail::JsonTapeEntry &entry() const;
+  std::string_view string(const detail::JsonTapeEntry &) const;
 
-      if (is.eoi() || is.get() != 'u')
-        throw std::runtime_error(
-            getJsonErrorMsg(detail::JsonErrorCode::InvalidUnicode));
+  // Index of the i-th element of an array, or of the entry past its last
+  // descendant for i == len.
+  size_t element(const detail::JsonTapeEntry &e, size_t i) const;
 
-      uint32_t u2 = parseHex4(is);
-      if (u2 < 0xDC00 || u2 > 0xDFFF)
-        throw std::runtime_error(
-            getJsonErrorMsg(detail::JsonErrorCode::InvalidUnicode));
+  // Index past the last descendant of a container.
+  size_t containerEnd(const detail::JsonTapeEntry &e) const {
+    return e.ty == detail::JsonTapeType::Arr ? element(e, e.len) : e.val.end;
+  }
 
-      u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
-    }
-    encodeUtf8(ret, u);
-  } break;
-  default:
-    throw std::runtime_error(
-        getJsonErrorMsg(detail::JsonErrorCode::InvalidEscapeSequence));
+  // Index of the next sibling.
+  size_t next() const {
+    const auto &e = entry();
+    return e.ty == detail::JsonTapeType::Arr || e.ty == detail::JsonTapeType::Obj
+               ? containerEnd(e)
+               : m_index + 1;
   }
-}
 
-template <typename Derived>
-inline uint32_t JsonParser::parseHex4(JsonInputStreamBase<Derived> &is) {
-  uint32_t u = 0;
-  for (int i = 0; i < 4; ++i) {
-    if (is.eoi())
+  void require(detail::JsonTapeType ty) const {
+    if (entry().ty != ty)
       throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidString));
+          getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+  }
 
-    char c = is.get();
-    u <<= 4;
-    if (c >= '0' && c <= '9') {
-      u |= c - '0';
-    } else if (c >= 'a' && c <= 'f') {
-      u |= c - 'a' + 10;
-    } else if (c >= 'A' && c <= 'F') {
-      u |= c - 'A' + 10;
-    } else {
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidUnicode));
-    }
+  // Index of the value of the last member named key, 0 if there is none.
+  size_t findIndex(std::string_view key) const;
+
+private:
+  const JsonLazyDocument *m_doc;
+  size_t m_index;
+};
+
+// Validates a document in one pass and records its values on a tape instead
+// of building a tree; see JsonLazyValue. The input must outlive the document
+// unless it is a file parsed by parseFile(). Strings with escape sequences are
+// unescaped during the pass, everything else is referenced in place.
+class JsonLazyDocument {
+public:
+  JsonLazyDocument() = default;
+  explicit JsonLazyDocument(std::string_view input) { parse(input); }
+
+  JsonLazyDocument(const JsonLazyDocument &) = delete;
+  JsonLazyDocument &operator=(const JsonLazyDocument &) = delete;
+  JsonLazyDocument(JsonLazyDocument &&) = default;
+  JsonLazyDocument &operator=(JsonLazyDocument &&) = default;
+
+  void parse(std::string_view input) {
+    clear();
+    // Scalars take about one entry per 8 bytes of typical input.
+    m_tape.reserve(input.size() / 8 + 1);
+    build(input);
   }
-  return u;
-}
 
-template <typename Derived>
-inline void JsonParser::parseUtf8(JsonInputStreamBase<Derived> &is,
-                                  JsonStr_t &ret) {
-  uint8_t u = static_cast<uint8_t>(is.ch()), byteCount = 0;
-  if ((u <= 0x7F))
-    byteCount = 1;
-  else if ((u >= 0xC0) && (u <= 0xDF))
-    byteCount = 2;
-  else if ((u >= 0xE0) && (u <= 0xEF))
-    byteCount = 3;
-  else if ((u >= 0xF0) && (u <= 0xF7))
-    byteCount = 4;
-  else
-    throw std::runtime_error(
-        getJsonErrorMsg(detail::JsonErrorCode::InvalidCharacter));
+  void parseFile(const std::filesystem::path &filename) {
+    clear();
+    m_file = JsonMappedFile(filename);
+    if (!m_file.isOpen()) {
+      std::ifstream ifs(filename, std::ios::binary);
+      m_fileCopy.assign(std::istreambuf_iterator<char>(ifs),
+                        std::istreambuf_iterator<char>());
+    }
+    auto input = m_file.isOpen()
+                     ? m_file.view()
+                     : std::string_view(m_fileCopy.data(), m_fileCopy.size());
+    build(input);
+  }
 
-  ret.push_back(is.get());
-  while (byteCount-- > 1) {
-    u = static_cast<uint8_t>(is.ch());
-    if ((u >= 0x80) && (u <= 0xBF))
-      ret.push_back(is.get());
-    else
+  // Values refer to the document and are invalidated by parse() and clear().
+  JsonLazyValue root() const {
+    if (m_tape.empty())
       throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidCharacter));
+          getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+    return {this, 0};
   }
-}
 
-inline void JsonParser::encodeUtf8(JsonStr_t &ret, uint32_t u) {
-  if (u <= 0x7F)
-    ret.push_back(u & 0xFF);
-  else if (u <= 0x7FF) {
-    ret.push_back(0xC0 | ((u >> 6) & 0xFF));
-    ret.push_back(0x80 | (u & 0x3F));
-  } else if (u <= 0xFFFF) {
-    ret.push_back(0xE0 | ((u >> 12) & 0xFF));
-    ret.push_back(0x80 | ((u >> 6) & 0x3F));
-    ret.push_back(0x80 | (u & 0x3F));
-  } else {
-    ret.push_back(0xF0 | ((u >> 18) & 0xFF));
-    ret.push_back(0x80 | ((u >> 12) & 0x3F));
-    ret.push_back(0x80 | ((u >> 6) & 0x3F));
-    ret.push_back(0x80 | (u & 0x3F));
+  JsonLazyValue operator[](size_t i) const { return root()[i]; }
+  JsonLazyValue operator[](std::string_view key) const { return root()[key]; }
+
+  void clear() {
+    m_tape.clear();
+    m_strings.clear();
+    m_elements.clear();
+    m_file.close();
+    m_fileCopy.clear();
   }
-}
 
-template <typename Derived>
-inline JsonStr_t
-JsonParser::parseKeyWithColon(JsonInputStreamBase<Derived> &is) {
-  auto key = parseString(is);
-  skipSpace(is);
-  if (is.eoi() || is.get() != ':')
-    throw std::runtime_error(
-        getJsonErrorMsg(detail::JsonErrorCode::InvalidKeyValuePair));
+private:
+  friend class JsonLazyValue;
+
+  // Leaves the document empty if the input is invalid.
+  void build(std::string_view input) {
+    detail::JsonTapeBuilder builder(m_tape, m_strings, m_elements);
+    try {
+      JsonParser{}.saxParse(input, builder);
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
 
-  return key;
-}
+  std::vector<detail::JsonTapeEntry> m_tape;
+  std::string m_strings;
+  // Tape indices of the elements of each array, see JsonTapeEntry.
+  std::vector<size_t> m_elements;
+  JsonMappedFile m_file;
+  std::vector<char> m_fileCopy;
+};
 
-template <typename Derived>
-inline void JsonParser::beginArray(JsonInputStreamBase<Derived> &is) {
-  auto *node = m_nodeStack.top();
-  *node = JsonArr_t{};
+inline const detail::JsonTapeEntry &JsonLazyValue::entry() const {
+  return m_doc->m_tape[m_index];
+}
 
-  skipSpace(is);
-  if (is.eoi())
-    throw std::runtime_error(
-        getJsonErrorMsg(detail::JsonErrorCode::UnexpectedEndOfInput));
+inline size_t JsonLazyValue::element(const detail::JsonTapeEntry &e,
+                                     size_t i) const {
+  return m_doc->m_elements[e.val.off + i];
+}
 
-  if (is.ch() == ']') {
-    is.next();
-    popStack();
-  } else {
-    m_nodeStack.push(&(node->val_.a->emplace_back()));
-  }
+inline std::string_view
+JsonLazyValue::string(const detail::JsonTapeEntry &e) const {
+  return e.copied ? std::string_view(m_doc->m_strings.data() + e.val.off, e.len)
+                  : std::string_view(e.val.p, e.len);
 }
 
-template <typename Derived>
-inline void JsonParser::beginObject(JsonInputStreamBase<Derived> &is) {
-  auto *node = m_nodeStack.top();
-  *node = JsonObj_t{};
+inline JsonType JsonLazyValue::type() const {
+  constexpr JsonType types[]{JsonType::Null, JsonType::Bool, JsonType::Num,
+                             JsonType::Num,  JsonType::Num,  JsonType::Str,
+                             JsonType::Str,  JsonType::Arr,  JsonType::Obj};
+  return types[static_cast<uint8_t>(entry().ty)];
+}
 
-  skipSpace(is);
-  if (is.eoi())
+inline std::string_view JsonLazyValue::key() const {
+  if (m_index == 0 || m_doc->m_tape[m_index - 1].ty != detail::JsonTapeType::Key)
     throw std::runtime_error(
-        getJsonErrorMsg(detail::JsonErrorCode::UnexpectedEndOfInput));
-
-  if (is.ch() == '}') {
-    is.next();
-    popStack();
-  } else {
-    if (is.get() != '"')
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidKeyValuePair));
+        getJsonErrorMsg(detail::JsonErrorCode::InvalidJsonAccess));
+  return string(m_doc->m_tape[m_index - 1]);
+}
 
-    auto key = parseKeyWithColon(is);
-    m_nodeStack.push(
-        &(node->val_.o->emplace(std::move(key), JsonNode{}).first->second));
+inline size_t JsonLazyValue::findIndex(std::string_view key) const {
+  require(detail::JsonTapeType::Obj);
+  size_t found = 0;
+  const auto &tape = m_doc->m_tape;
+  for (size_t i = m_index + 1, end = entry().val.end; i < end;) {
+    if (string(tape[i]) == key)
+      found = i + 1;
+    i = JsonLazyValue{m_doc, i + 1}.next();
   }
+  return found;
 }
 
-template <typename Derived>
-inline void JsonParser::handleComma(JsonInputStreamBase<Derived> &is) {
-  auto *node = m_nodeStack.top();
-  if (node->ty_ == JsonNode::ArrType_) {
-    m_nodeStack.push(&node->val_.a->emplace_back());
-  } else if (node->ty_ == JsonNode::ObjType_) {
-    skipSpace(is);
-    if (is.eoi() || is.get() != '"')
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::UnexpectedEndOfInput));
+inline JsonNode JsonLazyValue::toNode() const {
+  // Replays the subtree as parse events.
+  JsonNode ret;
+  JsonParser::DomBuilder builder(ret, nullptr, false);
+  const auto &tape = m_doc->m_tape;
+  // End indices of the open containers, true for objects.
+  std::vector<std::pair<size_t, bool>> open;
+  for (size_t i = m_index, last = next();;) {
+    for (; !open.empty() && open.back().first == i; open.pop_back()) {
+      if (open.back().second)
+        builder.onEndObject();
+      else
+        builder.onEndArray();
+    }
+    if (i == last)
+      return ret;
 
-    auto key = parseKeyWithColon(is);
-    m_nodeStack.push(
-        &(node->val_.o->emplace(std::move(key), JsonNode{}).first->second));
-  } else {
-    throw std::runtime_error(
-        getJsonErrorMsg(detail::JsonErrorCode::InvalidArrayOrObject));
+    const auto &e = tape[i++];
+    switch (e.ty) {
+    case detail::JsonTapeType::Null:
+      builder.onNull();
+      break;
+    case detail::JsonTapeType::Bool:
+      builder.onBool(e.val.b);
+      break;
+    case detail::JsonTapeType::Int:
+      builder.onInt64(e.val.i);
+      break;
+    case detail::JsonTapeType::Uint:
+      builder.onUint64(e.val.u);
+      break;
+    case detail::JsonTapeType::Double:
+      builder.onDouble(e.val.d);
+      break;
+    case detail::JsonTapeType::Str:
+      builder.onString(string(e), false);
+      break;
+    case detail::JsonTapeType::Key:
+      builder.onKey(string(e));
+      break;
+    case detail::JsonTapeType::Arr:
+      builder.onStartArray();
+      open.emplace_back(containerEnd(e), false);
+      break;
+    case detail::JsonTapeType::Obj:
+      builder.onStartObject();
+      open.emplace_back(e.val.end, true);
+      break;
+    }
   }
 }
 
-template <typename Derived>
-inline void JsonParser::parseNumber(JsonInputStreamBase<Derived> &is,
-                                    JsonNode *node) {
-  std::string numStr;
-
-  bool isSigned = false;
-  bool isFloatingPoint = false;
-
-  enum class NumType { DBL, INT, UINT } numType{};
-
-  if (is.ch() == '-') {
-    isSigned = true;
-    numStr.push_back(is.get());
-  }
-  if (is.eoi())
-    throw std::runtime_error(
-        getJsonErrorMsg(detail::JsonErrorCode::InvalidNumber));
-  if (is.ch() == '0') {
-    numStr.push_back(is.get());
-  } else {
-    if (!std::isdigit(is.ch()))
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidNumber));
-    while (!is.eoi() && std::isdigit(is.ch()))
-      numStr.push_back(is.get());
-  }
-  if (!is.eoi() && is.ch() == '.') {
-    isFloatingPoint = true;
-    numStr.push_back(is.get());
-    if (is.eoi() || !std::isdigit(is.ch()))
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidNumber));
-    while (!is.eoi() && std::isdigit(is.ch()))
-      numStr.push_back(is.get());
-  }
-  if (!is.eoi() && (is.ch() == 'e' || is.ch() == 'E')) {
-    isFloatingPoint = true;
-    numStr.push_back(is.get());
-    if (is.eoi())
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidNumber));
-    if (is.ch() == '+' || is.ch() == '-')
-      numStr.push_back(is.get());
-    if (is.eoi() || !std::isdigit(is.ch()))
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidNumber));
-    while (!is.eoi() && std::isdigit(is.ch()))
-      numStr.push_back(is.get());
-  }
-
-  if (isFloatingPoint) {
-    numType = NumType::DBL;
-  } else if (isSigned) {
-    constexpr std::string_view maxSignedIntStr = "9223372036854775808"; // 2^63
-    size_t unsignedLen = numStr.size() - 1;
-    bool overflow = false;
-    if (unsignedLen == maxSignedIntStr.size())
-      for (size_t i = 0; i < maxSignedIntStr.size(); ++i) {
-        if (numStr[i + 1] == maxSignedIntStr[i])
-          continue;
-        overflow = numStr[i + 1] > maxSignedIntStr[i];
-        break;
-      }
-    else
-      overflow = unsignedLen > maxSignedIntStr.size();
-    numType = overflow ? NumType::DBL : NumType::INT;
-  } else {
-    constexpr std::string_view maxUnsignedIntStr =
-        "18446744073709551615"; // 2^64 - 1
-    bool overflow = false;
-    if (numStr.size() == maxUnsignedIntStr.size())
-      for (size_t i = 0; i < maxUnsignedIntStr.size(); ++i) {
-        if (numStr[i] == maxUnsignedIntStr[i])
-          continue;
-        overflow = numStr[i] > maxUnsignedIntStr[i];
-        break;
-      }
-    else
-      overflow = numStr.size() > maxUnsignedIntStr.size();
-    numType = overflow ? NumType::DBL : NumType::UINT;
-  }
+inline JsonDocument parseJsonDocument(std::string_view inputView,
+                                      size_t *offset = nullptr) {
+  return JsonDocument(inputView, offset);
+}
 
-  switch (numType) {
-  case NumType::DBL: {
-    double num = std::strtod(numStr.c_str(), nullptr);
-    if (std::isinf(num))
-      throw std::runtime_error(
-          getJsonErrorMsg(detail::JsonErrorCode::InvalidNumber));
-    *node = num;
-  } break;
-  case NumType::INT: {
-    int64_t num{};
-    for (size_t i = 1; i < numStr.size(); ++i)
-      num = num * 10 - (numStr[i] - '0');
-    *node = num;
-  } break;
-  case NumType::UINT: {
-    uint64_t num{};
-    for (size_t i = 0; i < numStr.size(); ++i)
-      num = num * 10 + (numStr[i] - '0');
-    *node = num;
-  } break;
-  }
+inline JsonDocument parseJsonDocumentFile(const std::filesystem::path &filename,
+                                          bool borrowStrings = false) {
+  JsonDocument doc;
+  doc.borrowStrings(borrowStrings).parseFile(filename);
+  return doc;
 }
 
 inline JsonNode parseJsonString(std::string_view inputView,
@@ -2048,6 +8627,9 @@ inline JsonNode parseJsonString(std::string_view inputView,
 
 inline JsonNode parseJsonFile(const std::filesystem::path &filename,
                               bool checkEnd = true) {
+  JsonMappedFile file(filename);
+  if (file.isOpen())
+    return JsonParser{}.parse(file, checkEnd);
   std::ifstream ifs(filename);
   return JsonParser{}.parse(ifs, checkEnd);
 }
@@ -2064,6 +8646,9 @@ inline JsonNode parseStreamJsonString(std::string_view inputView,
 
 inline JsonNode parseStreamJsonFile(const std::filesystem::path &filename,
                                     bool *isComplete = nullptr) {
+  JsonMappedFile file(filename);
+  if (file.isOpen())
+    return JsonParser{}.streamParse(file, isComplete);
   std::ifstream ifs(filename);
   return JsonParser{}.streamParse(ifs, isComplete);
 }
@@ -2083,6 +8668,144 @@ inline std::istream &operator>>(std::istream &is, JsonNode &node) {
   return is;
 }
 
+template <typename Derived>
+JsonNode::Serializer &
+JsonNode::Serializer::dumpParallel(JsonOutputStreamBase<Derived> &os,
+                                   unsigned threadCount) {
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  const bool isArr = m_node.isArr();
+  const size_t n = m_node.size();
+  if (threadCount < 2 || !(isArr || m_node.isObj()) || n < 2)
+    return dump(os);
+
+  auto element = [&](size_t i) -> const JsonNode & {
+    return isArr ? (*m_node.val_.a)[i] : m_node.val_.o->cbegin()[i].second;
+  };
+
+  // Chunks are sized from the estimated size of the first elements.
+  const size_t sampleCount = std::min<size_t>(n, 64);
+  size_t sampleSize = 0;
+  for (size_t i = 0; i < sampleCount; ++i)
+    sampleSize += Serializer(element(i), *this, m_depth + 1).estimateSize();
+  const size_t elementSize = sampleSize / sampleCount + 1;
+  if (elementSize * n < ParallelMinSize)
+    return dump(os);
+  const size_t perChunk = std::max<size_t>(1, ParallelChunkSize / elementSize);
+  const size_t chunkCount = (n + perChunk - 1) / perChunk;
+  if (chunkCount < 2)
+    return dump(os);
+
+  const bool formatted = (m_indent != -1);
+  auto render = [&](size_t c, std::string &text) {
+    JsonStringOutputStream out(text, ParallelChunkSize);
+    for (size_t i = c * perChunk; i < n && i < (c + 1) * perChunk; ++i) {
+      if (i != 0)
+        out.put(',');
+      if (formatted) {
+        out.put('\n');
+        out.put(' ', m_indent * (m_depth + 1));
+      }
+      if (!isArr) {
+        out.put('"');
+        dumpJsonString(out, m_node.val_.o->cbegin()[i].first, m_ascii);
+        out.puts("\":", 2);
+        if (formatted)
+          out.put(' ');
+      }
+      Serializer(element(i), *this, m_depth + 1).dump(out);
+    }
+  };
+
+  // Workers render chunks up to `window` ahead of the one written next.
+  const size_t window = static_cast<size_t>(threadCount) * 4;
+  std::vector<std::string> texts(chunkCount);
+  std::vector<char> ready(chunkCount, 0);
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t next = 0;
+  size_t written = 0;
+  bool stop = false;
+  std::exception_ptr error;
+
+  auto canClaim = [&] { return next < chunkCount && next < written + window; };
+  auto work = [&](std::unique_lock<std::mutex> &lock) {
+    const size_t c = next++;
+    lock.unlock();
+    try {
+      render(c, texts[c]);
+      lock.lock();
+      ready[c] = 1;
+    } catch (...) {
+      lock.lock();
+      if (!error)
+        error = std::current_exception();
+      stop = true;
+    }
+    cv.notify_all();
+  };
+  auto worker = [&] {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cv.wait(lock, [&] { return stop || next == chunkCount || canClaim(); });
+      if (stop || next == chunkCount)
+        return;
+      work(lock);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < threadCount && t < chunkCount; ++t) {
+    try {
+      threads.emplace_back(worker);
+    } catch (const std::system_error &) {
+      break; // the remaining chunks are rendered by this thread
+    }
+  }
+  auto join = [&] {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    cv.notify_all();
+    for (auto &t : threads)
+      t.join();
+  };
+
+  // This thread writes the chunks in order, rendering some while it waits.
+  try {
+    os.put(isArr ? '[' : '{');
+    std::unique_lock<std::mutex> lock(mutex);
+    while (written < chunkCount && !stop) {
+      if (ready[written]) {
+        std::string text = std::move(texts[written]);
+        lock.unlock();
+        os.puts(text.data(), text.size());
+        lock.lock();
+        ++written;
+        cv.notify_all();
+      } else if (canClaim()) {
+        work(lock);
+      } else {
+        cv.wait(lock);
+      }
+    }
+  } catch (...) {
+    join();
+    throw;
+  }
+  join();
+  if (error)
+    std::rethrow_exception(error);
+
+  if (formatted) {
+    os.put('\n');
+    os.put(' ', m_indent * m_depth);
+  }
+  os.put(isArr ? ']' : '}');
+  return *this;
+}
+
 inline std::ostream &operator<<(std::ostream &os, const JsonNode &node) {
   JsonNode::JsonFileOutputStream fout(os);
   node.serializer().dump(fout);
@@ -0,0 +1,277 @@
+#include "JsonParser.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
+// Counts heap use during one extra, untimed run of each operation. Every
+// block carries its size in a header that keeps max_align_t alignment.
+namespace {
+constexpr size_t HeaderSize = alignof(std::max_align_t);
+std::atomic<bool> counting{false};
+std::atomic<size_t> allocCount{0}, freeCount{0}, allocBytes{0};
+std::atomic<size_t> liveBytes{0}, peakBytes{0};
+
+void *allocate(size_t n) {
+  void *p = std::malloc(n + HeaderSize);
+  if (!p)
+    throw std::bad_alloc();
+  *static_cast<size_t *>(p) = n;
+  if (counting.load(std::memory_order_relaxed)) {
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(n, std::memory_order_relaxed);
+    size_t live = liveBytes.fetch_add(n, std::memory_order_relaxed) + n;
+    size_t peak = peakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !peakBytes.compare_exchange_weak(
+                              peak, live, std::memory_order_relaxed))
+      ;
+  }
+  return static_cast<char *>(p) + HeaderSize;
+}
+
+void deallocate(void *p) {
+  if (!p)
+    return;
+  p = static_cast<char *>(p) - HeaderSize;
+  if (counting.load(std::memory_order_relaxed)) {
+    freeCount.fetch_add(1, std::memory_order_relaxed);
+    liveBytes.fetch_sub(*static_cast<size_t *>(p), std::memory_order_relaxed);
+  }
+  std::free(p);
+}
+} // namespace
+
+void *operator new(size_t n) { return allocate(n); }
+void *operator new[](size_t n) { return allocate(n); }
+void operator delete(void *p) noexcept { deallocate(p); }
+void operator delete[](void *p) noexcept { deallocate(p); }
+void operator delete(void *p, size_t) noexcept { deallocate(p); }
+void operator delete[](void *p, size_t) noexcept { deallocate(p); }
+
+namespace {
+struct Result {
+  size_t iterations = 0;
+  double medianNs = 0, minNs = 0;
+  size_t allocs = 0, frees = 0, allocBytes = 0, peakBytes = 0;
+};
+
+long maxRssKb() {
+#ifdef __unix__
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+#else
+  return -1;
+#endif
+}
+
+// Times op, after setup if given, until minTime has passed and at least
+// five runs were made, then runs it once more to count allocations.
+Result measure(const std::function<void()> &op,
+               const std::function<void()> &setup,
+               std::chrono::milliseconds minTime) {
+  using Clock = std::chrono::steady_clock;
+  std::vector<double> times;
+  auto begin = Clock::now();
+  while (times.size() < 5 || Clock::now() - begin < minTime) {
+    if (setup)
+      setup();
+    auto t = Clock::now();
+    op();
+    times.push_back(
+        std::chrono::duration<double, std::nano>(Clock::now() - t).count());
+  }
+  Result r;
+  r.iterations = times.size();
+  std::sort(times.begin(), times.end());
+  r.medianNs = times[times.size() / 2];
+  r.minNs = times.front();
+
+  if (setup)
+    setup();
+  allocCount = freeCount = allocBytes = liveBytes = peakBytes = 0;
+  counting = true;
+  op();
+  counting = false;
+  r.allocs = allocCount;
+  r.frees = freeCount;
+  r.allocBytes = allocBytes;
+  r.peakBytes = peakBytes;
+  return r;
+}
+
+// Makes every container of json private, which copies a shared tree in full.
+// Iterative, so deep documents do not overflow the stack.
+void unshareAll(JsonNode &json) {
+  std::vector<JsonNode *> stack{&json};
+  while (!stack.empty()) {
+    JsonNode *node = stack.back();
+    stack.pop_back();
+    if (node->isArr()) {
+      for (JsonNode &e : node->arr())
+        stack.push_back(&e);
+    } else if (node->isObj()) {
+      for (auto &member : node->obj())
+        stack.push_back(&member.second);
+    }
+  }
+}
+
+struct NullBuf : std::streambuf {
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char *, std::streamsize n) override {
+    return n;
+  }
+};
+
+bool isJsonLines(const std::filesystem::path &path) {
+  return path.extension() == ".ndjson" || path.extension() == ".jsonl";
+}
+
+void report(std::string_view file, std::string_view op, size_t bytes,
+            const Result &r) {
+  JsonNode row = {{"file"_key, file},
+                  {"op"_key, op},
+                  {"bytes"_key, bytes},
+                  {"iterations"_key, r.iterations},
+                  {"ns_per_op"_key, r.medianNs},
+                  {"min_ns_per_op"_key, r.minNs},
+                  {"mb_per_s"_key, bytes / r.medianNs * 1e3},
+                  {"allocs_per_op"_key, r.allocs},
+                  {"frees_per_op"_key, r.frees},
+                  {"alloc_bytes_per_op"_key, r.allocBytes},
+                  {"peak_heap_bytes"_key, r.peakBytes},
+                  {"max_rss_kb"_key, maxRssKb()}};
+  std::cout << row.serializer().precision(6) << std::endl;
+}
+
+volatile size_t sink;
+} // namespace
+
+// Usage: bench [--min-time=MS] FILE...
+// Prints one JSON object per operation and file. Files ending in .ndjson or
+// .jsonl are read as JSON lines; the tree operations then run on an array of
+// all the lines. Objects built key by key through operator[] are measured on
+// generated keys after the files.
+int main(int argc, char **argv) {
+  std::chrono::milliseconds minTime(500);
+  std::vector<std::filesystem::path> files;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg = argv[i];
+    if (arg.rfind("--min-time=", 0) == 0)
+      minTime = std::chrono::milliseconds(std::atol(argv[i] + 11));
+    else
+      files.emplace_back(arg);
+  }
+  if (files.empty()) {
+    std::cerr << "Usage: " << argv[0] << " [--min-time=MS] FILE...\n";
+    return 1;
+  }
+
+  for (const auto &path : files) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+      std::cerr << "Cannot open " << path << '\n';
+      return 1;
+    }
+    const std::string text(std::istreambuf_iterator<char>(ifs), {});
+    const bool lines = isJsonLines(path);
+
+    auto run = [&](std::string_view op, size_t bytes,
+                   const std::function<void()> &f,
+                   const std::function<void()> &setup = {}) {
+      report(path.filename().string(), op, bytes,
+             measure(f, setup, minTime));
+    };
+
+    JsonNode json;
+    if (lines) {
+      run("streamParse", text.size(), [&] {
+        JsonParser parser;
+        size_t count = 0, offset = 0;
+        bool complete = true;
+        while (offset < text.size() && complete)
+          count += parser.streamParse(text, &offset, &complete).size();
+        sink = count;
+      });
+      run("JsonLinesReader", text.size(), [&] {
+        JsonLinesReader reader(text);
+        sink = reader.forEach([](JsonNode &) {});
+      });
+      JsonLinesReader reader(text);
+      json = JsonArr_t{};
+      reader.forEach([&](JsonNode &value) { json.push_back(value); });
+    } else {
+      // The previous result is dropped by setup, outside the timed run.
+      auto drop = [&] { json = JsonNode{}; };
+      run(
+          "parseJsonString", text.size(), [&] { json = parseJsonString(text); },
+          drop);
+      run(
+          "parseJsonFile", text.size(), [&] { json = parseJsonFile(path); },
+          drop);
+      run(
+          "streamParse", text.size(),
+          [&] { json = parseStreamJsonString(text); }, drop);
+    }
+
+    const size_t outSize = json.serializer().dumps().size();
+    run("dumps", outSize, [&] { sink = json.serializer().dumps().size(); });
+    NullBuf nullBuf;
+    std::ostream null(&nullBuf);
+    run("dump", outSize, [&] {
+      JsonNode::JsonFileOutputStream os(null);
+      json.serializer().dump(os);
+    });
+    run("copy", text.size(), [&] {
+      JsonNode copy = json;
+      sink = copy.size();
+    });
+    // The previous copy is destroyed by setup, "destroy" times that part.
+    JsonNode copy;
+    run(
+        "deepCopy", text.size(),
+        [&] {
+          copy = json;
+          unshareAll(copy);
+          sink = copy.size();
+        },
+        [&] { copy = JsonNode{}; });
+    JsonNode victim;
+    run(
+        "destroy", text.size(), [&] { victim = JsonNode{}; },
+        [&] {
+          victim = json;
+          unshareAll(victim);
+        });
+  }
+
+  // Keys in an order unrelated to the sorted one, read once at the end so
+  // that the time includes ordering the members.
+  for (size_t n : {size_t(20000), size_t(200000)}) {
+    std::vector<std::string> keys(n);
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; ++i)
+      bytes += (keys[i] = "key" + std::to_string(i * 7919 % n)).size();
+    JsonNode obj;
+    report(
+        "objectKeys" + std::to_string(n), "buildObject", bytes,
+        measure(
+            [&] {
+              for (const auto &key : keys)
+                obj[key] = 1;
+              sink = std::as_const(obj).contains(keys[0]);
+            },
+            [&] { obj = JsonNode{}; }, minTime));
+  }
+}
@@ -1,10 +1,1057 @@
 #include "JsonParser.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <new>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
 
-int main() {
+// Counts heap allocations, for checks that a loop stops allocating.
+namespace {
+std::atomic<size_t> allocations{0};
+
+void *allocate(size_t n) {
+  ++allocations;
+  if (void *p = std::malloc(n == 0 ? 1 : n))
+    return p;
+  throw std::bad_alloc();
+}
+
+void deallocate(void *p) { std::free(p); }
+} // namespace
+
+void *operator new(size_t n) { return allocate(n); }
+void *operator new[](size_t n) { return allocate(n); }
+void *operator new(size_t n, const std::nothrow_t &) noexcept {
+  try {
+    return allocate(n);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+void *operator new[](size_t n, const std::nothrow_t &) noexcept {
+  return operator new(n, std::nothrow);
+}
+void operator delete(void *p) noexcept { deallocate(p); }
+void operator delete[](void *p) noexcept { deallocate(p); }
+void operator delete(void *p, size_t) noexcept { deallocate(p); }
+void operator delete[](void *p, size_t) noexcept { deallocate(p); }
+
+static int totalChecks = 0;
+static int passedChecks = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    ++totalChecks;                                                             \
+    if (cond)                                                                  \
+      ++passedChecks;                                                          \
+    else                                                                       \
+      std::cerr << "Check failed at line " << __LINE__ << ": " #cond "\n";     \
+  } while (0)
+
+// Trees parsed into a document's arena: copies outlive the document, moves and
+// mutation keep it valid, and parsing again reuses the arena.
+static void testDocument() {
+  const std::string input = R"({"id":42,"n":{"x":[1,2,3]},)"
+                            R"("name":"a string longer than a short key",)"
+                            R"("tags":["a","b"]})";
+  JsonNode copy;
+  {
+    JsonDocument doc(input);
+    CHECK(doc.root()["tags"][1].str() == "b");
+    copy = doc.root();
+    JsonDocument moved(std::move(doc));
+    moved.mutableRoot()["name"] = std::string(100, 'x');
+    moved.mutableRoot()["n"]["x"][0] = "now on the heap, not in the arena";
+    CHECK(moved.root()["name"].str().size() == 100);
+  }
+  CHECK(copy.serializer().dumps() == input);
+
+  JsonDocument doc;
+  doc.borrowStrings(true).parse(input);
+  const std::string_view name = doc.root()["name"].get<std::string_view>();
+  CHECK(name.data() > input.data() &&
+        name.data() < input.data() + input.size());
+  const size_t capacity = doc.arena().capacity();
+  for (int i = 0; i < 10; ++i)
+    doc.parse(input);
+  CHECK(doc.arena().capacity() == capacity &&
+        doc.root().serializer().dumps() == input);
+}
+
+// Copies must not see writes through references taken before the copy.
+static void testCopyOnWrite() {
+  JsonNode root = parseJsonString(R"({"a":1,"b":[1,2],"c":{"d":[1]}})");
+  JsonNode snap = root;
+  root["a"] = 5;
+  CHECK(snap["a"].get<int>() == 1);
+  CHECK(root["a"].get<int>() == 5);
+
+  JsonArr_t &b = root["b"].arr();
+  JsonNode snap2 = root["b"];
+  b.push_back(3);
+  CHECK(snap2.size() == 2);
+  CHECK(root["b"].size() == 3);
+
+  JsonNode snap3 = root;
+  root["c"]["d"].push_back(2);
+  CHECK(snap3["c"]["d"].size() == 1);
+
+  auto it = root.find("a");
+  JsonNode snap4 = root;
+  it->second = 6;
+  CHECK(snap4["a"].get<int>() == 5);
+
+  // Unpinned containers are still shared, and unshared on write.
+  JsonNode base = parseJsonString(R"({"x":[1,2,3]})");
+  JsonNode copy = base;
+  copy["x"].push_back(4);
+  CHECK(base.serializer().dumps() == R"({"x":[1,2,3]})");
+  CHECK(copy.serializer().dumps() == R"({"x":[1,2,3,4]})");
+
+  // Non-const reads do not pin, copies made after them stay O(1).
+  JsonNode config;
+  for (int i = 0; i < 100; ++i)
+    config["key" + std::to_string(i)]["v"].push_back(i);
+  CHECK(config["key5"]["v"][0].get<int>() == 5);
+  CHECK(config.at("key7").at("v").at(0).get<int>() == 7);
+  const size_t before = allocations;
+  JsonNode perRequest = config;
+  CHECK(allocations == before);
+  perRequest["key5"]["v"][0] = 0;
+  CHECK(config["key5"]["v"][0].get<int>() == 5);
+}
+
+// The reclaimer takes trees and documents from any thread, and drain() waits
+// until all of them are freed, trees before the documents they live in.
+static void testReclaimer() {
+  const std::string input = R"({"items":[{"name":"a string on the heap"},)"
+                            R"({"name":"another string on the heap"}]})";
+  JsonReclaimer reclaimer;
+  const JsonNode kept = parseJsonString(input);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 100; ++i) {
+        JsonNode copy = kept;
+        copy["items"][0]["name"] = "changed";
+        reclaimer.retire(std::move(copy));
+        JsonDocument doc(input);
+        JsonNode moved = std::move(doc.mutableRoot()["items"]);
+        reclaimer.retire(std::move(moved));
+        reclaimer.retire(std::move(doc));
+      }
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+  reclaimer.drain();
+  CHECK(reclaimer.pending() == 0 && kept.serializer().dumps() == input);
+
+  JsonNode scalar = 1;
+  JsonNode tree = parseJsonString(input);
+  reclaimer.retire(std::move(scalar));
+  CHECK(reclaimer.pending() == 0 && scalar.isNull());
+  reclaimer.retire(std::move(tree));
+  reclaimer.drain();
+  CHECK(tree.isNull() && reclaimer.pending() == 0);
+}
+
+// Parsing into recycled storage stops allocating, long strings included.
+static void testRecycle() {
+  const std::string msg =
+      R"({"id":12,"name":"a name longer than inline","tags":["first tag )"
+      R"(here","second tag here"],"note":"some\nescaped text here"})";
+  JsonParser parser;
+  size_t last = 0;
+  for (int i = 0; i < 4; ++i) {
+    size_t before = allocations;
+    JsonNode json = parser.parse(msg);
+    last = allocations - before;
+    CHECK(json["tags"][1].str() == "second tag here");
+    CHECK(json["note"].str() == "some\nescaped text here");
+    json.recycle(parser);
+    CHECK(json.isNull());
+  }
+  CHECK(last == 0);
+}
+
+static void testLazyDocument() {
+  JsonLazyDocument doc(
+      R"({"a":[1,[2,3],{"b":"x\ty"},"s"],"a":[4,5,6],"n":null})");
+  CHECK(doc.root().size() == 3);
+  CHECK(doc["a"].size() == 3); // the last duplicate wins
+  CHECK(doc["a"][2].get<int>() == 6);
+  CHECK(doc["n"].isNull());
+  CHECK(!doc.root().contains("b"));
+
+  std::string input = "[";
+  for (int i = 0; i < 1000; ++i)
+    input += (i ? ",[" : "[") + std::to_string(i) + ",{\"k\":[" +
+             std::to_string(i) + "]}]";
+  input += "]";
+  doc.parse(input);
+  bool indexed = true;
+  for (size_t i = 0; i < 1000; ++i)
+    indexed = indexed && doc[i][0].get<size_t>() == i &&
+              doc[i][1]["k"][0].get<size_t>() == i;
+  CHECK(indexed);
+  size_t count = 0;
+  for (auto v : doc.root())
+    count += v[1]["k"].size();
+  CHECK(count == 1000);
+  CHECK(doc[999].toNode().serializer().dumps() == R"([999,{"k":[999]}])");
+
+  JsonLazyDocument nested(R"([1,[2,3],{"b":"x\ty"},"s"])");
+  CHECK(nested[2]["b"].str() == "x\ty");
+  CHECK(nested.root().toNode().serializer().dumps() ==
+        R"([1,[2,3],{"b":"x\ty"},"s"])");
+
+  bool threw = false;
+  try {
+    doc.parse(R"([1,[2,3,{"a":4,"b":[5)");
+  } catch (const std::exception &) {
+    threw = true;
+  }
+  CHECK(threw);
+  threw = false;
+  try {
+    doc.root();
+  } catch (const std::exception &) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+// Strings and keys without escapes point into the input, copies own theirs.
+static void testBorrowedKeys() {
+  std::string input =
+      R"({"a long key without escapes":"a long value without escapes",)"
+      R"("an escaped long key\u0021":1,"short":2})";
+  JsonParser parser;
+  JsonNode json = parser.borrowStrings(true).parse(input);
+  const JsonNode &root = json;
+  auto inInput = [&](const char *p) {
+    return p >= input.data() && p < input.data() + input.size();
+  };
+  auto it = root.obj().begin();
+  CHECK(it->first == "a long key without escapes" && inInput(it->first.data()));
+  CHECK(inInput(it->second.get<std::string_view>().data()));
+  ++it;
+  CHECK(it->first == "an escaped long key!" && !inInput(it->first.data()));
+  CHECK(root["a long key without escapes"].str() ==
+        "a long value without escapes");
+  CHECK(root.contains("short"));
+
+  JsonNode copy = json;
+  const JsonKey &key = std::as_const(copy).obj().begin()->first;
+  CHECK(key == "a long key without escapes" && !inInput(key.data()));
+  CHECK(std::string(key.c_str()) == "a long key without escapes");
+  CHECK(copy.serializer().dumps() == json.serializer().dumps());
+
+  // Borrowed strings and keys are not null-terminated, c_str() refuses them.
+  auto refused = [](auto f) {
+    try {
+      f();
+    } catch (const std::logic_error &) {
+      return true;
+    }
+    return false;
+  };
+  CHECK(refused([&] { root["a long key without escapes"].c_str(); }));
+  CHECK(refused([&] { root.obj().begin()->first.c_str(); }));
+  JsonNode owned = parseJsonString(input);
+  CHECK(std::string(owned["a long key without escapes"].c_str()) ==
+        "a long value without escapes");
+}
+
+// Objects built key by key in any order read back complete and ordered, also
+// from several threads at once.
+static void testObjectBuild() {
+  const int n = 1000;
+  JsonNode obj;
+  for (int i = 0; i < n; ++i) {
+    const int k = i * 7919 % n;
+    obj[std::to_string(k)] = k;
+  }
+  obj["5"] = 5; // existing key
+  CHECK(obj.size() == n);
+
+  const JsonNode &view = obj;
+  std::string dumps[2];
+  std::thread reader([&] { dumps[1] = view.serializer().dumps(); });
+  dumps[0] = view.serializer().dumps();
+  reader.join();
+  CHECK(dumps[0] == dumps[1]);
+
+  bool found = true;
+  for (int k = 0; k < n; ++k)
+    found = found && view[std::to_string(k)].get<int>() == k;
+  CHECK(found);
+  if (!JsonObjInsertionOrder)
+    CHECK(std::is_sorted(view.obj().begin(), view.obj().end(),
+                         [](const auto &a, const auto &b) {
+                           return std::string_view(a.first) < b.first;
+                         }));
+  else
+    CHECK(view.obj().begin()->first == "0" &&
+          (view.obj().begin() + 1)->first == "919");
+}
+
+static void testKeys() {
+  const JsonNode json =
+      parseJsonString(R"({"prefix.name":1,"a long key for a buffer":2})");
+  const JsonKey &key = json.find("a long key for a buffer")->first;
+  CHECK(key.substr(2, 4) == "long" && key.find("key") == 7);
+  CHECK(key.find('z') == JsonKey::npos && key.rfind('f') == 20);
+  CHECK(key + "!" == "a long key for a buffer!" && "<" + key + '>' ==
+        "<a long key for a buffer>");
+  const JsonKey &shortKey = json.find("prefix.name")->first;
+  CHECK(shortKey.substr(0, shortKey.find('.')) == "prefix");
+
+  // Iterators yield the stored pairs; values may be assigned through them.
+  static_assert(std::is_same_v<JsonObj_t::iterator::reference,
+                               std::pair<JsonKey, JsonNode> &>);
+  JsonNode mutableJson = json;
+  for (auto &[k, v] : mutableJson.obj())
+    v = k.size();
+  CHECK(mutableJson["prefix.name"].get<size_t>() == 11);
+
+  // The table stops growing, without changing the keys it returns.
+  detail::JsonKeyTable table;
+  std::string longKey(300, 'k');
+  CHECK(table.intern(longKey) == longKey);
+  std::string key100(100, 'x');
+  bool same = true;
+  for (size_t i = 0; i < 50000; ++i) {
+    std::string k = key100 + std::to_string(i);
+    same = same && table.intern(k) == k;
+  }
+  CHECK(same);
+}
+
+// Interned long keys share one buffer across the trees of a parser and stay
+// valid after it is gone; short and very long keys are not interned.
+static void testInternKeys() {
+  const std::string longKey = "a key longer than fourteen bytes";
+  const std::string input = "{\"" + longKey + "\":1,\"" +
+                            std::string(300, 'k') + "\":2,\"short\":3}";
+  auto keyData = [](const JsonNode &json, size_t i) {
+    return (json.obj().begin() + i)->first.data();
+  };
+  JsonNode first, second, other;
+  size_t firstAllocations, secondAllocations;
+  {
+    JsonParser parser;
+    parser.internKeys(true);
+    size_t before = allocations;
+    first = parser.parse(input);
+    firstAllocations = allocations - before;
+    before = allocations;
+    second = parser.parse(input);
+    secondAllocations = allocations - before;
+    parser.releasePool();
+    other = parser.parse(input);
+  }
+  const size_t i = first.obj().find(longKey) - first.obj().begin();
+  const size_t s = first.obj().find("short") - first.obj().begin();
+  const size_t k = first.obj().find(std::string(300, 'k')) -
+                   first.obj().begin();
+  CHECK(keyData(first, i) == keyData(second, i) &&
+        keyData(first, i) != keyData(other, i));
+  CHECK(keyData(first, s) != keyData(second, s) &&
+        keyData(first, k) != keyData(second, k));
+  CHECK(secondAllocations < firstAllocations &&
+        second.serializer().dumps() == input);
+
+  const JsonNode plain = parseJsonString(input);
+  CHECK(keyData(plain, i) != keyData(first, i) &&
+        plain.serializer().dumps() == input);
+}
+
+// Hashed "x"_key lookups agree with string lookups around the index
+// threshold, on parsed and built objects, before and after erasing.
+static void testHashedKeys() {
+  auto key = [](size_t i) { return "k" + std::to_string(i * 7 % 1000); };
+  size_t mismatches = 0;
+  for (size_t n : {15, 16, 17, 40, 1000}) {
+    std::string input = "{";
+    for (size_t i = 0; i < n; ++i)
+      input += (i == 0 ? "\"" : ",\"") + key(i) + "\":" + std::to_string(i);
+    const JsonNode parsed = parseJsonString(input + "}");
+    JsonNode built;
+    for (size_t i = 0; i < n; ++i)
+      built[JsonKeyLiteral_t(key(i))] = i;
+    for (size_t i = 0; i < n; ++i) {
+      const std::string k = key(i);
+      const JsonKeyLiteral_t literal(k);
+      if (built[literal].get<size_t>() != i ||
+          parsed[literal].get<size_t>() != i ||
+          parsed.find(literal)->first != k || !parsed.contains(literal) ||
+          &parsed.at(literal) != &parsed[std::string_view(k)])
+        ++mismatches;
+    }
+    if (parsed.contains("k1000"_key) || built.contains("missing"_key))
+      ++mismatches;
+
+    JsonNode copy = parsed;
+    for (size_t i = 0; i < n; i += 2)
+      copy.obj().erase(key(i));
+    copy["added"_key] = "added";
+    for (size_t i = 0; i < n; ++i) {
+      const std::string k = key(i);
+      if (std::as_const(copy).contains(JsonKeyLiteral_t(k)) != (i % 2 == 1))
+        ++mismatches;
+    }
+    if (std::as_const(copy)["added"_key].str() != "added" ||
+        copy.size() != n / 2 + 1)
+      ++mismatches;
+  }
+  CHECK(mismatches == 0);
+
+  bool threw = false;
+  try {
+    const JsonNode empty = parseJsonString("{}");
+    empty.at("x"_key);
+  } catch (const std::out_of_range &) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+static void testStringViews() {
+  JsonNode json = parseJsonString(R"(["short","a string in a buffer"])");
+  std::string_view v = json[1].view();
+  CHECK(v == "a string in a buffer" && json[1].c_str() == v.data());
+  CHECK(std::as_const(json)[0].str() == "short" && json[0].view() == "short");
+  CHECK(json[1].str().append("!") == "a string in a buffer!");
+  CHECK(json[1].view() == "a string in a buffer!");
+}
+
+// Files parse like the same bytes in memory, whether mapped or read.
+static void testFiles() {
+  const std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "JsonParserTestFile.json";
+  auto write = [&](std::string_view content) {
+    std::ofstream(path, std::ios::binary) << content;
+  };
+  std::string input = "{\"items\":[";
+  for (int i = 0; i < 2000; ++i)
+    input += (i == 0 ? "{\"id\":" : ",{\"id\":") + std::to_string(i) +
+             ",\"name\":\"item " + std::to_string(i) + "\"}";
+  input += "]}";
+  const std::string expected = JsonParser{}.parse(input).serializer().dumps();
+  write(input);
+
+  JsonMappedFile file(path);
+#ifndef JSON_PARSER_NO_MMAP
+  CHECK(file.isOpen() && file.view() == input);
+#endif
+  JsonMappedFile moved(std::move(file));
+  CHECK(!file.isOpen() && moved.view() == (moved.isOpen() ? input : ""));
+  CHECK(parseJsonFile(path).serializer().dumps() == expected);
+  std::ifstream ifs(path, std::ios::binary);
+  CHECK(parseJsonFile(ifs).serializer().dumps() == expected);
+
+  {
+    JsonDocument doc = parseJsonDocumentFile(path, true);
+    moved.close();
+    JsonDocument other = std::move(doc);
+    CHECK(other.root()["items"][1999]["name"].str() == "item 1999" &&
+          other.root().serializer().dumps() == expected);
+  }
+
+  write(input + " x");
+  bool threw = false;
+  try {
+    parseJsonFile(path);
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  CHECK(threw && parseJsonFile(path, false).size() == 1);
+
+  write("");
+  CHECK(!JsonMappedFile(path).isOpen());
+  threw = false;
+  try {
+    parseJsonFile(path);
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  std::filesystem::remove(path);
+  CHECK(threw && !JsonMappedFile(path).isOpen());
+}
+
+// parseParallel gives the tree or the error of a sequential parse, whatever
+// With readAhead, each parse of a multi-document file leaves the stream just
+// past its document, across block boundaries, as a plain stream does.
+static void testReadAhead() {
+  const std::filesystem::path path =
+      std::filesystem::temp_directory_path() / "JsonParserTestDocs.json";
+  std::vector<std::string> docs;
+  std::string content;
+  for (int d = 0; d < 4; ++d) {
+    std::string doc = "[";
+    for (int i = 0; doc.size() < (700u << 10) * (d % 2) + 1000; ++i)
+      doc += (i == 0 ? "\"" : ",\"") + std::to_string(d) + ":" +
+             std::string(i % 100, 'x') + "\"";
+    docs.push_back(doc + "]");
+    content += docs.back() + (d % 2 ? "\n" : " \t\n\n");
+  }
+  std::ofstream(path, std::ios::binary) << content;
+
+  size_t mismatches = 0;
+  for (bool readAhead : {true, false}) {
+    std::ifstream ifs(path, std::ios::binary);
+    JsonParser parser;
+    parser.readAhead(readAhead);
+    for (const std::string &doc : docs)
+      if (parser.parse(ifs, false).serializer().dumps() != doc)
+        ++mismatches;
+    ifs >> std::ws;
+    if (!ifs.eof())
+      ++mismatches;
+  }
+  std::ifstream ifs(path, std::ios::binary);
+  JsonParser parser;
+  parser.readAhead(true);
+  bool threw = false;
+  try {
+    parser.parse(ifs);
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  std::filesystem::remove(path);
+  CHECK(mismatches == 0 && threw);
+}
+
+// the chunk boundaries fall on.
+static void testParseParallel() {
+  std::string input = "[\n";
+  for (int i = 0; input.size() < JsonParser::ParallelMinSize * 2; ++i)
+    input += (i == 0 ? "" : ",\n") + std::string("{\"id\":") +
+             std::to_string(i) + ",\"s\":\"[,]{:}\\\"," + std::to_string(i) +
+             "\\\\\",\"a\":[" + std::to_string(i % 7) + ",[],{}],\"d\":" +
+             std::to_string(i * 0.25) + "}";
+  input += "\n]";
+  auto outcome = [&](std::string_view in, bool parallel) {
+    try {
+      JsonParser parser;
+      parser.borrowStrings(true);
+      JsonNode json = parallel ? parser.parseParallel(in, 4) : parser.parse(in);
+      return json.serializer().dumps();
+    } catch (const std::runtime_error &e) {
+      return std::string("error: ") + e.what();
+    }
+  };
+  CHECK(outcome(input, true) == outcome(input, false));
+
+  size_t mismatches = 0;
+  for (std::string bad :
+       {input + ",", input + " x", input.substr(0, input.size() - 1),
+        input.substr(0, input.size() / 2) + "}" +
+            input.substr(input.size() / 2),
+        input.substr(0, input.size() - 3) + "\"\x01\"}\n]"}) {
+    const std::string expected = outcome(bad, false);
+    if (expected.rfind("error: ", 0) != 0 || outcome(bad, true) != expected)
+      ++mismatches;
+  }
+  CHECK(mismatches == 0);
+  CHECK(outcome("{\"a\":[1,2]}", true) == "{\"a\":[1,2]}" &&
+        outcome("[1,2]", true) == "[1,2]");
+}
+
+static void testJsonLines() {
+  std::string input;
+  for (int i = 0; i < 5000; ++i)
+    input += R"({"id":)" + std::to_string(i) +
+             R"(,"name":"a name longer than inline"})" + "\n\n";
+  JsonLinesReader reader(input, 4, 100);
+  size_t expected = 0;
+  bool inOrder = true;
+  size_t last = 0;
+  for (int batch = 0;; ++batch) {
+    size_t before = allocations;
+    auto &nodes = reader.nextBatch();
+    if (nodes.empty())
+      break;
+    if (batch > 2)
+      last = std::max(last, allocations - before);
+    for (auto &node : nodes)
+      inOrder = inOrder && node["id"].get<size_t>() == expected++;
+  }
+  CHECK(inOrder && expected == 5000);
+  CHECK(last == 0);
+
+  JsonLinesReader bad("[1]\n[2]\n\n[3,\n[4]\n", 2, 10);
+  std::string message;
+  try {
+    reader.forEach([](JsonNode &) {});
+    bad.nextBatch();
+  } catch (const std::exception &e) {
+    message = e.what();
+  }
+  CHECK(message.find("at line 4") != std::string::npos);
+}
+
+// dumpParallel writes what dump writes, with or without indentation, for
+// arrays and objects spanning several chunks.
+static void testDumpParallel() {
+  JsonNode arr, obj;
+  const JsonNode base = parseJsonString(R"({"tags":["a","b\n"],"o":{}})");
+  for (int i = 0; i < 10000; ++i) {
+    JsonNode item = base;
+    item["id"] = i;
+    item["d"] = i * 0.5;
+    item["s"] = std::string(200, 'a' + i % 26);
+    arr.push_back(item);
+    obj["key" + std::to_string(i * 7919 % 10000)] = std::move(item);
+  }
+  JsonNode small = parseJsonString(R"({"a":[1,2,{"b":null}]})");
+  size_t mismatches = 0;
+  for (const JsonNode *json : {&arr, &obj, &small}) {
+    for (int indent : {-1, 0, 2}) {
+      std::ostringstream out;
+      json->serializer().indent(indent).dumpParallel(out, 4);
+      if (out.str() != json->serializer().indent(indent).dumps())
+        ++mismatches;
+    }
+  }
+  CHECK(mismatches == 0);
+}
+
+// Returned strings do not keep a buffer's worth of spare capacity.
+static void testDumps() {
+  std::string small = JsonNode(1).serializer().dumps();
+  CHECK(small == "1" && small.capacity() < 64);
+  JsonNode doubles = parseJsonString("[0.5,0.25,1e-7,2.5]");
+  std::string out = doubles.serializer().dumps();
+  CHECK(out == "[0.5,0.25,1e-07,2.5]" && out.capacity() < 64);
+  CHECK(JsonValueSerializer(std::vector<int>{1, 2}).dumps().capacity() < 64);
+
+  // flush() makes the output readable while the stream is still open.
+  std::string body = "body: ";
+  const std::string expected =
+      "body: [1,\"" + std::string(5000, 'x') + "\"]";
+  {
+    JsonNode::JsonStringOutputStream os(body);
+    JsonWriter w(os);
+    w.beginArray().value(1);
+    w.flush();
+    CHECK(body == "body: [1");
+    w.value(std::string(5000, 'x')).endArray();
+    w.flush();
+    CHECK(body == expected);
+  }
+  CHECK(body == expected);
+  // Leads past U+10FFFF are replaced byte by byte, never half a pair.
+  CHECK(JsonNode("\xF5\x80\x80\x80").serializer().dumps() ==
+        R"("\ufffd\ufffd\ufffd\ufffd")");
+  CHECK(JsonNode("\xF0\x9F\x98\x80").serializer().dumps() ==
+        R"("\ud83d\ude00")");
+}
+
+// Numeric arrays are copied from offset, every stride elements, and never
+// Integers keep every digit up to 64 bits and beyond that become doubles.
+// Doubles on either side of the exact fast path round like strtod.
+static void testNumbers() {
+  auto number = [](std::string_view s) {
+    return JsonParser{}.parse("[" + std::string(s) + "]")[0];
+  };
+  CHECK(number("18446744073709551615").get<uint64_t>() ==
+        18446744073709551615u);
+  CHECK(number("-9223372036854775808").get<int64_t>() == INT64_MIN);
+  CHECK(number("-9223372036854775808").serializer().dumps() ==
+        "-9223372036854775808");
+  CHECK(number("9007199254740993").get<int64_t>() == 9007199254740993);
+  CHECK(number("18446744073709551616").get<double>() ==
+        18446744073709551616.0);
+  CHECK(number("-9223372036854775809").get<double>() ==
+        -9223372036854775808.0);
+  CHECK(number("99999999999999999999").serializer().dumps() == "1e+20");
+
+  size_t mismatches = 0;
+  for (const char *s :
+       {"9007199254740992e22", "9007199254740993e22", "9007199254740991e-22",
+        "9007199254740993e-22", "1e22", "1e23", "1e-22", "1e-23",
+        "123456789012345678e-5", "0.1", "2.2250738585072011e-308",
+        "4.9e-324", "1.7976931348623157e308", "8.988465674311579e307"}) {
+    const double expected = std::strtod(s, nullptr);
+    const double d = number(s).get<double>();
+    if (std::memcmp(&d, &expected, sizeof(d)) != 0)
+      ++mismatches;
+  }
+  CHECK(mismatches == 0);
+
+  size_t failures = 0;
+  for (std::string_view bad : {"1e400", "-1e400", "01", "1.", ".5", "-", "1e+"})
+    failures += JsonParser{}.tryParse("[" + std::string(bad) + "]").failed;
+  CHECK(failures == 7);
+}
+
+// Doubles are written with the fewest digits that parse back to the same bits.
+static void testDoubleRoundTrip() {
+  std::mt19937_64 random(42);
+  JsonNode values;
+  std::vector<double> expected;
+  while (expected.size() < 10000) {
+    const uint64_t bits = random();
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    if (!std::isfinite(d))
+      continue;
+    expected.push_back(d);
+    values.push_back(d);
+  }
+  for (double d : {0.1, 1.0 / 3, 5e-324, 2.2250738585072014e-308,
+                   1.7976931348623157e308, 9007199254740993.0}) {
+    expected.push_back(d);
+    values.push_back(d);
+  }
+
+  const JsonNode copy = JsonParser{}.parse(values.serializer().dumps());
+  size_t mismatches = 0;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    const double d = copy[i].get<double>();
+    if (std::memcmp(&d, &expected[i], sizeof(d)) != 0)
+      ++mismatches;
+  }
+  CHECK(mismatches == 0);
+  CHECK(JsonNode(0.1).serializer().dumps() == "0.1" &&
+        JsonNode(1e300).serializer().dumps() == "1e+300" &&
+        JsonNode(1.0 / 3).serializer().precision(3).dumps() == "0.333");
+}
+
+// past the end of either side.
+static void testNumericArrays() {
+  const JsonNode json = parseJsonString("[1,2,3,4,5,6]");
+  std::vector<double> buf(5, -1);
+  CHECK(json.getInto(buf, 0, 2) == 3 &&
+        buf == std::vector<double>({1, 3, 5, -1, -1}));
+  CHECK(json.getInto(buf, 1, 2) == 3 &&
+        buf == std::vector<double>({2, 4, 6, -1, -1}));
+  CHECK(json.getInto(buf, 6) == 0);
+  float xs[2];
+  CHECK(json.getInto(xs, 2, 3, 10) == 1 && xs[0] == 4);
+
+  // A stride of 0 repeats one element.
+  CHECK(json.get<std::vector<double>>(2, 0, 0) ==
+        std::vector<double>({1, 1}));
+  CHECK(json.getInto(buf.data(), 3, 1, 0) == 3 &&
+        buf == std::vector<double>({2, 2, 2, -1, -1}));
+  const JsonNode strs = parseJsonString(R"(["a","b","c"])");
+  CHECK(strs.get<std::vector<std::string>>(2, 1, 0) ==
+        std::vector<std::string>({"b", "b"}));
+
+  CHECK(json.get<std::vector<int>>(3, 1, 2) == std::vector<int>({2, 4, 6}));
+  CHECK((json.get<std::array<int, 3>>() == std::array<int, 3>{1, 2, 3}));
+  CHECK((json.get<std::array<float, 3>>(-1, 4) ==
+         std::array<float, 3>{5, 6, 0}));
+  CHECK((strs.get<std::array<std::string, 2>>() ==
+         std::array<std::string, 2>{"a", "b"}));
+}
+
+// Any split of a document between two feed() calls, and feeding it byte by
+// byte, gives the tree parse() gives.
+static void testIncremental() {
+  const std::string doc =
+      R"({"a":[1,-2.5e3,"x\u00e9y\n",true,null,[]],"b":{"c":"a string )"
+      R"(longer than the inline capacity"},"d":18446744073709551615})";
+  const std::string expected = parseJsonString(doc).serializer().dumps();
+  bool same = true;
+  for (size_t i = 0; i <= doc.size(); ++i) {
+    JsonParser parser;
+    parser.feed(std::string_view(doc).substr(0, i));
+    same = same && parser.feed(std::string_view(doc).substr(i)) &&
+           parser.finish().serializer().dumps() == expected;
+  }
+  CHECK(same);
+
+  JsonParser parser;
+  bool done = false;
+  for (char c : doc)
+    done = parser.feed(std::string_view(&c, 1));
+  CHECK(done && parser.finish().serializer().dumps() == expected);
+
+  parser.feed(R"({"a":[1,)");
+  bool threw = false;
+  try {
+    parser.finish();
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  CHECK(threw);
+  CHECK(parser.feed("[2]") && parser.finish()[0].get<int>() == 2);
+}
+
+// saxParse reports every value in document order, with decoded strings, and
+// stops at the first handler that returns false.
+static void testSaxParse() {
+  struct Recorder : JsonSaxHandler {
+    std::string log;
+    size_t stopAt = SIZE_MAX;
+    bool add(std::string event) {
+      log += event + ' ';
+      return --stopAt != 0;
+    }
+    bool onNull() { return add("null"); }
+    bool onBool(bool b) { return add(b ? "true" : "false"); }
+    bool onInt64(int64_t i) { return add("i" + std::to_string(i)); }
+    bool onUint64(uint64_t u) { return add("u" + std::to_string(u)); }
+    bool onDouble(double d) { return add("d" + std::to_string(d)); }
+    bool onString(std::string_view s) { return add("s:" + std::string(s)); }
+    bool onKey(std::string_view k) { return add("k:" + std::string(k)); }
+    bool onStartArray() { return add("["); }
+    bool onEndArray() { return add("]"); }
+    bool onStartObject() { return add("{"); }
+    bool onEndObject() { return add("}"); }
+  };
+  const std::string input =
+      R"({"a\tb":[null,true,false,-3,7,0.5,"x\u00e9"],"c":{},"d":[[]]})";
+  const std::string expected = "{ k:a\tb [ null true false i-3 u7 d0.500000 "
+                               "s:x\xC3\xA9 ] k:c { } k:d [ [ ] ] } ";
+  Recorder recorder;
+  CHECK(JsonParser{}.saxParse(input, recorder) && recorder.log == expected);
+  Recorder streamRecorder;
+  std::istringstream is(input);
+  CHECK(JsonParser{}.saxParse(is, streamRecorder) &&
+        streamRecorder.log == expected);
+
+  Recorder stopping;
+  stopping.stopAt = 5;
+  CHECK(!JsonParser{}.saxParse(input, stopping) &&
+        stopping.log == "{ k:a\tb [ null true ");
+
+  bool threw = false;
+  try {
+    Recorder bad;
+    JsonParser{}.saxParse(R"({"a":[1,})", bad);
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+struct Point {
+  double x = 0;
+  std::vector<int> tags;
+  std::optional<std::string> name;
+};
+JSON_PARSER_FIELDS(Point, x, tags, name)
+
+// parseInto fills bound structs and containers, skipping unknown keys.
+static void testParseInto() {
+  Point p;
+  JsonParser{}.parseInto(
+      R"({"x":1.5,"skip":{"q":[1,{}]},"tags":[1,2,3],"name":"p"})", p);
+  CHECK(p.x == 1.5 && p.tags == std::vector<int>({1, 2, 3}) &&
+        p.name == std::string("p"));
+
+  Point q;
+  JsonParser{}.parseInto(jsonSerializer(p).dumps(), q);
+  CHECK(q.x == p.x && q.tags == p.tags && q.name == p.name);
+
+  std::vector<float> samples;
+  JsonParser{}.parseInto("[0.5, 1, -2]", samples);
+  CHECK(samples == std::vector<float>({0.5f, 1.0f, -2.0f}));
+
+  bool threw = false;
+  try {
+    JsonParser{}.parseInto(R"({"x":1.5,"tags":[1,)", q);
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+// A projection keeps the listed paths and the containers leading to them.
+static void testProjection() {
+  const std::string input =
+      R"({"user":{"id":7,"name":"n"},"items":[{"price":1.5,"qty":2},)"
+      R"({"price":3},{"qty":1}],"other":[1,{"price":2}]})";
+  JsonProjection fields{"/user/id", "$.items[*].price"};
+  JsonNode json = JsonParser{}.parse(input, fields);
+  CHECK(json.serializer().dumps() ==
+        parseJsonString(R"({"user":{"id":7},"items":[{"price":1.5},)"
+                        R"({"price":3},{}]})")
+            .serializer()
+            .dumps());
+  CHECK(JsonParser{}.parse(input, JsonProjection{"/missing"}).size() == 0);
+}
+
+// MessagePack round-trips a tree, and every truncation of it is an error.
+static void testMsgPack() {
+  const JsonNode tree = parseJsonString(
+      R"({"i":-5,"big":-9000000000,"u":18446744073709551615,"f":0.5,)"
+      R"("d":0.1,"s":"a string longer than thirty-one bytes, for str8",)"
+      R"("a":[null,true,false,[],{}],"o":{"k":[1,2,3]}})");
+  const std::string bytes = tree.serializer().dumpsMsgPack();
+  const JsonNode copy = JsonParser{}.parseMsgPack(bytes);
+  CHECK(copy.serializer().dumps() == tree.serializer().dumps());
+  CHECK(copy["big"].get<int64_t>() == -9000000000 &&
+        copy["u"].get<uint64_t>() == 18446744073709551615u);
+
+  size_t failures = 0;
+  for (size_t n = 0; n < bytes.size(); ++n) {
+    try {
+      JsonParser{}.parseMsgPack(std::string_view(bytes).substr(0, n));
+    } catch (const std::runtime_error &) {
+      ++failures;
+    }
+  }
+  CHECK(failures == bytes.size());
+
+#ifdef JSON_PARSER_STATS
+  // Each decoded value reports its stats, failures included.
+  struct Hook : JsonStatsHook {
+    std::vector<JsonParseStats> parses;
+    void onParse(const JsonParseStats &s) override { parses.push_back(s); }
+  } hook;
+  JsonParser parser;
+  parser.statsHook(&hook);
+  parser.parseMsgPack(bytes);
+  const JsonParseStats &s = parser.stats();
+  CHECK(!s.failed && s.bytes == bytes.size());
+  CHECK(s.objects == 3 && s.arrays == 3 && s.keys == 9 && s.strings == 1);
+  CHECK(s.nulls == 1 && s.bools == 2 && s.ints == 2 && s.uints == 4 &&
+        s.doubles == 2 && s.maxDepth == 3 && s.heapBlocks > 0);
+  try {
+    parser.parseMsgPack(std::string_view(bytes).substr(0, bytes.size() - 1));
+  } catch (const std::runtime_error &) {
+  }
+  std::istringstream stream(bytes + bytes);
+  parser.parseMsgPack(stream);
+  CHECK(hook.parses.size() == 3 && hook.parses[1].failed &&
+        !hook.parses[2].failed && hook.parses[2].objects == 3);
+#endif
+}
+
+// The 64-byte block scan of contiguous input agrees with the byte-wise scan of
+// streams, for strings and whitespace runs ending at every block offset.
+static void testBlockScan() {
+  struct Piece {
+    std::string_view json, value;
+  };
+  const Piece pieces[] = {{"", ""},
+                          {R"(\n)", "\n"},
+                          {R"(\"\\)", "\"\\"},
+                          {R"(\u00e9)", "\xC3\xA9"},
+                          {R"(\ud83d\ude00)", "\xF0\x9F\x98\x80"},
+                          {"\xC3\xA9", "\xC3\xA9"},
+                          {"\xE2\x82\xAC", "\xE2\x82\xAC"},
+                          {"\xF0\x9F\x98\x80", "\xF0\x9F\x98\x80"}};
+  auto parseStream = [](const std::string &input, std::string &error) {
+    std::istringstream is(input);
+    try {
+      return JsonParser{}.parse(is).serializer().dumps();
+    } catch (const std::runtime_error &e) {
+      error = e.what();
+      return std::string();
+    }
+  };
+  size_t mismatches = 0;
+  for (size_t pad = 0; pad < 130; ++pad) {
+    for (const Piece &p : pieces) {
+      const std::string text = std::string(pad, 'a') + std::string(p.value);
+      const std::string input = std::string(pad, ' ') + "[\n\t\"" +
+                                std::string(pad, 'a') + std::string(p.json) +
+                                "\"" + std::string(pad, ' ') + "]";
+      JsonNode json = JsonParser{}.parse(input);
+      std::string error;
+      if (json[0].str() != text ||
+          json.serializer().dumps() != parseStream(input, error))
+        ++mismatches;
+    }
+    // Control characters, bad escapes and truncated UTF-8 at each offset.
+    for (std::string_view bad : {"\x01", "\\x", "\xC3", "\xE2\x82", "\xFF"}) {
+      const std::string input =
+          "\"" + std::string(pad, 'a') + std::string(bad) + "\"";
+      std::string error;
+      parseStream(input, error);
+      JsonParseResult r = JsonParser{}.tryParse(input);
+      if (!r.failed || error != r.message())
+        ++mismatches;
+    }
+  }
+  CHECK(mismatches == 0);
+}
+
+// tryParse fails exactly where parse throws, with the same message.
+static void testTryParse() {
+  for (std::string_view input :
+       {"", " [ ] ", "{\"a\":1}", "[1,2", "{\"a\":}", "tru", "\"\\x\"",
+        "[1] x", "1e", "\"\xC3\"", "-0.5e-3"}) {
+    JsonParser parser;
+    JsonParseResult r = parser.tryParse(input);
+    std::string error;
+    JsonNode json;
+    try {
+      json = parser.parse(input);
+    } catch (const std::runtime_error &e) {
+      error = e.what();
+    }
+    CHECK(r.failed == !error.empty());
+    CHECK(r ? r.value.serializer().dumps() == json.serializer().dumps()
+            : error == r.message() && r.offset <= input.size());
+  }
+}
+
+// JsonWriter writes what the serializer writes for the same tree.
+static void testWriter() {
+  const JsonNode tree = parseJsonString(
+      R"({"a":[1,-2,0.5,"\u00e9\n",true,null,[],{}],"b":{"c":[{"d":1e300}]}})");
+  for (int indent : {-1, 0, 2}) {
+    std::string out;
+    bool complete[3];
+    {
+      JsonNode::JsonStringOutputStream os(out);
+      JsonWriter w(os);
+      w.indent(indent);
+      complete[0] = w.complete();
+      w.beginObject().key("a").beginArray();
+      complete[1] = w.complete();
+      w.value(1).value(-2).value(0.5).value("\u00e9\n").value(true);
+      w.value(nullptr).beginArray().endArray().beginObject().endObject();
+      w.endArray().key("b").value(tree["b"]).endObject();
+      complete[2] = w.complete();
+    }
+    CHECK(out == tree.serializer().indent(indent).dumps());
+    CHECK(!complete[0] && !complete[1] && complete[2]);
+  }
+
+  std::string out;
+  JsonNode::JsonStringOutputStream os(out);
+  JsonWriter w(os);
+  bool threw = false;
+  try {
+    w.beginObject().value(1);
+  } catch (const std::logic_error &) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+// A missing suite fails the run, unless --skip-suite was given.
+static void testJsonTestSuite() {
   JsonNode json;
   std::string dir = "tests/JSONTestSuite/test_parsing/";
+  const bool found = std::filesystem::exists(dir);
+  if (!found)
+    std::cerr << "Missing " << dir << ", run git submodule update --init\n";
+  CHECK(found);
+  if (!found)
+    return;
 
   int totalTests = 0;
   int passedTests = 0;
@@ -25,4 +1072,41 @@ int main() {
     }
   }
   std::cerr << "Passed " << passedTests << " out of " << totalTests << '\n';
-}
\ No newline at end of file
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || std::string_view(argv[1]) != "--skip-suite")
+    testJsonTestSuite();
+
+  testDocument();
+  testCopyOnWrite();
+  testReclaimer();
+  testRecycle();
+  testLazyDocument();
+  testBorrowedKeys();
+  testKeys();
+  testObjectBuild();
+  testFiles();
+  testReadAhead();
+  testParseParallel();
+  testJsonLines();
+  testInternKeys();
+  testHashedKeys();
+  testStringViews();
+  testDumpParallel();
+  testDumps();
+  testWriter();
+  testNumbers();
+  testDoubleRoundTrip();
+  testNumericArrays();
+  testIncremental();
+  testSaxParse();
+  testParseInto();
+  testProjection();
+  testMsgPack();
+  testBlockScan();
+  testTryParse();
+  std::cerr << "Passed " << passedChecks << " out of " << totalChecks
+            << " checks\n";
+  return passedChecks == totalChecks ? 0 : 1;
+}